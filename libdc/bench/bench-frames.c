@@ -0,0 +1,182 @@
+/*
+ * Part of ncdc - a discord client for the console
+ * Copyright (C) 2019 Florian Stinglmayr <fstinglmayr@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Compares the old websocket frame builder (byte wise masking, two
+ * allocations) with dc_gateway_makeframe_into() writing into a reused
+ * buffer.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include <glib.h>
+
+#include <dc/gateway.h>
+
+static uint8_t *
+old_mask(uint8_t key[4], uint8_t const *pload, size_t psize)
+{
+    size_t i = 0;
+    uint8_t *ret = calloc(psize, sizeof(char));
+
+    for (i = 0; i < psize; i++) {
+        ret[i] = pload[i] ^ key[i % 4];
+    }
+
+    return ret;
+}
+
+static uint8_t *
+old_makeframe(uint8_t const *d, size_t data_len, uint8_t type, size_t *outlen)
+{
+    uint8_t *data = NULL;
+    uint8_t *full_data;
+    uint32_t len_size = 1;
+    uint8_t mkey[4] = { 0x12, 0x34, 0x56, 0x78 };
+
+    data = old_mask(mkey, d, data_len);
+
+    if (data_len > 125) {
+        if (data_len <= UINT16_MAX) {
+            len_size += 2;
+        } else {
+            len_size += 8;
+        }
+    }
+
+    full_data = calloc(1 + data_len + len_size + 4, sizeof(uint8_t));
+    full_data[0] = type;
+
+    if (data_len <= 125) {
+        full_data[1] = data_len | 0x80;
+    } else if (data_len <= G_MAXUINT16) {
+        uint16_t be_len = GUINT16_TO_BE(data_len);
+        full_data[1] = 126 | 0x80;
+        memmove(full_data + 2, &be_len, 2);
+    } else {
+        guint64 be_len = GUINT64_TO_BE(data_len);
+        full_data[1] = 127 | 0x80;
+        memmove(full_data + 2, &be_len, 8);
+    }
+
+    memmove(full_data + (1 + len_size), &mkey, 4);
+    memmove(full_data + (1 + len_size + 4), data, data_len);
+
+    *outlen = 1 + data_len + len_size + 4;
+    free(data);
+
+    return full_data;
+}
+
+static double now(void)
+{
+    struct timespec ts = {0};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* unmask the new frame again, and compare it with the input
+ */
+static int verify(uint8_t const *frame, size_t framelen,
+                  uint8_t const *d, size_t len)
+{
+    uint8_t const *payload = NULL;
+    size_t plen = 0;
+    uint8_t *copy = NULL;
+    int ok = 0;
+
+    if (dc_gateway_parseframe(frame, framelen, NULL, &payload, &plen) == 0) {
+        return 0;
+    }
+
+    /* parseframe() doesn't know about client side masking, so what it
+     * calls the payload starts with the key
+     */
+    if (plen != len || framelen != 4 + (payload - frame) + len) {
+        return 0;
+    }
+
+    copy = malloc(len + 1);
+    dc_gateway_mask(copy, payload + 4, len, payload);
+    ok = (memcmp(copy, d, len) == 0);
+    free(copy);
+
+    return ok;
+}
+
+int main(int ac, char **av)
+{
+    static size_t const sizes[] = { 64, 512, 4096, 65536, 1024 * 1024 };
+    size_t i = 0, n = 0, iter = 0, outlen = 0;
+    uint8_t *data = NULL, *frame = NULL, *f = NULL;
+    double start = 0, t_old = 0, t_new = 0;
+
+    data = malloc(sizes[G_N_ELEMENTS(sizes)-1]);
+    frame = malloc(dc_gateway_frame_size(sizes[G_N_ELEMENTS(sizes)-1]));
+    if (data == NULL || frame == NULL) {
+        return 1;
+    }
+
+    for (i = 0; i < sizes[G_N_ELEMENTS(sizes)-1]; i++) {
+        data[i] = (uint8_t)(i * 31 + 7);
+    }
+
+    printf("%10s %10s %12s %12s %8s\n",
+           "size", "iter", "old MB/s", "new MB/s", "speedup");
+
+    for (n = 0; n < G_N_ELEMENTS(sizes); n++) {
+        size_t len = sizes[n];
+
+        iter = MAX((size_t)1, (size_t)(256 * 1024 * 1024) / len);
+
+        start = now();
+        for (i = 0; i < iter; i++) {
+            f = old_makeframe(data, len, GATEWAY_FRAME_TEXT_DATA, &outlen);
+            free(f);
+        }
+        t_old = now() - start;
+
+        start = now();
+        for (i = 0; i < iter; i++) {
+            outlen = dc_gateway_makeframe_into(
+                frame, dc_gateway_frame_size(len),
+                data, len, GATEWAY_FRAME_TEXT_DATA
+                );
+        }
+        t_new = now() - start;
+
+        if (!verify(frame, outlen, data, len)) {
+            fprintf(stderr, "frame of size %zu does not round trip\n", len);
+            return 1;
+        }
+
+        printf("%10zu %10zu %12.1f %12.1f %7.1fx\n", len, iter,
+               (len * (double)iter) / t_old / 1e6,
+               (len * (double)iter) / t_new / 1e6,
+               t_old / t_new
+            );
+    }
+
+    free(data);
+    free(frame);
+
+    return 0;
+}
@@ -0,0 +1,295 @@
+/*
+ * Part of ncdc - a discord client for the console
+ * Copyright (C) 2019 Florian Stinglmayr <fstinglmayr@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Compares parsing a synthetic READY of 500 guilds as one JSON tree, and
+ * building the objects from it, with streaming it through
+ * dc_ready_loadb(), and dc_ready_loadb_parallel(). Besides the time, it
+ * reports the peak amount of memory jansson had allocated at any one time.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <glib.h>
+#include <jansson.h>
+
+#include <dc/ready.h>
+#include <dc/refable.h>
+
+#define GUILDS    500
+#define CHANNELS  30
+#define ROLES     20
+#define EMOJIS    40
+#define MEMBERS   50
+#define FRIENDS   300
+#define PRIVATE   100
+#define READSTATE 2000
+#define RUNS      5
+
+static size_t live = 0;
+static size_t peak = 0;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* jansson does not tell us the size on free, so keep it in front
+ */
+static void *count_malloc(size_t size)
+{
+    size_t *p = malloc(sizeof(size_t) + size);
+
+    if (p == NULL) {
+        return NULL;
+    }
+
+    *p = size;
+    pthread_mutex_lock(&lock);
+    live += size;
+    peak = MAX(peak, live);
+    pthread_mutex_unlock(&lock);
+
+    return p + 1;
+}
+
+static void count_free(void *ptr)
+{
+    size_t *p = ptr;
+
+    if (p == NULL) {
+        return;
+    }
+
+    --p;
+    pthread_mutex_lock(&lock);
+    live -= *p;
+    pthread_mutex_unlock(&lock);
+    free(p);
+}
+
+static double now(void)
+{
+    struct timespec ts = {0};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void user(GString *s, unsigned id)
+{
+    g_string_append_printf(s,
+        "{\"id\":\"%u\",\"username\":\"user%u\",\"discriminator\":\"%04u\","
+        "\"avatar\":\"0123456789abcdef0123456789abcdef\"}",
+        id, id, id % 10000
+        );
+}
+
+static char *make_ready(size_t *len)
+{
+    GString *s = g_string_new(NULL);
+    unsigned g = 0, i = 0, id = 1000;
+
+    g_string_append(s, "{\"t\":\"READY\",\"s\":1,\"op\":0,\"d\":{\"v\":6,"
+                    "\"session_id\":\"0123456789abcdef\",\"user\":");
+    user(s, 1);
+
+    g_string_append(s, ",\"guilds\":[");
+    for (g = 0; g < GUILDS; g++) {
+        g_string_append_printf(s, "%s{\"id\":\"%u\",\"name\":\"guild %u\","
+                               "\"owner_id\":\"1\",\"member_count\":%u,"
+                               "\"channels\":[", (g ? "," : ""), id++, g,
+                               MEMBERS
+            );
+        for (i = 0; i < CHANNELS; i++) {
+            g_string_append_printf(s, "%s{\"id\":\"%u\",\"type\":0,"
+                                   "\"guild_id\":\"%u\",\"name\":\"chan-%u\","
+                                   "\"position\":%u,\"nsfw\":false,"
+                                   "\"topic\":\"what channel %u is about\","
+                                   "\"last_message_id\":\"%u\","
+                                   "\"permission_overwrites\":[{\"id\":\"%u\","
+                                   "\"type\":\"role\",\"allow\":0,"
+                                   "\"deny\":1024}]}",
+                                   (i ? "," : ""), id, g, i, i, i, id + 1,
+                                   id + 2
+                );
+            id += 3;
+        }
+        g_string_append(s, "],\"roles\":[");
+        for (i = 0; i < ROLES; i++) {
+            g_string_append_printf(s, "%s{\"id\":\"%u\",\"name\":\"role %u\","
+                                   "\"color\":%u,\"hoist\":false,"
+                                   "\"position\":%u,\"permissions\":104324161,"
+                                   "\"managed\":false,\"mentionable\":true}",
+                                   (i ? "," : ""), id++, i, i * 4099, i
+                );
+        }
+        g_string_append(s, "],\"emojis\":[");
+        for (i = 0; i < EMOJIS; i++) {
+            g_string_append_printf(s, "%s{\"id\":\"%u\",\"name\":\"emoji%u\","
+                                   "\"roles\":[],\"require_colons\":true,"
+                                   "\"managed\":false,\"animated\":false}",
+                                   (i ? "," : ""), id++, i
+                );
+        }
+        g_string_append(s, "],\"members\":[");
+        for (i = 0; i < MEMBERS; i++) {
+            g_string_append_printf(s, "%s{\"user\":", (i ? "," : ""));
+            user(s, id++);
+            g_string_append(s, ",\"roles\":[],\"deaf\":false,\"mute\":false,"
+                            "\"joined_at\":\"2019-01-01T00:00:00+00:00\"}");
+        }
+        g_string_append(s, "]}");
+    }
+
+    g_string_append(s, "],\"relationships\":[");
+    for (i = 0; i < FRIENDS; i++) {
+        g_string_append_printf(s, "%s{\"id\":\"%u\",\"type\":1,\"user\":",
+                               (i ? "," : ""), 10 + i
+            );
+        user(s, 10 + i);
+        g_string_append(s, "}");
+    }
+
+    g_string_append(s, "],\"presences\":[");
+    for (i = 0; i < FRIENDS; i++) {
+        g_string_append_printf(s, "%s{\"user\":{\"id\":\"%u\"},"
+                               "\"status\":\"online\",\"activities\":[]}",
+                               (i ? "," : ""), 10 + i
+            );
+    }
+
+    g_string_append(s, "],\"private_channels\":[");
+    for (i = 0; i < PRIVATE; i++) {
+        g_string_append_printf(s, "%s{\"id\":\"%u\",\"type\":1,"
+                               "\"last_message_id\":\"%u\",\"recipients\":[",
+                               (i ? "," : ""), id, id + 1
+            );
+        user(s, 10 + i);
+        g_string_append(s, "]}");
+        id += 2;
+    }
+
+    g_string_append(s, "],\"read_state\":[");
+    for (i = 0; i < READSTATE; i++) {
+        g_string_append_printf(s, "%s{\"id\":\"%u\",\"mention_count\":0,"
+                               "\"last_message_id\":\"%u\"}",
+                               (i ? "," : ""), i, i * 7
+            );
+    }
+
+    g_string_append(s, "]}}");
+
+    *len = s->len;
+    return g_string_free(s, FALSE);
+}
+
+static dc_ready_t tree(char const *data, size_t len)
+{
+    json_t *j = json_loadb(data, len, 0, NULL);
+    dc_ready_t r = dc_ready_from_json(json_object_get(j, "d"));
+
+    json_decref(j);
+    return r;
+}
+
+static dc_ready_t stream(char const *data, size_t len)
+{
+    json_t *op = NULL;
+    dc_ready_t r = dc_ready_loadb(data, len, &op);
+
+    json_decref(op);
+    return r;
+}
+
+static dc_ready_t parallel(char const *data, size_t len)
+{
+    json_t *op = NULL;
+    dc_ready_t r = dc_ready_loadb_parallel(data, len, &op, 0);
+
+    json_decref(op);
+    return r;
+}
+
+static int run(char const *name, dc_ready_t (*f)(char const *, size_t),
+               char const *data, size_t len, dc_ready_t *out)
+{
+    double best = 0, start = 0, t = 0;
+    dc_ready_t r = NULL;
+    size_t i = 0;
+
+    live = peak = 0;
+
+    for (i = 0; i < RUNS; i++) {
+        dc_unref(r);
+
+        start = now();
+        r = f(data, len);
+        t = now() - start;
+
+        if (r == NULL) {
+            fprintf(stderr, "%s: failed to parse READY\n", name);
+            return 1;
+        }
+
+        best = (i == 0 ? t : MIN(best, t));
+    }
+
+    printf("%-8s %10.2f %14.2f %14.2f\n", name, best * 1e3,
+           len / best / 1e6, peak / 1e6
+        );
+
+    *out = r;
+    return 0;
+}
+
+int main(int ac, char **av)
+{
+    size_t len = 0;
+    char *data = NULL;
+    dc_ready_t a = NULL, b = NULL, c = NULL;
+
+    json_set_alloc_funcs(count_malloc, count_free);
+
+    data = make_ready(&len);
+    printf("READY with %d guilds, %.2f MB\n\n", GUILDS, len / 1e6);
+
+    printf("%-8s %10s %14s %14s\n", "", "ms", "MB/s", "peak jansson MB");
+
+    if (run("tree", tree, data, len, &a) ||
+        run("stream", stream, data, len, &b) ||
+        run("parallel", parallel, data, len, &c)) {
+        return 1;
+    }
+
+    if (dc_ready_guilds(a) != dc_ready_guilds(b) ||
+        dc_ready_channels(a) != dc_ready_channels(b) ||
+        dc_ready_friends(a) != dc_ready_friends(b) ||
+        dc_ready_guilds(b) != GUILDS ||
+        dc_ready_guilds(c) != GUILDS ||
+        dc_ready_channels(c) != dc_ready_channels(b)) {
+        fprintf(stderr, "tree, stream, and parallel disagree\n");
+        return 1;
+    }
+
+    dc_unref(a);
+    dc_unref(b);
+    dc_unref(c);
+    g_free(data);
+
+    return 0;
+}
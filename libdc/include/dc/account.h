@@ -24,6 +24,7 @@
 #include <stdlib.h>
 
 #include <jansson.h>
+#include <glib.h>
 
 struct dc_account_;
 typedef struct dc_account_ *dc_account_t;
@@ -66,6 +67,9 @@ dc_account_t dc_account_from_fullname(char const *fullid);
 dc_account_t dc_account_from_json(json_t *j);
 dc_account_t dc_account_from_relationship(json_t *j);
 json_t *dc_account_to_json(dc_account_t a);
+/* same as dc_account_to_json(), but appends the JSON text to "out"
+ */
+bool dc_account_write_json(dc_account_t a, GString *out);
 bool dc_account_load(dc_account_t a, json_t *j);
 
 void dc_account_set_email(dc_account_t a, char const *email);
@@ -100,6 +104,7 @@ bool dc_account_equal(dc_account_t a, dc_account_t b);
  */
 void dc_account_set_friends(dc_account_t a, dc_account_t *ptr, size_t len);
 void dc_account_add_friend(dc_account_t a, dc_account_t friend);
+void dc_account_remove_friend(dc_account_t a, char const *id);
 dc_account_t dc_account_nth_friend(dc_account_t a, size_t i);
 size_t dc_account_friends_size(dc_account_t a);
 dc_account_t dc_account_find_friend(dc_account_t a, char const *fullname);
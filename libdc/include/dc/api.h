@@ -24,8 +24,11 @@
 #include <dc/guild.h>
 #include <dc/channel.h>
 #include <dc/gateway.h>
+#include <dc/share.h>
 
 #include <stdbool.h>
+#include <pthread.h>
+#include <stdint.h>
 
 #include <jansson.h>
 #include <event.h>
@@ -44,6 +47,137 @@ dc_api_t dc_api_new(void);
 void dc_api_set_curl_multi(dc_api_t api, CURLM *curl);
 void dc_api_set_event_base(dc_api_t api, struct event_base *base);
 
+/**
+ * Share DNS, TLS sessions and connections with other handles. Only
+ * affects calls made after this. Transfers still running when the API
+ * is freed must not outlive it.
+ */
+void dc_api_set_share(dc_api_t api, dc_share_t share);
+
+/**
+ * Completion callback of the asynchronous calls (those ending in "_async").
+ * "ok" tells whether the call succeeded. "result" is whatever the call
+ * produced, as documented with each call, or NULL. It is only valid for the
+ * duration of the callback, so take a reference if you want to keep it.
+ *
+ * The asynchronous calls return false, without calling the callback, if
+ * the request could not even be made. Otherwise the callback is called
+ * exactly once.
+ */
+typedef void (*dc_api_callback_t)(dc_api_t api, bool ok, void *result,
+                                  void *data);
+
+/**
+ * Completions are delivered on the thread running the loop by default, so
+ * callbacks must not block, nor call the blocking variants of the API. If
+ * a base is given here, they are delivered by whichever thread runs that
+ * base instead. The base must have been created after evthread was set up.
+ */
+void dc_api_set_callback_base(dc_api_t api, struct event_base *base);
+
+/* GET replies that come with an ETag or Last-Modified header are kept, and
+ * asked for again with If-None-Match/If-Modified-Since. If the server says
+ * nothing has changed, the kept reply is used. They are kept in memory, and
+ * in files below dir if one is given here, so they survive a restart.
+ */
+bool dc_api_set_cache_dir(dc_api_t api, char const *dir);
+
+typedef enum {
+    /* the user is waiting for it, i.e. a message being sent. These go
+     * before all others.
+     */
+    DC_API_PRIORITY_INTERACTIVE = 0,
+    DC_API_PRIORITY_NORMAL,
+    /* nobody is waiting for it, i.e. history fetched ahead of time. Only
+     * a few of these are in flight at once.
+     */
+    DC_API_PRIORITY_BACKGROUND,
+} dc_api_priority_t;
+
+/* priority of the calls this thread makes from now on, which is normal
+ * until set otherwise. Returns the one before, so it can be put back.
+ */
+dc_api_priority_t dc_api_set_priority(dc_api_priority_t priority);
+
+/* milliseconds within which the calls this thread makes from now on have
+ * to be done, or fail with CURLE_OPERATION_TIMEDOUT. That includes retries
+ * and waiting for rate limits. Zero puts back the default of 30 seconds.
+ * Returns the one before.
+ */
+int64_t dc_api_set_timeout(int64_t ms);
+
+/* Handle for calls whose result may stop being of use, i.e. history for a
+ * view that is closed before it arrives. Calls a thread makes after
+ * dc_api_set_cancel() belong to the handle, and dc_api_cancel() ends those
+ * that are not done yet with CURLE_ABORTED_BY_CALLBACK. After that the
+ * handle is forgotten, so it should not be used for new calls. It only
+ * works for APIs that are on a loop. Zero is no handle.
+ */
+typedef uint64_t dc_api_cancel_t;
+
+dc_api_cancel_t dc_api_cancel_new(dc_api_t api);
+dc_api_cancel_t dc_api_set_cancel(dc_api_cancel_t cancel);
+void dc_api_cancel(dc_api_t api, dc_api_cancel_t cancel);
+
+/**
+ * Connection pool statistics of all REST calls that went through this
+ * API object. A call that did not have to open a new connection, because
+ * it was kept alive or multiplexed over HTTP/2, counts as reused.
+ */
+typedef struct {
+    uint64_t requests;
+    uint64_t connects;
+    uint64_t reused;
+    uint64_t http2;
+    /* microseconds spent on TCP and TLS handshakes */
+    uint64_t connect_time;
+    /* times a call was held back, because its rate limit bucket was
+     * empty, and times one was sent again after a 429
+     */
+    uint64_t limited;
+    uint64_t retried;
+    /* GET calls that were answered from the cache
+     */
+    uint64_t cached;
+    /* calls sent again after a server error or a broken connection,
+     * calls that ran out of time, and calls that were cancelled
+     */
+    uint64_t reattempts;
+    uint64_t timedout;
+    uint64_t cancelled;
+} dc_api_stats_t;
+
+void dc_api_stats(dc_api_t api, dc_api_stats_t *stats);
+
+/* one try of a call to get through
+ */
+typedef struct {
+    /* verb and method, with all but the major parameter cut out
+     */
+    char route[96];
+    /* one for the first
+     */
+    int attempt;
+    dc_api_priority_t priority;
+    /* microseconds from making the call until this attempt went out, and
+     * from then until it was done
+     */
+    int64_t waited;
+    int64_t duration;
+    /* CURLcode, and HTTP status, zero if there was no response
+     */
+    int code;
+    long status;
+    /* whether another attempt followed
+     */
+    bool retried;
+} dc_api_attempt_t;
+
+/* copies up to n of the latest attempts, oldest first, and returns how
+ * many there were
+ */
+size_t dc_api_attempts(dc_api_t api, dc_api_attempt_t *out, size_t n);
+
 /* call this function in case the MULTI has told us that some
  * transfer has finished.
  */
@@ -55,10 +189,85 @@ bool dc_api_error(json_t *j, int *code, char const **message);
 dc_api_sync_t dc_api_call(dc_api_t api, char const *token,
                           char const *verb, char const *method,
                           json_t *j);
-json_t *dc_api_call_sync(dc_api_t api, char const *token,
-                         char const *verb, char const *method,
+json_t *dc_api_call_sync(dc_api_t api, char const *verb,
+                         char const *token, char const *method,
                          json_t *j);
 
+/* called on the loop thread, with the CURLcode of the transfer, and the
+ * parsed body, or NULL if there was none
+ */
+typedef void (*dc_api_reply_t)(dc_api_t api, int code, json_t *reply,
+                               void *data);
+bool dc_api_call_async(dc_api_t api, char const *verb,
+                       char const *token, char const *method,
+                       json_t *j, dc_api_reply_t cb, void *data);
+
+/* same, but if the reply is a JSON array, each of its elements is given
+ * to "element" on the loop thread as soon as it has come in, and "cb" gets
+ * no reply. Any other reply (i.e. an error) goes to "cb" as usual.
+ */
+typedef void (*dc_api_element_t)(dc_api_t api, json_t *element, void *data);
+bool dc_api_call_stream(dc_api_t api, char const *verb,
+                        char const *token, char const *method,
+                        json_t *j, dc_api_element_t element,
+                        dc_api_reply_t cb, void *data);
+
+/* same again, but with a body that is already JSON (or NULL for none), and
+ * copied before this returns.
+ */
+bool dc_api_call_buffer(dc_api_t api, char const *verb,
+                        char const *token, char const *method,
+                        char const *body, size_t len,
+                        dc_api_element_t element,
+                        dc_api_reply_t cb, void *data);
+
+/* buffers of the calling thread to build a method and a body in, without
+ * allocating anything once they have grown. Each call empties them, and
+ * they stay valid until the thread's next call.
+ */
+GString *dc_api_scratch_url(void);
+GString *dc_api_scratch_body(void);
+
+/* state of one asynchronous call, "object" is referenced until the call
+ * is complete. "objects" collects what a streamed call has built so far.
+ */
+typedef struct {
+    dc_api_callback_t cb;
+    void *data;
+    void *object;
+    GPtrArray *objects;
+} dc_api_context_t;
+
+dc_api_context_t *dc_api_context_new(dc_api_callback_t cb, void *data,
+                                     void *object);
+void dc_api_context_free(dc_api_context_t *ctx);
+
+/* calls, or posts, the callback of ctx, and frees it. "result" is passed
+ * to "destroy" once the callback is done with it
+ */
+void dc_api_complete(dc_api_t api, dc_api_context_t *ctx, bool ok,
+                     void *result, GDestroyNotify destroy);
+
+/* reply handler of calls that answer with no data if they worked
+ */
+void dc_api_empty_reply(dc_api_t api, int code, json_t *reply, void *arg);
+
+/* the blocking calls are made of the asynchronous ones, and wait on this.
+ * "keep" takes a reference of the result for the waiting thread
+ */
+typedef struct {
+    pthread_mutex_t mtx;
+    pthread_cond_t cnd;
+    bool done;
+    bool ok;
+    void *result;
+    void *(*keep)(void *);
+} dc_api_wait_t;
+
+void dc_api_wait_init(dc_api_wait_t *w, void *(*keep)(void *));
+void dc_api_wait_done(dc_api_t api, bool ok, void *result, void *data);
+bool dc_api_wait(dc_api_wait_t *w);
+
 /**
  * Authenticate a given user account. The user account should have
  * email, and password set. If the auth succeeds the account will have
@@ -67,6 +276,8 @@ json_t *dc_api_call_sync(dc_api_t api, char const *token,
  * authentication.
  */
 bool dc_api_authenticate(dc_api_t api, dc_account_t account);
+bool dc_api_authenticate_async(dc_api_t api, dc_account_t account,
+                               dc_api_callback_t cb, void *data);
 
 /**
  * Log the account in. Will first call dc_api_authenticate(), then
@@ -74,12 +285,16 @@ bool dc_api_authenticate(dc_api_t api, dc_account_t account);
  * any of these steps fail, it returns false.
  */
 bool dc_api_login(dc_api_t api, dc_account_t account);
+bool dc_api_login_async(dc_api_t api, dc_account_t account,
+                        dc_api_callback_t cb, void *data);
 
 /**
  * Inverse of dc_api_authenticate(). Logs the given user out, destroying the
  * login token in the process.
  */
 bool dc_api_logout(dc_api_t api, dc_account_t account);
+bool dc_api_logout_async(dc_api_t api, dc_account_t account,
+                         dc_api_callback_t cb, void *data);
 
 /**
  * Retrieve basic user information for the given account. The first
@@ -90,13 +305,19 @@ bool dc_api_logout(dc_api_t api, dc_account_t account);
  */
 bool dc_api_get_userinfo(dc_api_t api, dc_account_t login,
                          dc_account_t user);
+bool dc_api_get_userinfo_async(dc_api_t api, dc_account_t login,
+                               dc_account_t user,
+                               dc_api_callback_t cb, void *data);
 
 /**
  * Fetch a list of guilds fro the specified login user. Warning if you
  * unref the pointer array, you will also unref all the dc_guild_t objects.
+ * The asynchronous variant passes the GPtrArray as result.
  */
 bool dc_api_get_userguilds(dc_api_t api, dc_account_t login,
                            GPtrArray **guilds);
+bool dc_api_get_userguilds_async(dc_api_t api, dc_account_t login,
+                                 dc_api_callback_t cb, void *data);
 
 /**
  * Set the online status of the currently logged in user "login". "status" must
@@ -105,27 +326,42 @@ bool dc_api_get_userguilds(dc_api_t api, dc_account_t login,
  */
 bool dc_api_set_user_status(dc_api_t api, dc_account_t login,
                             char const *status);
+bool dc_api_set_user_status_async(dc_api_t api, dc_account_t login,
+                                  char const *status,
+                                  dc_api_callback_t cb, void *data);
 
 /**
  * Create a 1:1 or 1:N DM channel with the given recipients. The recipients must
  * have their ID (snowflake) set. Returns the new channel, complete with ID, and
  * all in "channel". Note that the "login" user is automatically added to the DM
- * session, so it is not needed to add him to recipients.
+ * session, so it is not needed to add him to recipients. The asynchronous
+ * variant passes the dc_channel_t as result.
  */
 bool dc_api_create_channel(dc_api_t api, dc_account_t login,
                            dc_account_t *recipients, size_t nrecp,
                            dc_channel_t *channel);
+bool dc_api_create_channel_async(dc_api_t api, dc_account_t login,
+                                 dc_account_t *recipients, size_t nrecp,
+                                 dc_api_callback_t cb, void *data);
 
 /**
- * Fetch 50 messages for the given channel.
+ * Fetch 50 messages for the given channel. The async variant adds them to
+ * the channel right before the callback is called, on the same thread, so
+ * with a callback base they never change under whoever runs that base.
  */
 bool dc_api_get_messages(dc_api_t api, dc_account_t login, dc_channel_t c);
+bool dc_api_get_messages_async(dc_api_t api, dc_account_t login,
+                               dc_channel_t c,
+                               dc_api_callback_t cb, void *data);
 
 /**
  * post a message to the given channel
  */
 bool dc_api_post_message(dc_api_t api, dc_account_t login,
                          dc_channel_t c, dc_message_t m);
+bool dc_api_post_message_async(dc_api_t api, dc_account_t login,
+                               dc_channel_t c, dc_message_t m,
+                               dc_api_callback_t cb, void *data);
 
 /**
  * "ack" a channel, meaning that you have read it its contents. You must provide
@@ -133,17 +369,25 @@ bool dc_api_post_message(dc_api_t api, dc_account_t login,
  */
 bool dc_api_channel_ack(dc_api_t api, dc_account_t login,
                         dc_channel_t c, dc_message_t msg);
+bool dc_api_channel_ack_async(dc_api_t api, dc_account_t login,
+                              dc_channel_t c, dc_message_t msg,
+                              dc_api_callback_t cb, void *data);
 
 /**
  * Fetch a list of friends of the login account "login". The friends are stored
  * within the login object.
  */
 bool dc_api_get_friends(dc_api_t api, dc_account_t login);
+bool dc_api_get_friends_async(dc_api_t api, dc_account_t login,
+                              dc_api_callback_t cb, void *data);
 
 /**
  * Add a given account as a friend to the friends list
  */
 bool dc_api_add_friend(dc_api_t api, dc_account_t login, dc_account_t friend);
+bool dc_api_add_friend_async(dc_api_t api, dc_account_t login,
+                             dc_account_t friend,
+                             dc_api_callback_t cb, void *data);
 
 /**
  * Remove a given account as a friend to the friends list. Warning: The
@@ -153,6 +397,9 @@ bool dc_api_add_friend(dc_api_t api, dc_account_t login, dc_account_t friend);
  */
 bool dc_api_remove_friend(dc_api_t api, dc_account_t login,
                           dc_account_t friend);
+bool dc_api_remove_friend_async(dc_api_t api, dc_account_t login,
+                                dc_account_t friend,
+                                dc_api_callback_t cb, void *data);
 
 /**
  * Accepts someone who has sent a friend request to you, as a friend. Warning:
@@ -161,5 +408,8 @@ bool dc_api_remove_friend(dc_api_t api, dc_account_t login,
  */
 bool dc_api_accept_friend(dc_api_t api, dc_account_t login,
                           dc_account_t friend);
+bool dc_api_accept_friend_async(dc_api_t api, dc_account_t login,
+                                dc_account_t friend,
+                                dc_api_callback_t cb, void *data);
 
 #endif
@@ -21,20 +21,67 @@
 
 #include <curl/curl.h>
 
+#include <jansson.h>
+
 #include <stdio.h>
 #include <stdbool.h>
 
 struct dc_api_sync_;
 typedef struct dc_api_sync_ *dc_api_sync_t;
 
+typedef void (*dc_api_sync_done_t)(dc_api_sync_t sync, void *data);
+typedef void (*dc_api_sync_element_t)(dc_api_sync_t sync, json_t *element,
+                                      void *data);
+
 dc_api_sync_t dc_api_sync_new(CURLM *curl, CURL *easy);
 
+/* called by dc_api_sync_finish(), after all waiters have been woken up
+ */
+void dc_api_sync_set_done(dc_api_sync_t sync, dc_api_sync_done_t done,
+                          void *data);
+
 FILE *dc_api_sync_stream(dc_api_sync_t sync);
 char const *dc_api_sync_data(dc_api_sync_t sync);
 size_t dc_api_sync_datalen(dc_api_sync_t sync);
 int dc_api_sync_code(dc_api_sync_t sync);
 struct curl_slist *dc_api_sync_list(dc_api_sync_t sync);
 
+/* each element of a body that is a JSON array is parsed, and passed to
+ * "element" (along with the data given to dc_api_sync_set_done()), as soon
+ * as it has been received. The array itself is never buffered. Any other
+ * body is buffered as usual.
+ */
+void dc_api_sync_set_element(dc_api_sync_t sync,
+                             dc_api_sync_element_t element);
+
+/* buffer the whole body as well, even if it is split into elements
+ */
+void dc_api_sync_set_buffered(dc_api_sync_t sync, bool buffered);
+
+/* a reply that has already been parsed, i.e. one from the cache, which is
+ * to be used instead of the body
+ */
+void dc_api_sync_set_reply(dc_api_sync_t sync, json_t *reply);
+json_t *dc_api_sync_reply(dc_api_sync_t sync);
+
+/* whether the body was an array, that has gone to the element callback
+ */
+bool dc_api_sync_split_up(dc_api_sync_t sync);
+
+/* CURLOPT_WRITEFUNCTION for the sync given as CURLOPT_WRITEDATA
+ */
+size_t dc_api_sync_write(char *ptr, size_t size, size_t n, void *sync);
+
+/* takes the easy handle away from the sync, so that it is not cleaned up
+ * along with it
+ */
+CURL *dc_api_sync_detach(dc_api_sync_t sync);
+
+/* throws away what has been received so far, so that the transfer can be
+ * done again
+ */
+bool dc_api_sync_reset(dc_api_sync_t sync);
+
 bool dc_api_sync_wait(dc_api_sync_t sync);
 void dc_api_sync_finish(dc_api_sync_t sync, int code);
 
@@ -84,6 +84,10 @@ bool dc_channel_has_recipient(dc_channel_t c, dc_account_t a);
 size_t dc_channel_messages(dc_channel_t c);
 dc_message_t dc_channel_nth_message(dc_channel_t c, size_t i);
 void dc_channel_add_messages(dc_channel_t c, dc_message_t *m, size_t s);
+/* replaces the message with the same id, if the channel has it
+ */
+void dc_channel_update_message(dc_channel_t c, dc_message_t m);
+void dc_channel_remove_message(dc_channel_t c, char const *id);
 
 bool dc_channel_compare(dc_channel_t a, dc_channel_t b);
 
@@ -0,0 +1,48 @@
+/*
+ * Part of ncdc - a discord client for the console
+ * Copyright (C) 2019 Florian Stinglmayr <fstinglmayr@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef DC_ETF_H
+#define DC_ETF_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <jansson.h>
+
+/**
+ * Erlang's External Term Format, which discord calls "etf" or "erlpack".
+ * The decoder turns a term into the same JSON objects the gateway would
+ * have sent us with encoding=json:
+ *
+ *   * maps become objects, lists and tuples become arrays
+ *   * binaries become strings, and so do all atoms except for nil/null,
+ *     true and false
+ *   * big integers (which discord only uses for snowflakes) become strings,
+ *     just like the snowflakes in JSON, all other integers stay integers
+ *
+ * Returns NULL if the data is not a valid term.
+ */
+json_t *dc_etf_decode(uint8_t const *data, size_t len);
+
+/**
+ * Turns a JSON object into a term discord understands. Returns a newly
+ * allocated buffer, and its size in outlen, or NULL on error.
+ */
+uint8_t *dc_etf_encode(json_t *j, size_t *outlen);
+
+#endif
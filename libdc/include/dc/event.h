@@ -22,13 +22,60 @@
 #include <stdint.h>
 #include <jansson.h>
 
+#include <dc/ready.h>
+
 struct dc_event_;
 typedef struct dc_event_ *dc_event_t;
 
 typedef enum {
     DC_EVENT_TYPE_UNKNOWN = 0,
     DC_EVENT_TYPE_READY,
+    DC_EVENT_TYPE_RESUMED,
+    DC_EVENT_TYPE_CHANNEL_CREATE,
+    DC_EVENT_TYPE_CHANNEL_UPDATE,
+    DC_EVENT_TYPE_CHANNEL_DELETE,
+    DC_EVENT_TYPE_CHANNEL_PINS_UPDATE,
+    DC_EVENT_TYPE_CHANNEL_RECIPIENT_ADD,
+    DC_EVENT_TYPE_CHANNEL_RECIPIENT_REMOVE,
+    DC_EVENT_TYPE_GUILD_CREATE,
+    DC_EVENT_TYPE_GUILD_UPDATE,
+    DC_EVENT_TYPE_GUILD_DELETE,
+    DC_EVENT_TYPE_GUILD_BAN_ADD,
+    DC_EVENT_TYPE_GUILD_BAN_REMOVE,
+    DC_EVENT_TYPE_GUILD_EMOJIS_UPDATE,
+    DC_EVENT_TYPE_GUILD_INTEGRATIONS_UPDATE,
+    DC_EVENT_TYPE_GUILD_MEMBER_ADD,
+    DC_EVENT_TYPE_GUILD_MEMBER_REMOVE,
+    DC_EVENT_TYPE_GUILD_MEMBER_UPDATE,
+    DC_EVENT_TYPE_GUILD_MEMBERS_CHUNK,
+    DC_EVENT_TYPE_GUILD_MEMBER_LIST_UPDATE,
+    DC_EVENT_TYPE_GUILD_ROLE_CREATE,
+    DC_EVENT_TYPE_GUILD_ROLE_UPDATE,
+    DC_EVENT_TYPE_GUILD_ROLE_DELETE,
+    DC_EVENT_TYPE_INVITE_CREATE,
+    DC_EVENT_TYPE_INVITE_DELETE,
     DC_EVENT_TYPE_MESSAGE_CREATE,
+    DC_EVENT_TYPE_MESSAGE_UPDATE,
+    DC_EVENT_TYPE_MESSAGE_DELETE,
+    DC_EVENT_TYPE_MESSAGE_DELETE_BULK,
+    DC_EVENT_TYPE_MESSAGE_ACK,
+    DC_EVENT_TYPE_MESSAGE_REACTION_ADD,
+    DC_EVENT_TYPE_MESSAGE_REACTION_REMOVE,
+    DC_EVENT_TYPE_MESSAGE_REACTION_REMOVE_ALL,
+    DC_EVENT_TYPE_MESSAGE_REACTION_REMOVE_EMOJI,
+    DC_EVENT_TYPE_PRESENCE_UPDATE,
+    DC_EVENT_TYPE_PRESENCES_REPLACE,
+    DC_EVENT_TYPE_SESSIONS_REPLACE,
+    DC_EVENT_TYPE_TYPING_START,
+    DC_EVENT_TYPE_RELATIONSHIP_ADD,
+    DC_EVENT_TYPE_RELATIONSHIP_REMOVE,
+    DC_EVENT_TYPE_USER_UPDATE,
+    DC_EVENT_TYPE_USER_SETTINGS_UPDATE,
+    DC_EVENT_TYPE_USER_GUILD_SETTINGS_UPDATE,
+    DC_EVENT_TYPE_USER_NOTE_UPDATE,
+    DC_EVENT_TYPE_VOICE_STATE_UPDATE,
+    DC_EVENT_TYPE_VOICE_SERVER_UPDATE,
+    DC_EVENT_TYPE_WEBHOOKS_UPDATE,
 
     /* ^^^^^^ Make sure events are up there ^^^^^^^ */
     DC_EVENT_TYPE_LAST,
@@ -50,8 +97,27 @@ char const *dc_event_type(dc_event_t e);
 json_t *dc_event_payload(dc_event_t e);
 
 /**
- * Returns an integer code representing the given type string.
+ * The objects of a READY event, if the gateway streamed it. This is NULL
+ * for all other events, and for a READY that was parsed as a whole, in
+ * which case its payload still has everything in it.
+ */
+dc_ready_t dc_event_ready(dc_event_t e);
+void dc_event_set_ready(dc_event_t e, dc_ready_t r);
+
+/**
+ * Returns an integer code representing the type of the event. This is
+ * worked out once when the event is made, so it is cheap to call.
  */
 dc_event_type_t dc_event_type_code(dc_event_t e);
 
+/**
+ * Returns the code of the given type string, or DC_EVENT_TYPE_UNKNOWN.
+ */
+dc_event_type_t dc_event_type_lookup(char const *type);
+
+/**
+ * Returns the type string of the given code, or NULL if there is none.
+ */
+char const *dc_event_type_name(dc_event_type_t t);
+
 #endif
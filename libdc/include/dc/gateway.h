@@ -22,8 +22,12 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include <event.h>
+#include <curl/curl.h>
+
 #include <dc/account.h>
 #include <dc/event.h>
+#include <dc/share.h>
 
 struct dc_gateway_;
 typedef struct dc_gateway_ *dc_gateway_t;
@@ -44,17 +48,144 @@ typedef enum {
     GATEWAY_OPCODE_PING = 1,
     GATEWAY_OPCODE_IDENTIFY = 2,
     GATEWAY_OPCODE_UPDATE = 3,
+    GATEWAY_OPCODE_RESUME = 6,
+    GATEWAY_OPCODE_RECONNECT = 7,
+    GATEWAY_OPCODE_INVALID_SESSION = 9,
     GATEWAY_OPCODE_HELLO = 10,
     GATEWAY_OPCODE_PONG = 11,
 } dc_gateway_opcode_t;
 
 typedef enum {
+    /* Discord splits large payloads into several frames, the first one
+     * is a text frame without the FIN bit, then continuation frames follow
+     * until the one that has the FIN bit set.
+     */
+    GATEWAY_FRAME_CONTINUE = 0,
+    GATEWAY_FRAME_TEXT_DATA_START = 1,
+    GATEWAY_FRAME_BINARY_DATA_START = 2,
+    GATEWAY_FRAME_CONTINUE_END = 128,
     GATEWAY_FRAME_TEXT_DATA = 129,
+    GATEWAY_FRAME_BINARY_DATA = 130,
     GATEWAY_FRAME_DISCONNECT = 136,
     GATEWAY_FRAME_PING = 137,
     GATEWAY_FRAME_PONG = 138,
 } dc_gateway_frames_t;
 
+/**
+ * Connection state of a gateway, as far as reconnecting is concerned.
+ */
+typedef enum {
+    /* not connected, and never tried to
+     */
+    GATEWAY_STATE_DISCONNECTED = 0,
+    /* DNS, TCP, and TLS in progress
+     */
+    GATEWAY_STATE_CONNECTING,
+    /* websocket upgrade request sent, waiting for the response
+     */
+    GATEWAY_STATE_UPGRADING,
+    GATEWAY_STATE_CONNECTED,
+    /* lost the connection, or failed to connect, and waiting for a bit
+     * before trying again
+     */
+    GATEWAY_STATE_BACKOFF,
+    /* failed too often in a row, waiting for a long while before trying
+     * again
+     */
+    GATEWAY_STATE_CIRCUIT_OPEN,
+    /* discord closed the connection with a code that says trying again
+     * is pointless (e.g. a bad token, or intents we may not have), so we
+     * don't. dc_gateway_connect() still does if you ask for it.
+     */
+    GATEWAY_STATE_FAILED,
+} dc_gateway_state_t;
+
+/**
+ * Payload encodings the gateway can speak. ETF is Erlang's binary term
+ * format, which is smaller and cheaper to parse than JSON.
+ */
+typedef enum {
+    GATEWAY_ENCODING_JSON = 0,
+    GATEWAY_ENCODING_ETF,
+} dc_gateway_encoding_t;
+
+/**
+ * How the gateway talks to discord. The curl transport uses CONNECT_ONLY,
+ * and reads into a buffer of our own. The bufferevent transport is done
+ * entirely by libevent and OpenSSL, and parses the frames straight from
+ * the evbuffer. It requires an event base.
+ */
+typedef enum {
+    GATEWAY_TRANSPORT_CURL = 0,
+    GATEWAY_TRANSPORT_BUFFEREVENT,
+} dc_gateway_transport_t;
+
+/**
+ * Gateway intents, these tell discord which groups of events we want to
+ * receive at all. See dc_gateway_set_intents().
+ */
+typedef enum {
+    GATEWAY_INTENT_GUILDS                   = (1 << 0),
+    GATEWAY_INTENT_GUILD_MEMBERS            = (1 << 1),
+    GATEWAY_INTENT_GUILD_BANS               = (1 << 2),
+    GATEWAY_INTENT_GUILD_EMOJIS             = (1 << 3),
+    GATEWAY_INTENT_GUILD_INTEGRATIONS       = (1 << 4),
+    GATEWAY_INTENT_GUILD_WEBHOOKS           = (1 << 5),
+    GATEWAY_INTENT_GUILD_INVITES            = (1 << 6),
+    GATEWAY_INTENT_GUILD_VOICE_STATES       = (1 << 7),
+    GATEWAY_INTENT_GUILD_PRESENCES          = (1 << 8),
+    GATEWAY_INTENT_GUILD_MESSAGES           = (1 << 9),
+    GATEWAY_INTENT_GUILD_MESSAGE_REACTIONS  = (1 << 10),
+    GATEWAY_INTENT_GUILD_MESSAGE_TYPING     = (1 << 11),
+    GATEWAY_INTENT_DIRECT_MESSAGES          = (1 << 12),
+    GATEWAY_INTENT_DIRECT_MESSAGE_REACTIONS = (1 << 13),
+    GATEWAY_INTENT_DIRECT_MESSAGE_TYPING    = (1 << 14),
+    /* without it, messages come with empty content, embeds and
+     * attachments, except those that mention us, or are DMs. Only gateway
+     * v8 and later know it, and it is privileged. We speak v6, where the
+     * content always comes along, so it is never sent.
+     */
+    GATEWAY_INTENT_MESSAGE_CONTENT          = (1 << 15),
+} dc_gateway_intent_t;
+
+/**
+ * Receive, and send statistics of a gateway. A wakeup is one call to
+ * dc_gateway_process(), which reads everything the socket has, and then
+ * dispatches all complete frames.
+ */
+typedef struct {
+    /* number of wakeups so far
+     */
+    uint64_t wakeups;
+
+    /* frames, and bytes received in total
+     */
+    uint64_t frames;
+    uint64_t bytes;
+
+    /* frames, and bytes handled by the last wakeup
+     */
+    size_t last_frames;
+    size_t last_bytes;
+
+    /* current size of the blocks read from the socket, curl transport
+     * only
+     */
+    size_t read_size;
+
+    /* writes done to the socket, and bytes sent with them. Ops queued
+     * together are sent together, so this grows slower than the number
+     * of ops sent.
+     */
+    uint64_t writes;
+    uint64_t bytes_sent;
+
+    /* events dropped by the event filter, with JSON most of them without
+     * being parsed at all
+     */
+    uint64_t filtered;
+} dc_gateway_stats_t;
+
 dc_gateway_t dc_gateway_new(void);
 
 void dc_gateway_set_login(dc_gateway_t gw, dc_account_t login);
@@ -62,12 +193,85 @@ void dc_gateway_set_login(dc_gateway_t gw, dc_account_t login);
 void dc_gateway_set_callback(dc_gateway_t gw, dc_gateway_event_callback_t c,
                              void *userdata);
 
+/**
+ * Enable zlib-stream transport compression. Discord then compresses the
+ * whole connection, which makes READY a lot smaller. Takes effect the next
+ * time the gateway connects.
+ */
+void dc_gateway_set_compress(dc_gateway_t gw, bool compress);
+
+/**
+ * Select the payload encoding, JSON being the default. Either way the
+ * session sees the same json_t objects. Takes effect the next time the
+ * gateway connects.
+ */
+void dc_gateway_set_encoding(dc_gateway_t gw, dc_gateway_encoding_t e);
+
+/**
+ * Give the gateway an event base to register its websocket, and heartbeat
+ * timer with. Once connected, reading, writing and heartbeats are then done
+ * from within the event loop. dc_loop_add_gateway() does this for you.
+ *
+ * READY is then built on worker threads, which report back to the base, so
+ * libevent must have been set up for threads (evthread_use_pthreads()).
+ */
+void dc_gateway_set_event_base(dc_gateway_t gw, struct event_base *base);
+
+/**
+ * Select the transport, the curl one being the default. Takes effect the
+ * next time the gateway connects.
+ */
+void dc_gateway_set_transport(dc_gateway_t gw, dc_gateway_transport_t t);
+
+/**
+ * Intents sent with IDENTIFY, an OR of dc_gateway_intent_t. Zero, which
+ * is the default, sends none, and discord then sends everything. Intents
+ * the gateway version we speak doesn't know are left out.
+ */
+void dc_gateway_set_intents(dc_gateway_t gw, uint32_t intents);
+
+/**
+ * Whether discord should send presence, and typing updates of guild
+ * members. Defaults to true.
+ */
+void dc_gateway_set_guild_subscriptions(dc_gateway_t gw, bool subscribe);
+
+/**
+ * Subscribe to the given event type, e.g. "MESSAGE_CREATE". As soon as at
+ * least one event type is subscribed all other events are dropped, JSON
+ * ones before they are parsed. READY, and RESUMED always come through.
+ */
+void dc_gateway_subscribe(dc_gateway_t gw, char const *type);
+
+/**
+ * Give the gateway a CURL multi handle to connect with. The connection is
+ * then set up without blocking, and the owner of the multi handle must pass
+ * finished transfers to dc_gateway_signal(). dc_loop_add_gateway() does this
+ * for you.
+ */
+void dc_gateway_set_curl_multi(dc_gateway_t gw, CURLM *multi);
+
+/**
+ * Use the given share for DNS lookups and TLS sessions of the curl
+ * transport, so reconnects can resume the previous TLS session. Cannot be
+ * changed while the gateway is connected.
+ */
+void dc_gateway_set_share(dc_gateway_t gw, dc_share_t share);
+
 /**
  * Connect the given gateway. Does nothing if the gateway is already
- * connected.
+ * connected. With a multi handle this only starts connecting, and returns
+ * right away. The websocket handshake is then done from the event loop, and
+ * dc_gateway_connected() returns true once it is complete.
  */
 bool dc_gateway_connect(dc_gateway_t gw);
 
+/**
+ * Tells the gateway that the given transfer of the multi handle has
+ * finished. Returns true if the transfer belonged to the gateway.
+ */
+bool dc_gateway_signal(dc_gateway_t gw, CURL *easy, CURLcode code);
+
 /**
  * Cleans up the easy handle, and thus disconnects from the socket handle
  * immediately. After this call dc_gateway_connected() will return false.
@@ -80,13 +284,36 @@ void dc_gateway_disconnect(dc_gateway_t gw);
 bool dc_gateway_connected(dc_gateway_t gw);
 
 /**
- * Process the queue of data that came from the websocket. Since the
- * gateway handle is not part of whole event_base_loop() shebang, this
- * must be called individually. dc_loop_once() will do this for you, if
- * you opt to use dc_loop() (which you should).
+ * Returns the reconnect state of the gateway.
+ */
+dc_gateway_state_t dc_gateway_state(dc_gateway_t gw);
+
+/**
+ * Microseconds until the next connection attempt is due, 0 if it is due
+ * now, and -1 if the gateway is connected, or has failed for good. dc_loop_t honours this, but
+ * dc_gateway_connect() itself does not.
+ */
+int64_t dc_gateway_reconnect_in(dc_gateway_t gw);
+
+/**
+ * Process the queue of data that came from the websocket. If the gateway
+ * has an event base (see dc_gateway_set_event_base()) this is called for you
+ * whenever the websocket becomes readable. Otherwise you must call this
+ * yourself periodically.
  */
 void dc_gateway_process(dc_gateway_t gw);
 
+/**
+ * Copies the statistics of the gateway into stats.
+ */
+void dc_gateway_stats(dc_gateway_t gw, dc_gateway_stats_t *stats);
+
+/**
+ * Round trip time of the last acknowledged heartbeat in microseconds, or
+ * -1 if no heartbeat has been acknowledged yet.
+ */
+int64_t dc_gateway_latency(dc_gateway_t gw);
+
 /**
  * utility function to make a websocket frame
  */
@@ -94,8 +321,47 @@ uint8_t *
 dc_gateway_makeframe(uint8_t const *d, size_t data_len,
                      uint8_t type, size_t *outlen);
 
+/**
+ * Size of the whole frame (header, key and payload) that
+ * dc_gateway_makeframe_into() builds for a payload of data_len bytes.
+ */
+size_t
+dc_gateway_frame_size(size_t data_len);
+
+/**
+ * Builds a websocket frame into out, which must hold at least
+ * dc_gateway_frame_size() bytes. The payload is masked with a random key
+ * on its way into out. Returns the size of the frame, or 0 if out is too
+ * small.
+ */
+size_t
+dc_gateway_makeframe_into(uint8_t *out, size_t outsize,
+                          uint8_t const *d, size_t data_len, uint8_t type);
+
+/**
+ * XORs len bytes of src with the four byte websocket key into dst. dst and
+ * src may be the same buffer.
+ */
+void
+dc_gateway_mask(uint8_t *dst, uint8_t const *src, size_t len,
+                uint8_t const key[4]);
+
+/**
+ * Parses the header of a websocket frame. Returns the size of the header,
+ * and the size of the payload in outlen, or 0 if data doesn't hold a whole
+ * header yet. Headers are never longer than 14 bytes.
+ */
+size_t
+dc_gateway_parseheader(uint8_t const *data, size_t datalen, uint8_t *type,
+                       size_t *outlen);
+
+/**
+ * Parses one websocket frame from data. Returns the size of the whole frame
+ * or 0 if data doesn't hold a complete frame yet. The payload is not copied:
+ * outdata points into data, and is only valid as long as data is.
+ */
 size_t
-dc_gateway_parseframe(uint8_t const *data, size_t datalen,
-                      uint8_t *type, uint8_t **outdata, size_t *outlen);
+dc_gateway_parseframe(uint8_t const *data, size_t datalen, uint8_t *type,
+                      uint8_t const **outdata, size_t *outlen);
 
 #endif
@@ -32,9 +32,18 @@ typedef struct dc_guild_ *dc_guild_t;
 dc_guild_t dc_guild_new(void);
 dc_guild_t dc_guild_from_json(json_t *j);
 
+/**
+ * A new guild with the same name, id and channels. The session changes
+ * a copy, and replaces the guild with it, so whoever holds the old one
+ * never sees its channels change.
+ */
+dc_guild_t dc_guild_copy(dc_guild_t g);
+
 size_t dc_guild_channels(dc_guild_t d);
 dc_channel_t dc_guild_nth_channel(dc_guild_t d, size_t idx);
 dc_channel_t dc_guild_channel_by_name(dc_guild_t g, char const *name);
+void dc_guild_add_channel(dc_guild_t g, dc_channel_t c);
+void dc_guild_remove_channel(dc_guild_t g, char const *id);
 
 char const *dc_guild_name(dc_guild_t d);
 void dc_guild_set_name(dc_guild_t d, char const *val);
@@ -21,6 +21,7 @@
 
 #include <dc/api.h>
 #include <dc/gateway.h>
+#include <dc/share.h>
 
 #include <event.h>
 #include <curl/curl.h>
@@ -48,6 +49,12 @@ dc_loop_t dc_loop_new_full(struct event_base *base, CURLM *multi);
  */
 CURLM *dc_loop_curl(dc_loop_t l);
 
+/**
+ * Returns the share handle all APIs and gateways of this loop use for
+ * DNS, TLS sessions and connections.
+ */
+dc_share_t dc_loop_share(dc_loop_t l);
+
 /**
  * Returns the event base used by this loop.
  */
@@ -74,8 +81,9 @@ void dc_loop_add_gateway(dc_loop_t loop, dc_gateway_t gw);
 void dc_loop_remove_gateway(dc_loop_t loop, dc_gateway_t gw);
 
 /**
- * Loop once, and process one message in the queues of the event
- * base, and one message from the queue of the CURL multi events.
+ * Loop once. Blocks until the event base has something to do, handles
+ * all active events (including gateway I/O), and then all finished
+ * transfers of the CURL multi handle.
  */
 bool dc_loop_once(dc_loop_t l);
 
@@ -32,6 +32,7 @@ dc_message_t dc_message_new(void);
 dc_message_t dc_message_new_content(char const *s, int len);
 dc_message_t dc_message_from_json(json_t *j);
 json_t *dc_message_to_json(dc_message_t m);
+bool dc_message_write_json(dc_message_t m, GString *out);
 
 char const *dc_message_id(dc_message_t m);
 char const *dc_message_channel_id(dc_message_t m);
@@ -0,0 +1,85 @@
+/*
+ * Part of ncdc - a discord client for the console
+ * Copyright (C) 2019 Florian Stinglmayr <fstinglmayr@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef DC_READY_H
+#define DC_READY_H
+
+#include <dc/account.h>
+#include <dc/channel.h>
+#include <dc/guild.h>
+
+#include <jansson.h>
+#include <stdint.h>
+
+/**
+ * The objects of a READY event. READY is by far the largest payload the
+ * gateway sends, and most of it is guilds, private channels, relationships
+ * and presences. These are collected here as libdc objects, so that the
+ * whole payload never has to exist as one JSON tree.
+ */
+struct dc_ready_;
+typedef struct dc_ready_ *dc_ready_t;
+
+dc_ready_t dc_ready_new(void);
+
+/**
+ * Builds the objects from a READY payload ("d") that has been parsed
+ * already.
+ */
+dc_ready_t dc_ready_from_json(json_t *d);
+
+/**
+ * Streams a whole READY op through a JSON tokenizer. Each guild, channel,
+ * relationship, and presence is parsed on its own, turned into an object,
+ * and thrown away again, so the largest tree that exists is that of one
+ * guild. Other large arrays are skipped without being parsed at all.
+ *
+ * Returns the objects, and in op the op itself, with only the small fields
+ * of "d" left in it (i.e. "session_id", "user", "v" and so on). Returns
+ * NULL if the data is not valid JSON.
+ */
+dc_ready_t dc_ready_load_callback(json_load_callback_t cb, void *arg,
+                                  json_t **op);
+
+dc_ready_t dc_ready_loadb(char const *data, size_t len, json_t **op);
+
+/**
+ * Same as dc_ready_loadb(), but the guilds and private channels are built
+ * by a pool of worker threads, while the calling thread keeps tokenizing.
+ * Zero threads uses one per processor. The guilds, and channels are then
+ * in no particular order. Blocks until everything has been built.
+ */
+dc_ready_t dc_ready_loadb_parallel(char const *data, size_t len,
+                                   json_t **op, unsigned int threads);
+
+size_t dc_ready_guilds(dc_ready_t r);
+dc_guild_t dc_ready_nth_guild(dc_ready_t r, size_t i);
+
+size_t dc_ready_channels(dc_ready_t r);
+dc_channel_t dc_ready_nth_channel(dc_ready_t r, size_t i);
+
+size_t dc_ready_friends(dc_ready_t r);
+dc_account_t dc_ready_nth_friend(dc_ready_t r, size_t i);
+
+/**
+ * Status of the given user according to the presences in READY, or NULL
+ * if there was none.
+ */
+char const *dc_ready_status(dc_ready_t r, char const *id);
+
+#endif
@@ -71,6 +71,36 @@ bool dc_session_is_ready(dc_session_t s);
 
 bool dc_session_has_token(dc_session_t s);
 
+/**
+ * Use zlib-stream compression for the websocket. Must be set before
+ * dc_session_login() is called.
+ */
+void dc_session_set_compress(dc_session_t s, bool compress);
+
+/**
+ * Payload encoding used on the websocket, JSON or ETF. Must be set before
+ * dc_session_login() is called.
+ */
+void dc_session_set_encoding(dc_session_t s, dc_gateway_encoding_t e);
+
+/**
+ * Receive the given event type, even though the session itself does not
+ * handle it. Events that neither the session, nor its user want are not
+ * even sent by discord, or are dropped before they are parsed. Must be set
+ * before dc_session_login() is called.
+ *
+ * PRESENCE_UPDATE is handled by the session (it sets the status of known
+ * accounts), but only asked for once subscribed to, since it needs a
+ * privileged intent and guild subscriptions.
+ */
+void dc_session_subscribe(dc_session_t s, dc_event_type_t t);
+
+/**
+ * Transport used for the websocket, curl or a libevent bufferevent. Must be
+ * set before dc_session_login() is called.
+ */
+void dc_session_set_transport(dc_session_t s, dc_gateway_transport_t t);
+
 /**
  * Returns the currently logged in user. Which is often called "@me" in
  * Discord API.
@@ -83,6 +113,13 @@ dc_account_t dc_session_me(dc_session_t s);
  */
 dc_api_t dc_session_api(dc_session_t s);
 
+/**
+ * Return the gateway of the session, or NULL if not logged in. Same rules
+ * as for dc_session_api() apply. Use this to query dc_gateway_latency() and
+ * dc_gateway_stats().
+ */
+dc_gateway_t dc_session_gateway(dc_session_t s);
+
 /**
  * Queue API. If you enable queuing the session will keep the events from the
  * web socket around for you to handle. Please note that all internal states
@@ -101,7 +138,9 @@ void dc_session_enable_queue(dc_session_t s, bool enable);
 dc_event_t dc_session_pop_event(dc_session_t s);
 
 /**
- * access to the internal account cache
+ * access to the internal account cache. The loop thread changes the caches
+ * while events come in, so whatever is looked up in them is a reference of
+ * its own, which the caller has to dc_unref().
  */
 void dc_session_add_account(dc_session_t s, dc_account_t u);
 void dc_session_add_account_new(dc_session_t s, dc_account_t u);
@@ -114,21 +153,27 @@ dc_account_t dc_session_account_fullname(dc_session_t s, char const *f);
 void dc_session_add_channel(dc_session_t s, dc_channel_t u);
 void dc_session_add_channel_new(dc_session_t s, dc_channel_t u);
 
+/**
+ * Returns a new reference of the channel, or NULL.
+ */
 dc_channel_t dc_session_channel_by_id(dc_session_t s, char const *snowflake);
 
 /**
  * Creates a new channel, or returns an existing channel if a channel with
- * these recipients already exists.
- * Warning: You must dc_ref() the return object if you need it beyond the
- * life-span of the session.
+ * these recipients already exists. Either way the caller owns a reference.
  */
 dc_channel_t dc_session_make_channel(dc_session_t s, dc_account_t *r,
                                      size_t n);
 
 /**
- * Finds a channel object by that match the given recipients.
- * Warning: You must dc_ref() the return object if you need it beyond the
- * life-span of the session.
+ * Calls off fetching the history of a channel that is no longer looked at,
+ * if that is still going on.
+ */
+void dc_session_cancel_channel(dc_session_t s, dc_channel_t c);
+
+/**
+ * Finds a channel object by that match the given recipients. Returns a new
+ * reference, or NULL.
  */
 dc_channel_t dc_session_channel_recipients(dc_session_t s,
                                            dc_account_t *r, size_t sz);
@@ -139,7 +184,16 @@ dc_channel_t dc_session_channel_recipients(dc_session_t s,
  */
 void dc_session_add_guild(dc_session_t s, dc_guild_t g);
 void dc_session_add_guild_new(dc_session_t s, dc_guild_t g);
-GHashTable *dc_session_guilds(dc_session_t s);
+
+/**
+ * The guilds as of now, free with g_ptr_array_unref(). A guild whose
+ * channels change is replaced, so the ones in here never change.
+ */
+GPtrArray *dc_session_guilds(dc_session_t s);
+
+/**
+ * Returns a new reference of the guild, or NULL.
+ */
 dc_guild_t dc_session_guild_by_name(dc_session_t s, char const *name);
 
 /**
@@ -0,0 +1,46 @@
+/*
+ * Part of ncdc - a discord client for the console
+ * Copyright (C) 2019 Florian Stinglmayr <fstinglmayr@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef DC_SHARE_H
+#define DC_SHARE_H
+
+#include <curl/curl.h>
+
+/**
+ * A CURL share handle, so that all API and gateway handles share one DNS
+ * cache, one TLS session cache, and one connection cache. Logging in a
+ * second account, or reconnecting a gateway, then resumes the TLS session
+ * and reuses the lookups of the first, instead of doing it all again.
+ *
+ * The handle is locked internally, so it can be used by transfers running
+ * in different threads. Every dc_loop_t has one, and hands it to all its
+ * APIs and gateways.
+ */
+struct dc_share_;
+typedef struct dc_share_ *dc_share_t;
+
+dc_share_t dc_share_new(void);
+
+CURLSH *dc_share_curl(dc_share_t share);
+
+/**
+ * Makes the given easy handle use the share. The easy handle must be
+ * cleaned up before the last reference to the share goes away.
+ */
+void dc_share_attach(dc_share_t share, CURL *easy);
+
+#endif
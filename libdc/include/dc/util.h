@@ -20,7 +20,17 @@
 #define NCDC_UTIL_H
 
 #include <jansson.h>
+#include <glib.h>
 
 void dc_util_dump_json(json_t *j);
 
+/**
+ * Writes JSON straight into a string, for when building a json_t only to
+ * dump it again would be a waste. dc_util_json_key() adds the separating
+ * comma, if it is not the first member of the object. A NULL string is
+ * written as null.
+ */
+void dc_util_json_string(GString *out, char const *s);
+void dc_util_json_key(GString *out, char const *key);
+
 #endif
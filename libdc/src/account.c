@@ -219,6 +219,31 @@ json_t *dc_account_to_json(dc_account_t a)
     return j;
 }
 
+bool dc_account_write_json(dc_account_t a, GString *out)
+{
+    return_if_true(a == NULL || out == NULL, false);
+    return_if_true(dc_account_username(a) == NULL ||
+                   dc_account_discriminator(a) == NULL,
+                   false
+        );
+
+    g_string_append_c(out, '{');
+
+    if (a->id != NULL) {
+        dc_util_json_key(out, "id");
+        dc_util_json_string(out, a->id);
+    }
+
+    dc_util_json_key(out, "username");
+    dc_util_json_string(out, a->username);
+    dc_util_json_key(out, "discriminator");
+    dc_util_json_string(out, a->discriminator);
+
+    g_string_append_c(out, '}');
+
+    return true;
+}
+
 void dc_account_set_email(dc_account_t a, char const *email)
 {
     return_if_true(a == NULL,);
@@ -387,6 +412,20 @@ void dc_account_add_friend(dc_account_t a, dc_account_t friend)
     g_ptr_array_add(a->friends, dc_ref(friend));
 }
 
+void dc_account_remove_friend(dc_account_t a, char const *id)
+{
+    size_t i = 0;
+    return_if_true(a == NULL || a->friends == NULL || id == NULL,);
+
+    for (i = 0; i < a->friends->len; i++) {
+        dc_account_t f = g_ptr_array_index(a->friends, i);
+        if (f->id != NULL && strcmp(f->id, id) == 0) {
+            g_ptr_array_remove_index(a->friends, i);
+            return;
+        }
+    }
+}
+
 dc_account_t dc_account_nth_friend(dc_account_t a, size_t i)
 {
     return_if_true(a == NULL || a->friends == NULL, NULL);
@@ -19,94 +19,196 @@
 #include <dc/api.h>
 #include "internal.h"
 
-bool dc_api_logout(dc_api_t api, dc_account_t account)
+static void dc_api_logout_reply(dc_api_t api, int code,
+                                json_t *reply, void *arg)
 {
-    json_t *reply = NULL;
-    json_t *data = NULL;
+    dc_api_context_t *ctx = (dc_api_context_t*)arg;
+    bool ret = (code == CURLE_OK && reply == NULL);
 
-    data = json_object();
-    return_if_true(data == NULL, false);
+    /* TODO: parse error
+     */
+    if (ret) {
+        dc_account_set_token((dc_account_t)ctx->object, NULL);
+    }
 
-    json_object_set_new(data, "provider", json_null());
-    json_object_set_new(data, "voip_provider", json_null());
+    dc_api_complete(api, ctx, ret, NULL, NULL);
+}
 
-    reply = dc_api_call_sync(api, "POST", dc_account_token(account),
-                             "auth/logout", data
-        );
-    json_decref(data);
+bool dc_api_logout_async(dc_api_t api, dc_account_t account,
+                         dc_api_callback_t cb, void *data)
+{
+    static char const body[] = "{\"provider\":null,\"voip_provider\":null}";
+    dc_api_context_t *ctx = NULL;
+
+    return_if_true(api == NULL || account == NULL, false);
 
-    if (reply != NULL) {
-        /* TODO: parse error
-         */
-        json_decref(reply);
+    ctx = dc_api_context_new(cb, data, account);
+    return_if_true(ctx == NULL, false);
+
+    if (!dc_api_call_buffer(api, "POST", dc_account_token(account),
+                            "auth/logout", body, sizeof(body) - 1,
+                            NULL, dc_api_logout_reply, ctx)) {
+        dc_api_context_free(ctx);
         return false;
     }
 
-    dc_account_set_token(account, NULL);
     return true;
 }
 
-bool dc_api_login(dc_api_t api, dc_account_t account)
+bool dc_api_logout(dc_api_t api, dc_account_t account)
 {
-    if (!dc_api_authenticate(api, account)) {
-        goto cleanup;
+    dc_api_wait_t w;
+
+    dc_api_wait_init(&w, NULL);
+    if (!dc_api_logout_async(api, account, dc_api_wait_done, &w)) {
+        dc_api_wait_done(api, false, NULL, &w);
     }
 
-    if (!dc_api_get_userinfo(api, account, account)) {
-        goto cleanup;
+    return dc_api_wait(&w);
+}
+
+/* logging in is three calls in a row, each one started from the
+ * completion of the one before
+ */
+static void dc_api_login_done(dc_api_t api, bool ok, void *result,
+                              void *arg)
+{
+    dc_api_context_t *ctx = (dc_api_context_t*)arg;
+
+    if (!ok) {
+        dc_account_set_token((dc_account_t)ctx->object, NULL);
     }
 
-    if (!dc_api_get_friends(api, account)) {
-        goto cleanup;
+    dc_api_complete(api, ctx, ok, NULL, NULL);
+}
+
+static void dc_api_login_userinfo(dc_api_t api, bool ok, void *result,
+                                  void *arg)
+{
+    dc_api_context_t *ctx = (dc_api_context_t*)arg;
+    dc_account_t account = (dc_account_t)ctx->object;
+
+    if (ok && dc_api_get_friends_async(api, account,
+                                       dc_api_login_done, ctx)) {
+        return;
     }
 
-    return true;
+    dc_api_login_done(api, false, NULL, ctx);
+}
 
-cleanup:
+static void dc_api_login_authenticated(dc_api_t api, bool ok, void *result,
+                                       void *arg)
+{
+    dc_api_context_t *ctx = (dc_api_context_t*)arg;
+    dc_account_t account = (dc_account_t)ctx->object;
 
-    dc_account_set_token(account, NULL);
+    if (ok && dc_api_get_userinfo_async(api, account, account,
+                                        dc_api_login_userinfo, ctx)) {
+        return;
+    }
 
-    return false;
+    dc_api_login_done(api, false, NULL, ctx);
 }
 
-bool dc_api_authenticate(dc_api_t api, dc_account_t account)
+bool dc_api_login_async(dc_api_t api, dc_account_t account,
+                        dc_api_callback_t cb, void *data)
 {
-    json_t *j = json_object(), *reply = NULL, *token = NULL;
-    bool ret = false;
+    dc_api_context_t *ctx = NULL;
 
-    json_object_set_new(j, "email",
-                        json_string(dc_account_email(account))
-        );
-    json_object_set_new(j, "password",
-                        json_string(dc_account_password(account))
-        );
+    return_if_true(api == NULL || account == NULL, false);
 
-    reply = dc_api_call_sync(api, "POST", NULL, "auth/login", j);
-    goto_if_true(reply == NULL, cleanup);
+    ctx = dc_api_context_new(cb, data, account);
+    return_if_true(ctx == NULL, false);
 
-    if (dc_api_error(j, NULL, NULL)) {
+    if (!dc_api_authenticate_async(api, account,
+                                   dc_api_login_authenticated, ctx)) {
+        dc_api_context_free(ctx);
         return false;
     }
 
-    token = json_object_get(reply, "token");
-    if (token == NULL || !json_is_string(token)) {
-        goto cleanup;
+    return true;
+}
+
+bool dc_api_login(dc_api_t api, dc_account_t account)
+{
+    dc_api_wait_t w;
+
+    dc_api_wait_init(&w, NULL);
+    if (!dc_api_login_async(api, account, dc_api_wait_done, &w)) {
+        dc_account_set_token(account, NULL);
+        dc_api_wait_done(api, false, NULL, &w);
     }
 
-    dc_account_set_token(account, json_string_value(token));
+    return dc_api_wait(&w);
+}
+
+static void dc_api_authenticate_reply(dc_api_t api, int code,
+                                      json_t *reply, void *arg)
+{
+    dc_api_context_t *ctx = (dc_api_context_t*)arg;
+    json_t *token = NULL;
+    bool ret = false;
+
+    goto_if_true(code != CURLE_OK || reply == NULL, cleanup);
+    goto_if_true(dc_api_error(reply, NULL, NULL), cleanup);
+
+    token = json_object_get(reply, "token");
+    goto_if_true(token == NULL || !json_is_string(token), cleanup);
+
+    dc_account_set_token((dc_account_t)ctx->object,
+                         json_string_value(token)
+        );
     ret = true;
 
 cleanup:
 
-    if (j != NULL) {
-        json_decref(j);
-        j = NULL;
-    }
+    dc_api_complete(api, ctx, ret, NULL, NULL);
+}
+
+bool dc_api_authenticate_async(dc_api_t api, dc_account_t account,
+                               dc_api_callback_t cb, void *data)
+{
+    GString *body = NULL;
+    dc_api_context_t *ctx = NULL;
+    bool ret = false;
+
+    return_if_true(api == NULL || account == NULL, false);
+
+    body = dc_api_scratch_body();
+    return_if_true(body == NULL, false);
+
+    g_string_append_c(body, '{');
+    dc_util_json_key(body, "email");
+    dc_util_json_string(body, dc_account_email(account));
+    dc_util_json_key(body, "password");
+    dc_util_json_string(body, dc_account_password(account));
+    g_string_append_c(body, '}');
+
+    ctx = dc_api_context_new(cb, data, account);
+    goto_if_true(ctx == NULL, cleanup);
+
+    ret = dc_api_call_buffer(api, "POST", NULL, "auth/login",
+                             body->str, body->len,
+                             NULL, dc_api_authenticate_reply, ctx
+        );
+
+cleanup:
 
-    if (reply != NULL) {
-        json_decref(reply);
-        reply = NULL;
+    if (!ret) {
+        dc_api_context_free(ctx);
     }
 
     return ret;
 }
+
+bool dc_api_authenticate(dc_api_t api, dc_account_t account)
+{
+    dc_api_wait_t w;
+
+    dc_api_wait_init(&w, NULL);
+    if (!dc_api_authenticate_async(api, account, dc_api_wait_done, &w)) {
+        dc_api_wait_done(api, false, NULL, &w);
+    }
+
+    return dc_api_wait(&w);
+}
@@ -20,158 +20,324 @@
 
 #include "internal.h"
 
-bool dc_api_channel_ack(dc_api_t api, dc_account_t login,
-                        dc_channel_t c, dc_message_t m)
+bool dc_api_channel_ack_async(dc_api_t api, dc_account_t login,
+                              dc_channel_t c, dc_message_t m,
+                              dc_api_callback_t cb, void *data)
 {
     bool ret = false;
-    char *url = NULL;
-    json_t *reply = NULL, *j = NULL;
+    GString *url = NULL, *body = NULL;
+    dc_api_context_t *ctx = NULL;
 
     return_if_true(api == NULL || login == NULL ||
                    c == NULL || m == NULL, false);
 
-    asprintf(&url, "channels/%s/messages/%s/ack",
-             dc_channel_id(c),
-             dc_message_id(m)
+    url = dc_api_scratch_url();
+    body = dc_api_scratch_body();
+    goto_if_true(url == NULL || body == NULL, cleanup);
+
+    g_string_printf(url, "channels/%s/messages/%s/ack",
+                    dc_channel_id(c),
+                    dc_message_id(m)
         );
-    goto_if_true(url == NULL, cleanup);
 
-    j = json_object();
-    goto_if_true(j == NULL, cleanup);
-    json_object_set_new(j, "token", json_string(TOKEN(login)));
+    g_string_append_c(body, '{');
+    dc_util_json_key(body, "token");
+    dc_util_json_string(body, TOKEN(login));
+    g_string_append_c(body, '}');
 
-    reply = dc_api_call_sync(api, "POST", TOKEN(login), url, j);
-    goto_if_true(reply != NULL, cleanup);
+    ctx = dc_api_context_new(cb, data, NULL);
+    goto_if_true(ctx == NULL, cleanup);
 
-    ret = true;
+    ret = dc_api_call_buffer(api, "POST", TOKEN(login), url->str,
+                             body->str, body->len,
+                             NULL, dc_api_empty_reply, ctx
+        );
 
 cleanup:
 
-    free(url);
-    json_decref(reply);
-    json_decref(j);
+    if (!ret) {
+        dc_api_context_free(ctx);
+    }
 
     return ret;
 }
 
-bool dc_api_post_message(dc_api_t api, dc_account_t login,
-                         dc_channel_t c, dc_message_t m)
+bool dc_api_channel_ack(dc_api_t api, dc_account_t login,
+                        dc_channel_t c, dc_message_t m)
+{
+    dc_api_wait_t w;
+
+    dc_api_wait_init(&w, NULL);
+    if (!dc_api_channel_ack_async(api, login, c, m, dc_api_wait_done, &w)) {
+        dc_api_wait_done(api, false, NULL, &w);
+    }
+
+    return dc_api_wait(&w);
+}
+
+bool dc_api_post_message_async(dc_api_t api, dc_account_t login,
+                               dc_channel_t c, dc_message_t m,
+                               dc_api_callback_t cb, void *data)
 {
     bool ret = false;
-    char *url = NULL;
-    json_t *j = NULL, *reply = NULL;
+    GString *url = NULL, *body = NULL;
+    dc_api_context_t *ctx = NULL;
 
     return_if_true(api == NULL || login == NULL || m == NULL, false);
     return_if_true(dc_message_content(m) == NULL, false);
 
-    asprintf(&url, "channels/%s/messages", dc_channel_id(c));
-    goto_if_true(url == NULL, cleanup);
+    url = dc_api_scratch_url();
+    body = dc_api_scratch_body();
+    goto_if_true(url == NULL || body == NULL, cleanup);
 
-    j = dc_message_to_json(m);
-    goto_if_true(j == NULL, cleanup);
+    g_string_printf(url, "channels/%s/messages", dc_channel_id(c));
+    goto_if_true(!dc_message_write_json(m, body), cleanup);
 
-    reply = dc_api_call_sync(api, "POST", TOKEN(login), url, j);
-    goto_if_true(reply != NULL, cleanup);
+    ctx = dc_api_context_new(cb, data, NULL);
+    goto_if_true(ctx == NULL, cleanup);
 
-    ret = true;
+    ret = dc_api_call_buffer(api, "POST", TOKEN(login), url->str,
+                             body->str, body->len,
+                             NULL, dc_api_empty_reply, ctx
+        );
 
 cleanup:
 
-    free(url);
-    json_decref(j);
-    json_decref(reply);
+    if (!ret) {
+        dc_api_context_free(ctx);
+    }
 
     return ret;
 }
 
-bool dc_api_get_messages(dc_api_t api, dc_account_t login, dc_channel_t c)
+bool dc_api_post_message(dc_api_t api, dc_account_t login,
+                         dc_channel_t c, dc_message_t m)
 {
-    bool ret = false;
-    char *url = NULL;
-    json_t *reply = NULL, *i = NULL;
-    GPtrArray *msgs = NULL;
-    size_t idx = 0;
+    dc_api_wait_t w;
 
-    return_if_true(api == NULL || login == NULL || c == NULL, false);
+    dc_api_wait_init(&w, NULL);
+    if (!dc_api_post_message_async(api, login, c, m, dc_api_wait_done, &w)) {
+        dc_api_wait_done(api, false, NULL, &w);
+    }
 
-    msgs = g_ptr_array_new_with_free_func((GDestroyNotify)dc_unref);
-    goto_if_true(msgs == NULL, cleanup);
+    return dc_api_wait(&w);
+}
 
-    asprintf(&url, "channels/%s/messages", dc_channel_id(c));
-    goto_if_true(url == NULL, cleanup);
+static void dc_api_get_messages_element(dc_api_t api, json_t *j, void *arg)
+{
+    dc_api_context_t *ctx = (dc_api_context_t*)arg;
+    dc_message_t m = dc_message_from_json(j);
 
-    reply = dc_api_call_sync(api, "GET", TOKEN(login), url, NULL);
-    goto_if_true(reply == NULL, cleanup);
-    goto_if_true(!json_is_array(reply), cleanup);
+    if (m != NULL) {
+        g_ptr_array_add(ctx->objects, m);
+    }
+}
 
-    json_array_foreach(reply, idx, i) {
-        dc_message_t m = dc_message_from_json(i);
-        g_ptr_array_add(msgs, m);
+/* what an async fetch needs to add the messages wherever its callback
+ * runs, and not on the loop thread behind the back of whoever reads them
+ */
+typedef struct {
+    dc_channel_t channel;
+    dc_api_callback_t cb;
+    void *data;
+} dc_api_messages_t;
+
+static void dc_api_get_messages_add(dc_api_t api, bool ok,
+                                    void *result, void *arg)
+{
+    dc_api_messages_t *m = (dc_api_messages_t*)arg;
+    GPtrArray *messages = (GPtrArray*)result;
+
+    if (ok && messages != NULL) {
+        dc_channel_add_messages(m->channel, (dc_message_t*)messages->pdata,
+                                messages->len
+            );
+    }
+
+    if (m->cb != NULL) {
+        m->cb(api, ok, NULL, m->data);
     }
 
-    dc_channel_add_messages(c, (dc_message_t*)msgs->pdata, msgs->len);
+    dc_unref(m->channel);
+    free(m);
+}
+
+static void dc_api_get_messages_reply(dc_api_t api, int code,
+                                      json_t *reply, void *arg)
+{
+    dc_api_context_t *ctx = (dc_api_context_t*)arg;
+    dc_channel_t c = (dc_channel_t)ctx->object;
+    bool ret = false;
+
+    /* the messages have been built while they came in, so only errors
+     * end up as reply here
+     */
+    goto_if_true(code != CURLE_OK || reply != NULL, cleanup);
     ret = true;
 
+    if (ctx->cb == dc_api_get_messages_add) {
+        dc_api_complete(api, ctx, ret, g_ptr_array_ref(ctx->objects),
+                        (GDestroyNotify)g_ptr_array_unref
+            );
+        return;
+    }
+
+    /* whoever waits for this is blocked until it is done
+     */
+    dc_channel_add_messages(c, (dc_message_t*)ctx->objects->pdata,
+                            ctx->objects->len
+        );
+
 cleanup:
 
-    if (msgs != NULL) {
-        g_ptr_array_unref(msgs);
-        msgs = NULL;
+    dc_api_complete(api, ctx, ret, NULL, NULL);
+}
+
+bool dc_api_get_messages_async(dc_api_t api, dc_account_t login,
+                               dc_channel_t c,
+                               dc_api_callback_t cb, void *data)
+{
+    bool ret = false;
+    GString *url = NULL;
+    dc_api_context_t *ctx = NULL;
+    dc_api_messages_t *m = NULL;
+
+    return_if_true(api == NULL || login == NULL || c == NULL, false);
+
+    url = dc_api_scratch_url();
+    goto_if_true(url == NULL, cleanup);
+    g_string_printf(url, "channels/%s/messages", dc_channel_id(c));
+
+    if (cb == dc_api_wait_done) {
+        ctx = dc_api_context_new(cb, data, c);
+    } else {
+        m = calloc(1, sizeof(dc_api_messages_t));
+        goto_if_true(m == NULL, cleanup);
+
+        m->channel = dc_ref(c);
+        m->cb = cb;
+        m->data = data;
+
+        ctx = dc_api_context_new(dc_api_get_messages_add, m, c);
     }
+    goto_if_true(ctx == NULL, cleanup);
+
+    ctx->objects = g_ptr_array_new_with_free_func((GDestroyNotify)dc_unref);
+    goto_if_true(ctx->objects == NULL, cleanup);
 
-    json_decref(reply);
-    free(url);
+    ret = dc_api_call_buffer(api, "GET", TOKEN(login), url->str, NULL, 0,
+                             dc_api_get_messages_element,
+                             dc_api_get_messages_reply, ctx
+        );
+
+cleanup:
+
+    if (!ret) {
+        dc_api_context_free(ctx);
+        if (m != NULL) {
+            dc_unref(m->channel);
+            free(m);
+        }
+    }
 
     return ret;
 }
 
-bool dc_api_create_channel(dc_api_t api, dc_account_t login,
-                           dc_account_t *recipients, size_t nrecp,
-                           dc_channel_t *channel)
+bool dc_api_get_messages(dc_api_t api, dc_account_t login, dc_channel_t c)
+{
+    dc_api_wait_t w;
+
+    dc_api_wait_init(&w, NULL);
+    if (!dc_api_get_messages_async(api, login, c, dc_api_wait_done, &w)) {
+        dc_api_wait_done(api, false, NULL, &w);
+    }
+
+    return dc_api_wait(&w);
+}
+
+static void dc_api_create_channel_reply(dc_api_t api, int code,
+                                        json_t *reply, void *arg)
 {
-    bool ret = false;
-    json_t *data = NULL, *array = NULL, *reply = NULL;
-    char *url = NULL;
     dc_channel_t c = NULL;
-    size_t i = 0;
 
-    return_if_true(api == NULL || login == NULL || channel == NULL, false);
+    if (code == CURLE_OK && reply != NULL) {
+        c = dc_channel_from_json(reply);
+    }
 
-    asprintf(&url, "users/%s/channels", dc_account_id(login));
-    goto_if_true(url == NULL, cleanup);
+    dc_api_complete(api, arg, (c != NULL), c, dc_unref);
+}
+
+bool dc_api_create_channel_async(dc_api_t api, dc_account_t login,
+                                 dc_account_t *recipients, size_t nrecp,
+                                 dc_api_callback_t cb, void *data)
+{
+    bool ret = false;
+    GString *url = NULL, *body = NULL;
+    size_t i = 0, n = 0;
+    dc_api_context_t *ctx = NULL;
+
+    return_if_true(api == NULL || login == NULL, false);
+
+    url = dc_api_scratch_url();
+    body = dc_api_scratch_body();
+    goto_if_true(url == NULL || body == NULL, cleanup);
+
+    g_string_printf(url, "users/%s/channels", dc_account_id(login));
 
     /* build a JSON object that contains one array called "recipients":
      * {"recipients": ["snowflake#1", ..., "snowflake#N"]}
      */
-    data = json_object();
-    array = json_array();
-    goto_if_true(data == NULL || array == NULL, cleanup);
-
+    g_string_append(body, "{\"recipients\":[");
     for (i = 0; i < nrecp; i++) {
-        dc_account_t r = recipients[0];
-        if (dc_account_id(r) == NULL) {
-            continue;
+        dc_account_t r = recipients[i];
+        continue_if_true(dc_account_id(r) == NULL);
+        if (n++ > 0) {
+            g_string_append_c(body, ',');
         }
-        json_array_append_new(array, json_string(dc_account_id(r)));
+        dc_util_json_string(body, dc_account_id(r));
     }
+    g_string_append(body, "]}");
 
-    goto_if_true(json_array_size(array) == 0, cleanup);
-    json_object_set_new(data, "recipients", array);
-
-    reply = dc_api_call_sync(api, "POST", dc_account_token(login), url, data);
-    goto_if_true(reply == NULL, cleanup);
+    goto_if_true(n == 0, cleanup);
 
-    c = dc_channel_from_json(reply);
-    goto_if_true(c == NULL, cleanup);
+    ctx = dc_api_context_new(cb, data, NULL);
+    goto_if_true(ctx == NULL, cleanup);
 
-    *channel = c;
-    ret = true;
+    ret = dc_api_call_buffer(api, "POST", TOKEN(login), url->str,
+                             body->str, body->len,
+                             NULL, dc_api_create_channel_reply, ctx
+        );
 
 cleanup:
 
-    free(url);
-    json_decref(reply);
-    json_decref(data);
+    if (!ret) {
+        dc_api_context_free(ctx);
+    }
+
+    return ret;
+}
+
+bool dc_api_create_channel(dc_api_t api, dc_account_t login,
+                           dc_account_t *recipients, size_t nrecp,
+                           dc_channel_t *channel)
+{
+    dc_api_wait_t w;
+    bool ret = false;
+
+    return_if_true(channel == NULL, false);
+
+    dc_api_wait_init(&w, dc_ref);
+    if (!dc_api_create_channel_async(api, login, recipients, nrecp,
+                                     dc_api_wait_done, &w)) {
+        dc_api_wait_done(api, false, NULL, &w);
+    }
+
+    ret = dc_api_wait(&w);
+    if (ret) {
+        *channel = w.result;
+    } else {
+        dc_unref(w.result);
+    }
 
     return ret;
 }
@@ -20,46 +20,41 @@
 
 #include "internal.h"
 
-bool dc_api_get_friends(dc_api_t api, dc_account_t login)
+static void dc_api_get_friends_element(dc_api_t api, json_t *c, void *arg)
 {
-    char const *url = "users/@me/relationships";
-    json_t *reply = NULL, *c = NULL, *val = NULL;
-    bool ret = false;
-    size_t i = 0;
-    GPtrArray *f = g_ptr_array_new_with_free_func((GDestroyNotify)dc_unref);
+    dc_api_context_t *ctx = (dc_api_context_t*)arg;
+    json_t *val = NULL;
+    dc_account_t a = NULL;
 
-    return_if_true(api == NULL, false);
-    return_if_true(login == NULL, false);
-
-    reply = dc_api_call_sync(api, "GET", dc_account_token(login), url, NULL);
-    goto_if_true(reply == NULL, cleanup);
+    /* the return is an array of objects, with a "user" member
+     * type 1 is probably a friend
+     */
+    val = json_object_get(c, "user");
+    return_if_true(val == NULL,);
 
-    goto_if_true(!json_is_array(reply), cleanup);
+    a = dc_account_from_json(val);
+    return_if_true(a == NULL,);
 
-    json_array_foreach(reply, i, c) {
-        /* the return is an array of objects, with a "user" member
-         * type 1 is probably a friend
-         */
-        val = json_object_get(c, "user");
-        if (val == NULL) {
-            continue;
-        }
+    /* read the type also known as "typ"
+     */
+    val = json_object_get(c, "type");
+    if (val != NULL && json_is_integer(val)) {
+        int state = json_integer_value(val);
+        dc_account_set_friend_state(a, state);
+    }
 
-        dc_account_t a = dc_account_from_json(val);
-        if (a == NULL) {
-            continue;
-        }
+    g_ptr_array_add(ctx->objects, a);
+}
 
-        /* read the type also known as "typ"
-         */
-        val = json_object_get(c, "type");
-        if (val != NULL && json_is_integer(val)) {
-            int state = json_integer_value(val);
-            dc_account_set_friend_state(a, state);
-        }
+static void dc_api_get_friends_reply(dc_api_t api, int code,
+                                     json_t *reply, void *arg)
+{
+    dc_api_context_t *ctx = (dc_api_context_t*)arg;
+    dc_account_t login = (dc_account_t)ctx->object;
+    GPtrArray *f = ctx->objects;
+    bool ret = false;
 
-        g_ptr_array_add(f, a);
-    }
+    goto_if_true(code != CURLE_OK || reply != NULL, cleanup);
 
     if (f->len == 0) {
         /* me_irl :-(
@@ -71,100 +66,159 @@ bool dc_api_get_friends(dc_api_t api, dc_account_t login)
 
 cleanup:
 
-    if (f != NULL) {
-        g_ptr_array_unref(f);
-    }
-    json_decref(reply);
-    reply = NULL;
-
-    return ret;
+    dc_api_complete(api, ctx, ret, NULL, NULL);
 }
 
-bool dc_api_remove_friend(dc_api_t api, dc_account_t login, dc_account_t friend)
+bool dc_api_get_friends_async(dc_api_t api, dc_account_t login,
+                              dc_api_callback_t cb, void *data)
 {
-    char *url = NULL;
-    json_t *reply = NULL, *post = NULL;
-    bool ret = false;
+    char const *url = "users/@me/relationships";
+    dc_api_context_t *ctx = NULL;
 
     return_if_true(api == NULL, false);
-    return_if_true(login == NULL || friend == NULL, false);
-    return_if_true(dc_account_id(friend) == NULL, false);
+    return_if_true(login == NULL, false);
 
-    asprintf(&url, "users/@me/relationships/%s", dc_account_id(friend));
+    ctx = dc_api_context_new(cb, data, login);
+    return_if_true(ctx == NULL, false);
 
-    post = dc_account_to_json(friend);
-    return_if_true(post == NULL, false);
+    ctx->objects = g_ptr_array_new_with_free_func((GDestroyNotify)dc_unref);
+    goto_if_true(ctx->objects == NULL, error);
 
-    reply = dc_api_call_sync(api, "DELETE", dc_account_token(login), url, post);
-    /* if no data comes back, then the whole thing was a success
-     */
-    goto_if_true(reply != NULL, cleanup);
+    goto_if_true(!dc_api_call_buffer(api, "GET", dc_account_token(login),
+                                     url, NULL, 0,
+                                     dc_api_get_friends_element,
+                                     dc_api_get_friends_reply, ctx),
+                 error
+        );
 
-    ret = true;
+    return true;
 
-cleanup:
+error:
 
-    free(url);
-    json_decref(post);
-    json_decref(reply);
+    dc_api_context_free(ctx);
+    return false;
+}
 
-    return ret;
+bool dc_api_get_friends(dc_api_t api, dc_account_t login)
+{
+    dc_api_wait_t w;
+
+    dc_api_wait_init(&w, NULL);
+    if (!dc_api_get_friends_async(api, login, dc_api_wait_done, &w)) {
+        dc_api_wait_done(api, false, NULL, &w);
+    }
+
+    return dc_api_wait(&w);
 }
 
-bool dc_api_accept_friend(dc_api_t api, dc_account_t login, dc_account_t friend)
+/* removing, accepting and adding a friend only differ in verb and URL
+ */
+static bool
+dc_api_relationship_async(dc_api_t api, char const *verb,
+                          dc_account_t login, dc_account_t friend,
+                          bool with_id,
+                          dc_api_callback_t cb, void *data)
 {
-    char *url = NULL;
-    json_t *reply = NULL, *post = NULL;
+    GString *url = NULL, *body = NULL;
+    dc_api_context_t *ctx = NULL;
     bool ret = false;
 
     return_if_true(api == NULL, false);
     return_if_true(login == NULL || friend == NULL, false);
-    return_if_true(dc_account_id(friend) == NULL, false);
+    return_if_true(with_id && dc_account_id(friend) == NULL, false);
 
-    asprintf(&url, "users/@me/relationships/%s", dc_account_id(friend));
+    url = dc_api_scratch_url();
+    body = dc_api_scratch_body();
+    goto_if_true(url == NULL || body == NULL, cleanup);
 
-    post = dc_account_to_json(friend);
-    return_if_true(post == NULL, false);
+    g_string_assign(url, "users/@me/relationships");
+    if (with_id) {
+        g_string_append_c(url, '/');
+        g_string_append(url, dc_account_id(friend));
+    }
 
-    reply = dc_api_call_sync(api, "PUT", dc_account_token(login), url, post);
-    /* no data = successful
-     */
-    goto_if_true(reply != NULL, cleanup);
+    goto_if_true(!dc_account_write_json(friend, body), cleanup);
 
-    ret = true;
+    ctx = dc_api_context_new(cb, data, NULL);
+    goto_if_true(ctx == NULL, cleanup);
+
+    /* if no data comes back, then the whole thing was a success
+     */
+    ret = dc_api_call_buffer(api, verb, dc_account_token(login), url->str,
+                             body->str, body->len,
+                             NULL, dc_api_empty_reply, ctx
+        );
 
 cleanup:
 
-    free(url);
-    json_decref(post);
-    json_decref(reply);
+    if (!ret) {
+        dc_api_context_free(ctx);
+    }
 
     return ret;
 }
 
-bool dc_api_add_friend(dc_api_t api, dc_account_t login, dc_account_t friend)
+bool dc_api_remove_friend_async(dc_api_t api, dc_account_t login,
+                                dc_account_t friend,
+                                dc_api_callback_t cb, void *data)
 {
-    char const *url = "users/@me/relationships";
-    json_t *reply = NULL, *post = NULL;
-    bool ret = false;
+    return dc_api_relationship_async(api, "DELETE", login, friend, true,
+                                     cb, data
+        );
+}
 
-    return_if_true(api == NULL, false);
-    return_if_true(login == NULL, false);
+bool dc_api_remove_friend(dc_api_t api, dc_account_t login, dc_account_t friend)
+{
+    dc_api_wait_t w;
 
-    post = dc_account_to_json(friend);
-    return_if_true(post == NULL, false);
+    dc_api_wait_init(&w, NULL);
+    if (!dc_api_remove_friend_async(api, login, friend,
+                                    dc_api_wait_done, &w)) {
+        dc_api_wait_done(api, false, NULL, &w);
+    }
 
-    reply = dc_api_call_sync(api, "POST", dc_account_token(login), url, post);
-    /* apparently if no data comes back, then the whole thing was a success
-     */
-    goto_if_true(reply != NULL, cleanup);
+    return dc_api_wait(&w);
+}
 
-    ret = true;
+bool dc_api_accept_friend_async(dc_api_t api, dc_account_t login,
+                                dc_account_t friend,
+                                dc_api_callback_t cb, void *data)
+{
+    return dc_api_relationship_async(api, "PUT", login, friend, true,
+                                     cb, data
+        );
+}
 
-cleanup:
+bool dc_api_accept_friend(dc_api_t api, dc_account_t login, dc_account_t friend)
+{
+    dc_api_wait_t w;
 
-    json_decref(post);
-    json_decref(reply);
+    dc_api_wait_init(&w, NULL);
+    if (!dc_api_accept_friend_async(api, login, friend,
+                                    dc_api_wait_done, &w)) {
+        dc_api_wait_done(api, false, NULL, &w);
+    }
 
-    return ret;
+    return dc_api_wait(&w);
+}
+
+bool dc_api_add_friend_async(dc_api_t api, dc_account_t login,
+                             dc_account_t friend,
+                             dc_api_callback_t cb, void *data)
+{
+    return dc_api_relationship_async(api, "POST", login, friend, false,
+                                     cb, data
+        );
+}
+
+bool dc_api_add_friend(dc_api_t api, dc_account_t login, dc_account_t friend)
+{
+    dc_api_wait_t w;
+
+    dc_api_wait_init(&w, NULL);
+    if (!dc_api_add_friend_async(api, login, friend, dc_api_wait_done, &w)) {
+        dc_api_wait_done(api, false, NULL, &w);
+    }
+
+    return dc_api_wait(&w);
 }
@@ -19,11 +19,13 @@
 #include <dc/api.h>
 #include "internal.h"
 
-bool dc_api_set_user_status(dc_api_t api, dc_account_t login,
-                            char const *status)
+bool dc_api_set_user_status_async(dc_api_t api, dc_account_t login,
+                                  char const *status,
+                                  dc_api_callback_t cb, void *data)
 {
     char const *url = "users/@me/settings";
-    json_t *reply = NULL, *data = NULL;
+    GString *body = NULL;
+    dc_api_context_t *ctx = NULL;
     bool ret = false;
 
     return_if_true(api == NULL || login == NULL || status == NULL, false);
@@ -35,43 +37,54 @@ bool dc_api_set_user_status(dc_api_t api, dc_account_t login,
         return false;
     }
 
-    data = json_object();
-    goto_if_true(data == NULL, cleanup);
+    body = dc_api_scratch_body();
+    goto_if_true(body == NULL, cleanup);
 
-    json_object_set_new(data, "status", json_string(status));
+    g_string_append_c(body, '{');
+    dc_util_json_key(body, "status");
+    dc_util_json_string(body, status);
+    g_string_append_c(body, '}');
 
-    reply = dc_api_call_sync(api, "PATCH", TOKEN(login), url, data);
-    goto_if_true(reply != NULL, cleanup);
+    ctx = dc_api_context_new(cb, data, NULL);
+    goto_if_true(ctx == NULL, cleanup);
 
-    ret = true;
+    ret = dc_api_call_buffer(api, "PATCH", TOKEN(login), url,
+                             body->str, body->len,
+                             NULL, dc_api_empty_reply, ctx
+        );
 
 cleanup:
 
-    json_decref(reply);
-    json_decref(data);
+    if (!ret) {
+        dc_api_context_free(ctx);
+    }
 
     return ret;
 }
 
-bool dc_api_get_userinfo(dc_api_t api, dc_account_t login,
-                         dc_account_t user)
+bool dc_api_set_user_status(dc_api_t api, dc_account_t login,
+                            char const *status)
 {
-    char *url = NULL;
-    json_t *reply = NULL, *val = NULL;
-    bool ret = false;
+    dc_api_wait_t w;
 
-    return_if_true(api == NULL, false);
-    return_if_true(login == NULL, false);
-    return_if_true(user == NULL, false);
-
-    if (user == login) {
-        url = strdup("users/@me");
-    } else {
-        asprintf(&url, "users/%s", dc_account_id(user));
+    dc_api_wait_init(&w, NULL);
+    if (!dc_api_set_user_status_async(api, login, status,
+                                      dc_api_wait_done, &w)) {
+        dc_api_wait_done(api, false, NULL, &w);
     }
 
-    reply = dc_api_call_sync(api, "GET", TOKEN(login), url, NULL);
-    goto_if_true(reply == NULL, cleanup);
+    return dc_api_wait(&w);
+}
+
+static void dc_api_get_userinfo_reply(dc_api_t api, int code,
+                                      json_t *reply, void *arg)
+{
+    dc_api_context_t *ctx = (dc_api_context_t*)arg;
+    dc_account_t user = (dc_account_t)ctx->object;
+    json_t *val = NULL;
+    bool ret = false;
+
+    goto_if_true(code != CURLE_OK || reply == NULL, cleanup);
 
     val = json_object_get(reply, "username");
     goto_if_true(val == NULL || !json_is_string(val), cleanup);
@@ -89,56 +102,141 @@ bool dc_api_get_userinfo(dc_api_t api, dc_account_t login,
 
 cleanup:
 
-    free(url);
-    json_decref(reply);
-
-    return ret;
+    dc_api_complete(api, ctx, ret, NULL, NULL);
 }
 
-bool dc_api_get_userguilds(dc_api_t api, dc_account_t login, GPtrArray **out)
+bool dc_api_get_userinfo_async(dc_api_t api, dc_account_t login,
+                               dc_account_t user,
+                               dc_api_callback_t cb, void *data)
 {
-    char const *url = "users/@me/guilds";
-    json_t *reply = NULL, *c = NULL, *val = NULL;
-    size_t i = 0;
+    GString *url = NULL;
+    dc_api_context_t *ctx = NULL;
     bool ret = false;
-    GPtrArray *guilds = g_ptr_array_new_with_free_func(
-        (GDestroyNotify)dc_unref
-        );
 
     return_if_true(api == NULL, false);
     return_if_true(login == NULL, false);
+    return_if_true(user == NULL, false);
 
-    reply = dc_api_call_sync(api, "GET", TOKEN(login), url, NULL);
-    goto_if_true(reply == NULL, cleanup);
+    url = dc_api_scratch_url();
+    goto_if_true(url == NULL, cleanup);
 
-    goto_if_true(!json_is_array(reply), cleanup);
+    if (user == login) {
+        g_string_assign(url, "users/@me");
+    } else {
+        g_string_printf(url, "users/%s", dc_account_id(user));
+    }
 
-    json_array_foreach(reply, i, c) {
-        dc_guild_t g = dc_guild_new();
+    ctx = dc_api_context_new(cb, data, user);
+    goto_if_true(ctx == NULL, cleanup);
 
-        val = json_object_get(c, "id");
-        goto_if_true(val == NULL || !json_is_string(val), cleanup);
-        dc_guild_set_id(g, json_string_value(val));
+    ret = dc_api_call_buffer(api, "GET", TOKEN(login), url->str, NULL, 0,
+                             NULL, dc_api_get_userinfo_reply, ctx
+        );
 
-        val = json_object_get(c, "name");
-        goto_if_true(val == NULL || !json_is_string(val), cleanup);
-        dc_guild_set_name(g, json_string_value(val));
+cleanup:
 
-        g_ptr_array_add(guilds, g);
+    if (!ret) {
+        dc_api_context_free(ctx);
     }
 
-    *out = guilds;
-    guilds = NULL;
+    return ret;
+}
 
-    ret = true;
+bool dc_api_get_userinfo(dc_api_t api, dc_account_t login,
+                         dc_account_t user)
+{
+    dc_api_wait_t w;
 
-cleanup:
+    dc_api_wait_init(&w, NULL);
+    if (!dc_api_get_userinfo_async(api, login, user, dc_api_wait_done, &w)) {
+        dc_api_wait_done(api, false, NULL, &w);
+    }
+
+    return dc_api_wait(&w);
+}
+
+static void dc_api_get_userguilds_element(dc_api_t api, json_t *c,
+                                          void *arg)
+{
+    dc_api_context_t *ctx = (dc_api_context_t*)arg;
+    json_t *id = NULL, *name = NULL;
+    dc_guild_t g = NULL;
+
+    id = json_object_get(c, "id");
+    name = json_object_get(c, "name");
+    return_if_true(id == NULL || !json_is_string(id),);
+    return_if_true(name == NULL || !json_is_string(name),);
+
+    g = dc_guild_new();
+    return_if_true(g == NULL,);
+
+    dc_guild_set_id(g, json_string_value(id));
+    dc_guild_set_name(g, json_string_value(name));
+
+    g_ptr_array_add(ctx->objects, g);
+}
+
+static void dc_api_get_userguilds_reply(dc_api_t api, int code,
+                                        json_t *reply, void *arg)
+{
+    dc_api_context_t *ctx = (dc_api_context_t*)arg;
+
+    if (code != CURLE_OK || reply != NULL) {
+        dc_api_complete(api, ctx, false, NULL, NULL);
+        return;
+    }
+
+    dc_api_complete(api, ctx, true, g_ptr_array_ref(ctx->objects),
+                    (GDestroyNotify)g_ptr_array_unref
+        );
+}
+
+bool dc_api_get_userguilds_async(dc_api_t api, dc_account_t login,
+                                 dc_api_callback_t cb, void *data)
+{
+    char const *url = "users/@me/guilds";
+    dc_api_context_t *ctx = NULL;
+
+    return_if_true(api == NULL, false);
+    return_if_true(login == NULL, false);
+
+    ctx = dc_api_context_new(cb, data, NULL);
+    return_if_true(ctx == NULL, false);
+
+    ctx->objects = g_ptr_array_new_with_free_func((GDestroyNotify)dc_unref);
+    goto_if_true(ctx->objects == NULL, error);
+
+    goto_if_true(!dc_api_call_buffer(api, "GET", TOKEN(login), url, NULL, 0,
+                                     dc_api_get_userguilds_element,
+                                     dc_api_get_userguilds_reply, ctx),
+                 error
+        );
+
+    return true;
 
-    json_decref(reply);
+error:
+
+    dc_api_context_free(ctx);
+    return false;
+}
+
+bool dc_api_get_userguilds(dc_api_t api, dc_account_t login, GPtrArray **out)
+{
+    dc_api_wait_t w;
+    bool ret = false;
+
+    return_if_true(out == NULL, false);
+
+    dc_api_wait_init(&w, (void *(*)(void *))g_ptr_array_ref);
+    if (!dc_api_get_userguilds_async(api, login, dc_api_wait_done, &w)) {
+        dc_api_wait_done(api, false, NULL, &w);
+    }
 
-    if (guilds) {
-        g_ptr_array_unref(guilds);
-        guilds = NULL;
+    ret = dc_api_wait(&w);
+    if (ret) {
+        *out = w.result;
+    } else if (w.result != NULL) {
+        g_ptr_array_unref(w.result);
     }
 
     return ret;
@@ -26,27 +26,435 @@ struct dc_api_
 
     struct event_base *base;
     CURLM *curl;
+    dc_share_t share;
+
+    /* the multi handle is driven by the loop thread, so requests made by
+     * other threads are queued here, and added by "submit" on the loop
+     */
+    pthread_mutex_t mtx;
+    GQueue *pending[DC_API_PRIORITIES];
+    struct event *submit;
+    /* background calls that have left "pending", and are not done yet
+     */
+    int background;
+
+    /* where completion callbacks are delivered, if not on the loop
+     */
+    struct event_base *callback_base;
+
+    /* rate limiting, only ever touched by the loop thread. Calls whose
+     * bucket is empty wait in "held" until "refill" fires
+     */
+    dc_ratelimit_t *limits;
+    GQueue *held;
+    struct event *refill;
+    int64_t refill_at;
+
+    /* handles given to dc_api_cancel(), and the event that ends their
+     * calls on the loop
+     */
+    GHashTable *cancels;
+    dc_api_cancel_t next_cancel;
+    struct event *sweep;
+
+    /* the last DC_API_ATTEMPTS attempts, "attempt" is where the next
+     * one goes
+     */
+    dc_api_attempt_t attempts[DC_API_ATTEMPTS];
+    uint64_t attempt;
 
     GHashTable *syncs;
+    /* CURL * -> dc_api_request_t, of the calls in flight, and the
+     * requests (and their easy handles) kept around for the next call
+     */
+    GHashTable *requests;
+    GPtrArray *idle;
+
+    /* token -> dc_api_headers_t, so the header lists are only built once
+     * per account
+     */
+    GHashTable *headers;
+
+    dc_cache_t *cache;
 
     char *cookie;
+
+    dc_api_stats_t stats;
 };
 
+typedef struct {
+    CURL *easy;
+    GString *route;
+    GString *body;
+    dc_ratelimit_headers_t headers;
+    int retries;
+
+    dc_api_priority_t priority;
+    /* counts against the limit of background calls
+     */
+    bool scheduled;
+
+    /* monotonic times: when it was made, when it has to be done, when
+     * it may go out again after a failed attempt, and when the current
+     * attempt went out
+     */
+    int64_t created;
+    int64_t deadline;
+    int64_t not_before;
+    int64_t started;
+    /* the current attempt is in the multi handle
+     */
+    bool running;
+    int attempts;
+    int errors;
+    bool idempotent;
+    dc_api_cancel_t cancel;
+
+    /* only while in flight, the API holds a reference
+     */
+    dc_api_sync_t sync;
+
+    /* key of a GET in the cache, empty for other calls, the validators that
+     * came with the reply, and the header list that sends ours
+     */
+    GString *cachekey;
+    GString *etag;
+    GString *modified;
+    struct curl_slist *validators;
+} dc_api_request_t;
+
+/* while a call is in flight its sync owns the easy handle
+ */
+static void dc_api_request_free(dc_api_request_t *r)
+{
+    return_if_true(r == NULL,);
+
+    g_string_free(r->route, TRUE);
+    g_string_free(r->body, TRUE);
+    g_string_free(r->cachekey, TRUE);
+    g_string_free(r->etag, TRUE);
+    g_string_free(r->modified, TRUE);
+    curl_slist_free_all(r->validators);
+    free(r);
+}
+
+static void dc_api_request_destroy(dc_api_request_t *r)
+{
+    return_if_true(r == NULL,);
+
+    if (r->easy != NULL) {
+        curl_easy_cleanup(r->easy);
+        r->easy = NULL;
+    }
+
+    dc_api_request_free(r);
+}
+
+static dc_api_request_t *dc_api_request_get(dc_api_t api)
+{
+    dc_api_request_t *r = NULL;
+
+    pthread_mutex_lock(&api->mtx);
+    if (api->idle->len > 0) {
+        r = g_ptr_array_remove_index_fast(api->idle, api->idle->len - 1);
+    }
+    pthread_mutex_unlock(&api->mtx);
+
+    if (r == NULL) {
+        r = calloc(1, sizeof(dc_api_request_t));
+        return_if_true(r == NULL, NULL);
+
+        r->route = g_string_new(NULL);
+        r->body = g_string_new(NULL);
+        r->cachekey = g_string_new(NULL);
+        r->etag = g_string_new(NULL);
+        r->modified = g_string_new(NULL);
+        r->easy = curl_easy_init();
+        if (r->easy == NULL) {
+            dc_api_request_free(r);
+            return NULL;
+        }
+    }
+
+    dc_ratelimit_headers_init(&r->headers);
+    r->retries = 0;
+    r->errors = 0;
+    r->attempts = 0;
+    r->not_before = 0;
+
+    return r;
+}
+
+static void dc_api_request_put(dc_api_t api, dc_api_request_t *r)
+{
+    return_if_true(r == NULL,);
+
+    /* keeps its connection, DNS and TLS caches, but not its options
+     */
+    curl_easy_reset(r->easy);
+    g_string_truncate(r->body, 0);
+    g_string_truncate(r->cachekey, 0);
+    curl_slist_free_all(r->validators);
+    r->validators = NULL;
+    r->sync = NULL;
+    r->scheduled = false;
+    r->running = false;
+
+    pthread_mutex_lock(&api->mtx);
+    if (api->idle->len < DC_API_IDLE_REQUESTS) {
+        g_ptr_array_add(api->idle, r);
+        r = NULL;
+    }
+    pthread_mutex_unlock(&api->mtx);
+
+    dc_api_request_destroy(r);
+}
+
+typedef struct {
+    struct curl_slist *plain;
+    struct curl_slist *json;
+} dc_api_headers_t;
+
+static void dc_api_headers_free(dc_api_headers_t *h)
+{
+    return_if_true(h == NULL,);
+
+    curl_slist_free_all(h->plain);
+    curl_slist_free_all(h->json);
+    free(h);
+}
+
+static struct curl_slist *dc_api_headers_build(char const *token, bool json)
+{
+    struct curl_slist *l = NULL;
+    char *tmp = NULL;
+
+    if (json) {
+        l = curl_slist_append(l, "Content-Type: application/json");
+    }
+    l = curl_slist_append(l, "Accept: application/json");
+    l = curl_slist_append(l, "User-Agent: " DISCORD_USERAGENT);
+    l = curl_slist_append(l, "Pragma: no-cache");
+    l = curl_slist_append(l, "Cache-Control: no-cache");
+
+    if (token != NULL) {
+        asprintf(&tmp, "Authorization: %s", token);
+        l = curl_slist_append(l, tmp);
+        free(tmp);
+        tmp = NULL;
+    }
+
+    return l;
+}
+
+/* the lists live as long as the API, since easy handles point to them
+ */
+static struct curl_slist *
+dc_api_headers(dc_api_t api, char const *token, bool json)
+{
+    dc_api_headers_t *h = NULL;
+    char const *key = (token != NULL ? token : "");
+
+    pthread_mutex_lock(&api->mtx);
+
+    h = g_hash_table_lookup(api->headers, key);
+    if (h == NULL) {
+        h = calloc(1, sizeof(dc_api_headers_t));
+        if (h != NULL) {
+            h->plain = dc_api_headers_build(token, false);
+            h->json = dc_api_headers_build(token, true);
+            g_hash_table_insert(api->headers, g_strdup(key), h);
+        }
+    }
+
+    pthread_mutex_unlock(&api->mtx);
+
+    return_if_true(h == NULL, NULL);
+    return (json ? h->json : h->plain);
+}
+
+typedef struct {
+    GString *url;
+    GString *body;
+    GString *full;
+    dc_api_priority_t priority;
+    int64_t timeout;
+    dc_api_cancel_t cancel;
+} dc_api_scratch_t;
+
+static void dc_api_scratch_free(gpointer p)
+{
+    dc_api_scratch_t *s = (dc_api_scratch_t*)p;
+
+    return_if_true(s == NULL,);
+
+    g_string_free(s->url, TRUE);
+    g_string_free(s->body, TRUE);
+    g_string_free(s->full, TRUE);
+    free(s);
+}
+
+static GPrivate dc_api_scratch_key = G_PRIVATE_INIT(dc_api_scratch_free);
+
+static dc_api_scratch_t *dc_api_scratch_get(void)
+{
+    dc_api_scratch_t *s = g_private_get(&dc_api_scratch_key);
+
+    if (s == NULL) {
+        s = calloc(1, sizeof(dc_api_scratch_t));
+        return_if_true(s == NULL, NULL);
+
+        s->url = g_string_sized_new(128);
+        s->body = g_string_sized_new(256);
+        s->full = g_string_sized_new(128);
+        s->priority = DC_API_PRIORITY_NORMAL;
+        s->timeout = DC_API_TIMEOUT;
+        g_private_set(&dc_api_scratch_key, s);
+    }
+
+    return s;
+}
+
+GString *dc_api_scratch_url(void)
+{
+    dc_api_scratch_t *s = dc_api_scratch_get();
+    return_if_true(s == NULL, NULL);
+
+    g_string_truncate(s->url, 0);
+    return s->url;
+}
+
+GString *dc_api_scratch_body(void)
+{
+    dc_api_scratch_t *s = dc_api_scratch_get();
+    return_if_true(s == NULL, NULL);
+
+    g_string_truncate(s->body, 0);
+    return s->body;
+}
+
+dc_api_priority_t dc_api_set_priority(dc_api_priority_t priority)
+{
+    dc_api_scratch_t *s = dc_api_scratch_get();
+    dc_api_priority_t old = DC_API_PRIORITY_NORMAL;
+
+    return_if_true(s == NULL, old);
+    return_if_true(priority < 0 || priority >= DC_API_PRIORITIES, s->priority);
+
+    old = s->priority;
+    s->priority = priority;
+
+    return old;
+}
+
+int64_t dc_api_set_timeout(int64_t ms)
+{
+    dc_api_scratch_t *s = dc_api_scratch_get();
+    int64_t old = DC_API_TIMEOUT;
+
+    return_if_true(s == NULL, old);
+
+    old = s->timeout;
+    s->timeout = (ms > 0 ? ms : DC_API_TIMEOUT);
+
+    return old;
+}
+
+dc_api_cancel_t dc_api_set_cancel(dc_api_cancel_t cancel)
+{
+    dc_api_scratch_t *s = dc_api_scratch_get();
+    dc_api_cancel_t old = 0;
+
+    return_if_true(s == NULL, 0);
+
+    old = s->cancel;
+    s->cancel = cancel;
+
+    return old;
+}
+
 static void dc_api_free(dc_api_t ptr)
 {
+    int i = 0;
+
     return_if_true(ptr == NULL,);
 
+    if (ptr->submit != NULL) {
+        event_free(ptr->submit);
+        ptr->submit = NULL;
+    }
+
+    if (ptr->refill != NULL) {
+        event_free(ptr->refill);
+        ptr->refill = NULL;
+    }
+
+    if (ptr->sweep != NULL) {
+        event_free(ptr->sweep);
+        ptr->sweep = NULL;
+    }
+
+    if (ptr->cancels != NULL) {
+        g_hash_table_unref(ptr->cancels);
+        ptr->cancels = NULL;
+    }
+
+    if (ptr->held != NULL) {
+        g_queue_free(ptr->held);
+        ptr->held = NULL;
+    }
+
+    if (ptr->requests != NULL) {
+        g_hash_table_unref(ptr->requests);
+        ptr->requests = NULL;
+    }
+
+    if (ptr->idle != NULL) {
+        g_ptr_array_foreach(ptr->idle, (GFunc)dc_api_request_destroy, NULL);
+        g_ptr_array_unref(ptr->idle);
+        ptr->idle = NULL;
+    }
+
+    dc_ratelimit_free(ptr->limits);
+    ptr->limits = NULL;
+
+    for (i = 0; i < DC_API_PRIORITIES; i++) {
+        if (ptr->pending[i] != NULL) {
+            g_queue_free(ptr->pending[i]);
+            ptr->pending[i] = NULL;
+        }
+    }
+
     if (ptr->syncs != NULL) {
         g_hash_table_unref(ptr->syncs);
         ptr->syncs = NULL;
     }
 
+    dc_cache_free(ptr->cache);
+    ptr->cache = NULL;
+
+    /* after all easy handles are gone, since they point to these
+     */
+    if (ptr->headers != NULL) {
+        g_hash_table_unref(ptr->headers);
+        ptr->headers = NULL;
+    }
+
+    pthread_mutex_destroy(&ptr->mtx);
+
+    /* after the syncs, since their easy handles use the share
+     */
+    dc_unref(ptr->share);
+    ptr->share = NULL;
+
     free(ptr);
 }
 
 dc_api_t dc_api_new(void)
 {
     dc_api_t ptr = calloc(1, sizeof(struct dc_api_));
+    int i = 0;
+
     return_if_true(ptr == NULL, NULL);
 
     ptr->ref.cleanup = (dc_cleanup_t)dc_api_free;
@@ -59,37 +467,690 @@ dc_api_t dc_api_new(void)
         return NULL;
     }
 
+    pthread_mutex_init(&ptr->mtx, NULL);
+
+    for (i = 0; i < DC_API_PRIORITIES; i++) {
+        ptr->pending[i] = g_queue_new();
+        goto_if_true(ptr->pending[i] == NULL, error);
+    }
+
+    ptr->requests = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+                                          (GDestroyNotify)dc_api_request_free
+        );
+    goto_if_true(ptr->requests == NULL, error);
+
+    ptr->held = g_queue_new();
+    goto_if_true(ptr->held == NULL, error);
+
+    ptr->idle = g_ptr_array_new();
+    goto_if_true(ptr->idle == NULL, error);
+
+    ptr->headers = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                         (GDestroyNotify)dc_api_headers_free
+        );
+    goto_if_true(ptr->headers == NULL, error);
+
+    ptr->limits = dc_ratelimit_new();
+    goto_if_true(ptr->limits == NULL, error);
+
+    ptr->cache = dc_cache_new();
+    goto_if_true(ptr->cache == NULL, error);
+
+    ptr->cancels = g_hash_table_new_full(g_int64_hash, g_int64_equal,
+                                         g_free, NULL
+        );
+    goto_if_true(ptr->cancels == NULL, error);
+
     return dc_ref(ptr);
+
+error:
+
+    dc_api_free(ptr);
+    return NULL;
 }
 
 void dc_api_set_curl_multi(dc_api_t api, CURLM *curl)
 {
     return_if_true(api == NULL,);
-    return_if_true(curl == NULL,);
 
     api->curl = curl;
 }
 
+void dc_api_set_share(dc_api_t api, dc_share_t share)
+{
+    return_if_true(api == NULL,);
+
+    dc_unref(api->share);
+    api->share = dc_ref(share);
+}
+
+static void dc_api_record(dc_api_t api, dc_api_request_t *req,
+                          int code, long status, bool retried)
+{
+    dc_api_attempt_t *a = NULL;
+
+    pthread_mutex_lock(&api->mtx);
+
+    a = &api->attempts[api->attempt % DC_API_ATTEMPTS];
+    ++api->attempt;
+
+    g_strlcpy(a->route, req->route->str, sizeof(a->route));
+    a->attempt = req->attempts;
+    a->priority = req->priority;
+    a->waited = req->started - req->created;
+    a->duration = g_get_monotonic_time() - req->started;
+    a->code = code;
+    a->status = status;
+    a->retried = retried;
+
+    pthread_mutex_unlock(&api->mtx);
+}
+
+size_t dc_api_attempts(dc_api_t api, dc_api_attempt_t *out, size_t n)
+{
+    uint64_t first = 0, i = 0;
+
+    return_if_true(api == NULL || out == NULL, 0);
+
+    pthread_mutex_lock(&api->mtx);
+
+    n = MIN(n, MIN(api->attempt, DC_API_ATTEMPTS));
+    first = api->attempt - n;
+    for (i = 0; i < n; i++) {
+        out[i] = api->attempts[(first + i) % DC_API_ATTEMPTS];
+    }
+
+    pthread_mutex_unlock(&api->mtx);
+
+    return n;
+}
+
+bool dc_api_set_cache_dir(dc_api_t api, char const *dir)
+{
+    return_if_true(api == NULL, false);
+    return dc_cache_set_dir(api->cache, dir);
+}
+
+/* removes the call from the API, and tells whoever is waiting
+ */
+static void dc_api_finish(dc_api_t api, CURL *easy, int code)
+{
+    dc_api_sync_t sync = NULL;
+    dc_api_request_t *req = NULL;
+    bool more = false;
+
+    pthread_mutex_lock(&api->mtx);
+    sync = dc_ref(g_hash_table_lookup(api->syncs, easy));
+    g_hash_table_remove(api->syncs, easy);
+    req = g_hash_table_lookup(api->requests, easy);
+    g_hash_table_steal(api->requests, easy);
+    if (req != NULL && req->scheduled) {
+        --api->background;
+        more = (g_queue_get_length(
+                    api->pending[DC_API_PRIORITY_BACKGROUND]) > 0);
+    }
+    pthread_mutex_unlock(&api->mtx);
+
+    /* room for the next background call
+     */
+    if (more && api->submit != NULL) {
+        event_active(api->submit, 0, 0);
+    }
+
+    return_if_true(sync == NULL,);
+
+    /* the easy handle goes back to the pool, before anybody waiting
+     * gets to free the sync
+     */
+    if (req != NULL && dc_api_sync_detach(sync) == easy) {
+        dc_api_request_put(api, req);
+    } else {
+        dc_api_request_free(req);
+    }
+
+    dc_api_sync_finish(sync, code);
+    dc_unref(sync);
+}
+
+static void dc_api_hold(dc_api_t api, CURL *easy, int64_t until)
+{
+    struct timeval tm = {0};
+    int64_t in = until - g_get_monotonic_time();
+
+    g_queue_push_tail(api->held, easy);
+
+    if (evtimer_pending(api->refill, NULL) && api->refill_at <= until) {
+        return;
+    }
+
+    in = MAX(in, 0);
+    tm.tv_sec = in / G_USEC_PER_SEC;
+    tm.tv_usec = in % G_USEC_PER_SEC;
+
+    api->refill_at = until;
+    evtimer_add(api->refill, &tm);
+}
+
+/* hands the call to curl, unless its rate limit bucket is empty
+ */
+static void dc_api_dispatch(dc_api_t api, CURL *easy)
+{
+    dc_api_request_t *req = NULL;
+    int64_t until = 0, now = g_get_monotonic_time();
+
+    pthread_mutex_lock(&api->mtx);
+    req = g_hash_table_lookup(api->requests, easy);
+    pthread_mutex_unlock(&api->mtx);
+
+    if (req != NULL) {
+        if (now >= req->deadline) {
+            ++api->stats.timedout;
+            dc_api_finish(api, easy, CURLE_OPERATION_TIMEDOUT);
+            return;
+        }
+
+        until = dc_ratelimit_until(api->limits, req->route->str, now);
+        if (req->not_before > now) {
+            until = MAX(until, req->not_before);
+        }
+
+        /* nothing to wake it up again without a loop
+         */
+        if (until > 0 && api->refill != NULL) {
+            /* no use waiting for a slot it can't make anyway
+             */
+            if (until >= req->deadline) {
+                ++api->stats.timedout;
+                dc_api_finish(api, easy, CURLE_OPERATION_TIMEDOUT);
+                return;
+            }
+            if (until > req->not_before) {
+                ++api->stats.limited;
+            }
+            dc_api_hold(api, easy, until);
+            return;
+        }
+        dc_ratelimit_take(api->limits, req->route->str);
+
+        /* whatever is left of the deadline is what this attempt gets
+         */
+        curl_easy_setopt(easy, CURLOPT_TIMEOUT_MS,
+                         (long)MAX((req->deadline - now) / 1000, 1)
+            );
+        req->started = now;
+        ++req->attempts;
+    }
+
+    if (api->curl == NULL ||
+        curl_multi_add_handle(api->curl, easy) != CURLM_OK) {
+        dc_api_finish(api, easy, CURLE_FAILED_INIT);
+        return;
+    }
+
+    if (req != NULL) {
+        req->running = true;
+    }
+}
+
+static void dc_api_refill(int sock, short what, void *arg)
+{
+    dc_api_t api = (dc_api_t)arg;
+    GQueue *held = api->held;
+    dc_api_request_t *req = NULL;
+    CURL *easy = NULL;
+    guint n = 0;
+    int p = 0;
+
+    /* in order, so calls on one route keep theirs, but interactive ones
+     * first. Those that still have to wait end up in the new queue
+     */
+    api->held = g_queue_new();
+    for (p = 0; p < DC_API_PRIORITIES; p++) {
+        for (n = g_queue_get_length(held); n > 0; n--) {
+            easy = g_queue_pop_head(held);
+
+            pthread_mutex_lock(&api->mtx);
+            req = g_hash_table_lookup(api->requests, easy);
+            pthread_mutex_unlock(&api->mtx);
+
+            if (req == NULL || (int)req->priority == p) {
+                dc_api_dispatch(api, easy);
+            } else {
+                g_queue_push_tail(held, easy);
+            }
+        }
+    }
+
+    g_queue_free(held);
+}
+
+static void dc_api_submit(int sock, short what, void *arg)
+{
+    dc_api_t api = (dc_api_t)arg;
+    GQueue *easies = NULL, *background = NULL;
+    dc_api_request_t *req = NULL;
+    CURL *easy = NULL;
+    int p = 0;
+
+    easies = g_queue_new();
+    return_if_true(easies == NULL,);
+
+    /* interactive calls go first, then normal ones, and background ones
+     * only while there is room for them. The rest stays, until one of
+     * those that are running is done.
+     */
+    pthread_mutex_lock(&api->mtx);
+    for (p = 0; p < DC_API_PRIORITY_BACKGROUND; p++) {
+        while ((easy = g_queue_pop_head(api->pending[p])) != NULL) {
+            g_queue_push_tail(easies, easy);
+        }
+    }
+
+    background = api->pending[DC_API_PRIORITY_BACKGROUND];
+    while (api->background < DC_API_MAX_BACKGROUND &&
+           (easy = g_queue_pop_head(background)) != NULL) {
+        req = g_hash_table_lookup(api->requests, easy);
+        if (req != NULL) {
+            req->scheduled = true;
+            ++api->background;
+        }
+        g_queue_push_tail(easies, easy);
+    }
+    pthread_mutex_unlock(&api->mtx);
+
+    while ((easy = g_queue_pop_head(easies)) != NULL) {
+        dc_api_dispatch(api, easy);
+    }
+
+    g_queue_free(easies);
+}
+
+dc_api_cancel_t dc_api_cancel_new(dc_api_t api)
+{
+    dc_api_cancel_t c = 0;
+
+    return_if_true(api == NULL, 0);
+
+    pthread_mutex_lock(&api->mtx);
+    c = ++api->next_cancel;
+    pthread_mutex_unlock(&api->mtx);
+
+    return c;
+}
+
+void dc_api_cancel(dc_api_t api, dc_api_cancel_t cancel)
+{
+    dc_api_cancel_t *key = NULL;
+
+    return_if_true(api == NULL || cancel == 0,);
+    /* without a loop nothing would ever forget it again
+     */
+    return_if_true(api->sweep == NULL,);
+
+    key = g_new(dc_api_cancel_t, 1);
+    *key = cancel;
+
+    pthread_mutex_lock(&api->mtx);
+    g_hash_table_add(api->cancels, key);
+    pthread_mutex_unlock(&api->mtx);
+
+    if (api->sweep != NULL) {
+        event_active(api->sweep, 0, 0);
+    }
+}
+
+/* whether a call that is not done yet belongs to the handle, with the
+ * lock held
+ */
+static bool dc_api_cancel_used(dc_api_t api, dc_api_cancel_t cancel)
+{
+    GHashTableIter iter;
+    gpointer value = NULL;
+
+    g_hash_table_iter_init(&iter, api->requests);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        if (((dc_api_request_t*)value)->cancel == cancel) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* ends all calls of cancelled handles, wherever they are
+ */
+static void dc_api_sweep(int sock, short what, void *arg)
+{
+    dc_api_t api = (dc_api_t)arg;
+    GHashTableIter iter;
+    gpointer key = NULL, value = NULL;
+    GPtrArray *easies = NULL;
+    dc_api_request_t *req = NULL;
+    CURL *easy = NULL;
+    bool running = false;
+    size_t i = 0;
+    int p = 0;
+
+    easies = g_ptr_array_new();
+    return_if_true(easies == NULL,);
+
+    pthread_mutex_lock(&api->mtx);
+    g_hash_table_iter_init(&iter, api->requests);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        req = (dc_api_request_t*)value;
+        if (req->cancel != 0 &&
+            g_hash_table_contains(api->cancels, &req->cancel)) {
+            g_ptr_array_add(easies, key);
+        }
+    }
+    for (i = 0; i < easies->len; i++) {
+        for (p = 0; p < DC_API_PRIORITIES; p++) {
+            g_queue_remove(api->pending[p], g_ptr_array_index(easies, i));
+        }
+    }
+    pthread_mutex_unlock(&api->mtx);
+
+    for (i = 0; i < easies->len; i++) {
+        easy = g_ptr_array_index(easies, i);
+
+        pthread_mutex_lock(&api->mtx);
+        req = g_hash_table_lookup(api->requests, easy);
+        running = (req != NULL && req->running);
+        pthread_mutex_unlock(&api->mtx);
+
+        g_queue_remove(api->held, easy);
+        if (running) {
+            curl_multi_remove_handle(api->curl, easy);
+            req->running = false;
+            dc_api_record(api, req, CURLE_ABORTED_BY_CALLBACK, 0, false);
+        }
+
+        ++api->stats.cancelled;
+        dc_api_finish(api, easy, CURLE_ABORTED_BY_CALLBACK);
+    }
+
+    /* a handle is forgotten once none of its calls is left
+     */
+    pthread_mutex_lock(&api->mtx);
+    g_hash_table_iter_init(&iter, api->cancels);
+    while (g_hash_table_iter_next(&iter, &key, NULL)) {
+        if (!dc_api_cancel_used(api, *(dc_api_cancel_t*)key)) {
+            g_hash_table_iter_remove(&iter);
+        }
+    }
+    pthread_mutex_unlock(&api->mtx);
+
+    g_ptr_array_unref(easies);
+}
+
+/* calls that were queued, held or running on the loop an API is taken
+ * away from. Without a loop nothing would ever finish them, so they fail
+ */
+static void dc_api_orphan(dc_api_t api)
+{
+    GHashTableIter iter;
+    gpointer key = NULL, value = NULL;
+    GPtrArray *easies = NULL;
+    dc_api_request_t *req = NULL;
+    CURL *easy = NULL;
+    size_t i = 0;
+    int p = 0;
+
+    easies = g_ptr_array_new();
+    return_if_true(easies == NULL,);
+
+    pthread_mutex_lock(&api->mtx);
+    g_hash_table_iter_init(&iter, api->requests);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        g_ptr_array_add(easies, key);
+    }
+    for (p = 0; p < DC_API_PRIORITIES; p++) {
+        g_queue_clear(api->pending[p]);
+    }
+    g_queue_clear(api->held);
+    pthread_mutex_unlock(&api->mtx);
+
+    for (i = 0; i < easies->len; i++) {
+        easy = g_ptr_array_index(easies, i);
+
+        pthread_mutex_lock(&api->mtx);
+        req = g_hash_table_lookup(api->requests, easy);
+        pthread_mutex_unlock(&api->mtx);
+
+        if (req != NULL && req->running) {
+            curl_multi_remove_handle(api->curl, easy);
+            req->running = false;
+        }
+
+        dc_api_finish(api, easy, CURLE_FAILED_INIT);
+    }
+
+    g_ptr_array_unref(easies);
+}
+
 void dc_api_set_event_base(dc_api_t api, struct event_base *base)
 {
     return_if_true(api == NULL,);
-    return_if_true(base == NULL,);
+    return_if_true(api->base == base && api->submit != NULL,);
+
+    if (api->submit != NULL) {
+        dc_api_orphan(api);
+    }
+
+    if (api->submit != NULL) {
+        event_free(api->submit);
+        api->submit = NULL;
+    }
+
+    if (api->refill != NULL) {
+        evtimer_del(api->refill);
+        event_free(api->refill);
+        api->refill = NULL;
+    }
+
+    if (api->sweep != NULL) {
+        event_free(api->sweep);
+        api->sweep = NULL;
+    }
 
     api->base = base;
+    return_if_true(base == NULL,);
+
+    api->submit = event_new(base, -1, 0, dc_api_submit, api);
+    api->refill = evtimer_new(base, dc_api_refill, api);
+    api->sweep = event_new(base, -1, 0, dc_api_sweep, api);
+}
+
+void dc_api_set_callback_base(dc_api_t api, struct event_base *base)
+{
+    return_if_true(api == NULL,);
+    api->callback_base = base;
+}
+
+static void dc_api_account(dc_api_t api, CURL *easy)
+{
+    long connects = 0, version = 0;
+    curl_off_t t = 0;
+
+    ++api->stats.requests;
+
+    /* NUM_CONNECTS is zero if the transfer went over a connection
+     * that was already open, either from the pool or multiplexed.
+     */
+    if (curl_easy_getinfo(easy, CURLINFO_NUM_CONNECTS, &connects) == CURLE_OK &&
+        connects > 0) {
+        api->stats.connects += connects;
+        if (curl_easy_getinfo(easy, CURLINFO_APPCONNECT_TIME_T, &t) == CURLE_OK) {
+            api->stats.connect_time += t;
+        }
+    } else {
+        ++api->stats.reused;
+    }
+
+    if (curl_easy_getinfo(easy, CURLINFO_HTTP_VERSION, &version) == CURLE_OK &&
+        version == CURL_HTTP_VERSION_2_0) {
+        ++api->stats.http2;
+    }
+}
+
+void dc_api_stats(dc_api_t api, dc_api_stats_t *stats)
+{
+    return_if_true(api == NULL || stats == NULL,);
+    memcpy(stats, &api->stats, sizeof(dc_api_stats_t));
+}
+
+/* a 304 gets the reply from the cache, and a reply that came with
+ * validators goes into it
+ */
+static int dc_api_revalidated(dc_api_t api, dc_api_request_t *req,
+                              dc_api_sync_t sync, long status)
+{
+    json_t *reply = NULL;
+    FILE *stream = NULL;
+
+    if (status == 304) {
+        reply = dc_cache_reply(api->cache, req->cachekey->str);
+        return_if_true(reply == NULL, CURLE_RECV_ERROR);
+
+        dc_api_sync_reset(sync);
+        dc_api_sync_set_reply(sync, reply);
+        json_decref(reply);
+
+        ++api->stats.cached;
+    } else if (status == 200 &&
+               (req->etag->len > 0 || req->modified->len > 0)) {
+        /* only the loop thread writes to it, and nobody reads it before
+         * the sync is finished
+         */
+        stream = dc_api_sync_stream(sync);
+        if (stream != NULL && fflush(stream) == 0) {
+            dc_cache_store(api->cache, req->cachekey->str,
+                           (req->etag->len > 0 ? req->etag->str : NULL),
+                           (req->modified->len > 0 ? req->modified->str : NULL),
+                           dc_api_sync_data(sync), dc_api_sync_datalen(sync)
+                );
+        }
+    }
+
+    return CURLE_OK;
+}
+
+/* Only calls that may safely be made twice, and that haven't handed out
+ * any part of their reply yet, are tried again, after a delay that
+ * doubles every time. Whatever the server or the network does, they are
+ * done by their deadline.
+ */
+static bool dc_api_retry(dc_api_t api, dc_api_request_t *req,
+                         dc_api_sync_t sync, int code, long status)
+{
+    int64_t delay = 0, now = g_get_monotonic_time();
+    bool transient = false;
+
+    return_if_true(!req->idempotent, false);
+    return_if_true(req->errors >= DC_API_RETRIES, false);
+    return_if_true(dc_api_sync_split_up(sync), false);
+
+    switch (code) {
+    case CURLE_OK:
+        transient = (status == 500 || status == 502 ||
+                     status == 503 || status == 504);
+        break;
+
+    case CURLE_COULDNT_RESOLVE_HOST:
+    case CURLE_COULDNT_CONNECT:
+    case CURLE_SSL_CONNECT_ERROR:
+    case CURLE_SEND_ERROR:
+    case CURLE_RECV_ERROR:
+    case CURLE_GOT_NOTHING:
+    case CURLE_PARTIAL_FILE:
+    case CURLE_HTTP2:
+    case CURLE_HTTP2_STREAM:
+        transient = true;
+        break;
+
+    default:
+        break;
+    }
+    return_if_true(!transient, false);
+
+    delay = (int64_t)DC_API_RETRY_BACKOFF * 1000 * (1 << req->errors);
+    delay += g_random_int_range(0, (gint32)(delay / 2) + 1);
+    return_if_true(now + delay >= req->deadline, false);
+
+    return_if_true(!dc_api_sync_reset(sync), false);
+
+    ++req->errors;
+    req->not_before = now + delay;
+
+    return true;
 }
 
 void dc_api_signal(dc_api_t api, CURL *easy, int code)
 {
     dc_api_sync_t sync = NULL;
+    dc_api_request_t *req = NULL;
+    long status = 0;
 
     return_if_true(api == NULL,);
     return_if_true(easy == NULL,);
 
+    pthread_mutex_lock(&api->mtx);
     sync = g_hash_table_lookup(api->syncs, easy);
-    if (sync != NULL) {
-        dc_api_sync_finish(sync, code);
-        g_hash_table_remove(api->syncs, easy);
+    req = g_hash_table_lookup(api->requests, easy);
+    pthread_mutex_unlock(&api->mtx);
+
+    return_if_true(sync == NULL,);
+
+    dc_api_account(api, easy);
+    /* here, on the loop thread, and not wherever the last reference
+     * of the sync happens to go away
+     */
+    curl_multi_remove_handle(api->curl, easy);
+
+    if (req != NULL) {
+        req->running = false;
+        curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &status);
+    }
+
+    if (req != NULL && code == CURLE_OK) {
+        dc_ratelimit_update(api->limits, req->route->str, &req->headers,
+                            status, g_get_monotonic_time()
+            );
+
+        /* the bucket now knows how long to wait, so hold the call
+         * until then, instead of failing it
+         */
+        if (status == 429 && req->retries < DC_API_RATELIMIT_RETRIES &&
+            dc_api_sync_reset(sync)) {
+            dc_api_record(api, req, code, status, true);
+            ++req->retries;
+            ++api->stats.retried;
+            dc_ratelimit_headers_init(&req->headers);
+            dc_api_dispatch(api, easy);
+            return;
+        }
+    }
+
+    if (req != NULL && dc_api_retry(api, req, sync, code, status)) {
+        dc_api_record(api, req, code, status, true);
+        ++api->stats.reattempts;
+        dc_ratelimit_headers_init(&req->headers);
+        dc_api_dispatch(api, easy);
+        return;
     }
+
+    if (req != NULL) {
+        dc_api_record(api, req, code, status, false);
+        if (code == CURLE_OPERATION_TIMEDOUT) {
+            ++api->stats.timedout;
+        }
+    }
+
+    if (req != NULL && code == CURLE_OK && req->cachekey->len > 0) {
+        code = dc_api_revalidated(api, req, sync, status);
+    }
+
+    dc_api_finish(api, easy, code);
 }
 
 #ifdef DEBUG
@@ -116,56 +1177,116 @@ int debug_callback(CURL *handle, curl_infotype type,
 }
 #endif
 
+/* of HTTP/2 streams, 16 is the default
+ */
+static long const dc_api_weights[DC_API_PRIORITIES] = { 256, 16, 1 };
+
+static size_t dc_api_header(char *buffer, size_t size, size_t n, void *arg)
+{
+    dc_api_request_t *req = (dc_api_request_t*)arg;
+
+    dc_ratelimit_header(&req->headers, buffer, size * n);
+
+    /* the body comes after all headers, so it is known by then whether
+     * it has to be kept whole for the cache
+     */
+    if (req->cachekey->len > 0) {
+        dc_cache_header(req->etag, req->modified, buffer, size * n);
+        dc_api_sync_set_buffered(req->sync, (req->etag->len > 0 ||
+                                             req->modified->len > 0));
+    }
+
+    return size * n;
+}
+
 static dc_api_sync_t
 dc_api_do(dc_api_t api, char const *verb,
-          char const *url, char const *token,
-          char const *data, int64_t len)
+          char const *method, char const *token,
+          char const *body, size_t len,
+          dc_api_sync_done_t done, dc_api_sync_element_t element,
+          void *arg)
 {
     return_if_true(api == NULL, NULL);
     return_if_true(api->curl == NULL, NULL);
-    return_if_true(url == NULL, NULL);
+    return_if_true(method == NULL, NULL);
     return_if_true(verb == NULL, NULL);
 
     CURL *c = NULL;
     bool ret = false;
     dc_api_sync_t sync = NULL;
-    struct curl_slist *l = NULL;
-    char *tmp = NULL;
+    dc_api_request_t *req = NULL;
+    dc_api_scratch_t *scratch = NULL;
+    struct curl_slist *headers = NULL;
 
-    c = curl_easy_init();
-    goto_if_true(c == NULL, cleanup);
+    scratch = dc_api_scratch_get();
+    goto_if_true(scratch == NULL, cleanup);
+
+    req = dc_api_request_get(api);
+    goto_if_true(req == NULL, cleanup);
+    c = req->easy;
 
     sync = dc_api_sync_new(api->curl, c);
-    goto_if_true(c == NULL, cleanup);
+    goto_if_true(sync == NULL, cleanup);
+
+    dc_api_sync_set_done(sync, done, arg);
+    dc_api_sync_set_element(sync, element);
+    req->sync = sync;
 
-    curl_easy_setopt(c, CURLOPT_URL, url);
-    curl_easy_setopt(c, CURLOPT_WRITEFUNCTION, fwrite);
-    curl_easy_setopt(c, CURLOPT_WRITEDATA, dc_api_sync_stream(sync));
+    dc_ratelimit_route(req->route, verb, method);
+
+    dc_share_attach(api->share, c);
+
+    /* curl keeps a copy of the URL, so the scratch can be reused
+     */
+    g_string_assign(scratch->full, DISCORD_URL "/");
+    g_string_append(scratch->full, method);
+    curl_easy_setopt(c, CURLOPT_URL, scratch->full->str);
+
+    curl_easy_setopt(c, CURLOPT_WRITEFUNCTION, dc_api_sync_write);
+    curl_easy_setopt(c, CURLOPT_WRITEDATA, sync);
+    curl_easy_setopt(c, CURLOPT_HEADERFUNCTION, dc_api_header);
+    curl_easy_setopt(c, CURLOPT_HEADERDATA, req);
 
     if (api->cookie != NULL) {
         curl_easy_setopt(c, CURLOPT_COOKIE, api->cookie);
     }
 
-    l = dc_api_sync_list(sync);
-    if (data != NULL) {
-        curl_slist_append(l, "Content-Type: application/json");
+    headers = dc_api_headers(api, token, body != NULL);
+    if (strcmp(verb, "GET") == 0) {
+        dc_cache_key(req->cachekey, token, method);
+        req->validators = dc_cache_headers(api->cache, req->cachekey->str,
+                                           headers
+            );
     }
-    curl_slist_append(l, "Accept: application/json");
-    curl_slist_append(l, "User-Agent: " DISCORD_USERAGENT);
-    curl_slist_append(l, "Pragma: no-cache");
-    curl_slist_append(l, "Cache-Control: no-cache");
+    curl_easy_setopt(c, CURLOPT_HTTPHEADER,
+                     (req->validators != NULL ? req->validators : headers)
+        );
+    /* all REST calls go to the same host, so keep the connection
+     * around, and multiplex over it if the server speaks HTTP/2.
+     * PIPEWAIT makes curl wait for a pending connection to finish its
+     * handshake, rather than opening another one next to it.
+     */
+    curl_easy_setopt(c, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+    curl_easy_setopt(c, CURLOPT_PIPEWAIT, 1L);
+    curl_easy_setopt(c, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(c, CURLOPT_FOLLOWLOCATION, 1L);
 
-    if (token != NULL) {
-        asprintf(&tmp, "Authorization: %s", token);
-        curl_slist_append(l, tmp);
-        free(tmp);
-        tmp = NULL;
-    }
+    /* the deadline covers all attempts, and the time spent waiting in
+     * between them
+     */
+    req->created = g_get_monotonic_time();
+    req->deadline = req->created + scratch->timeout * 1000;
+    req->idempotent = (strcmp(verb, "GET") == 0);
+    req->cancel = scratch->cancel;
+    curl_easy_setopt(c, CURLOPT_CONNECTTIMEOUT_MS, (long)DC_API_CONNECT_TIMEOUT);
+    curl_easy_setopt(c, CURLOPT_TIMEOUT_MS, (long)scratch->timeout);
 
-    curl_easy_setopt(c, CURLOPT_HTTPHEADER, l);
-    curl_easy_setopt(c, CURLOPT_FORBID_REUSE, 1L);
-    //curl_easy_setopt(c, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
-    curl_easy_setopt(c, CURLOPT_FOLLOWLOCATION, 1L);
+    /* streams that share a connection get its bandwidth by weight
+     */
+    req->priority = scratch->priority;
+    curl_easy_setopt(c, CURLOPT_STREAM_WEIGHT,
+                     dc_api_weights[req->priority]
+        );
 
 #ifdef DEBUG
     curl_easy_setopt(c, CURLOPT_VERBOSE, 1L);
@@ -177,11 +1298,18 @@ dc_api_do(dc_api_t api, char const *verb,
         curl_easy_setopt(c, CURLOPT_POSTREDIR, CURL_REDIR_POST_ALL);
     }
 
-    if (data != NULL) {
-        if (len >= 0) {
-            curl_easy_setopt(c, CURLOPT_POSTFIELDSIZE_LARGE, len);
-        }
-        curl_easy_setopt(c, CURLOPT_COPYPOSTFIELDS, data);
+    /* the request keeps the body until the call is done, and its
+     * buffer is reused by the next call, so curl need not copy it
+     */
+    g_string_truncate(req->body, 0);
+    if (body != NULL) {
+        g_string_append_len(req->body, body, len);
+    }
+    if (body != NULL || strcmp(verb, "POST") == 0) {
+        curl_easy_setopt(c, CURLOPT_POSTFIELDSIZE_LARGE,
+                         (curl_off_t)req->body->len
+            );
+        curl_easy_setopt(c, CURLOPT_POSTFIELDS, req->body->str);
     }
 
     if (strcmp(verb, "PUT") == 0 ||
@@ -190,67 +1318,360 @@ dc_api_do(dc_api_t api, char const *verb,
         curl_easy_setopt(c, CURLOPT_CUSTOMREQUEST, verb);
     }
 
-    if (curl_multi_add_handle(api->curl, c) != CURLM_OK) {
+    pthread_mutex_lock(&api->mtx);
+    if (req->cancel != 0 &&
+        g_hash_table_contains(api->cancels, &req->cancel)) {
+        /* cancelled before it was even made
+         */
+        pthread_mutex_unlock(&api->mtx);
         goto cleanup;
     }
-
     g_hash_table_insert(api->syncs, c, dc_ref(sync));
-    ret = true;
+    g_hash_table_insert(api->requests, c, req);
+    if (api->submit != NULL) {
+        g_queue_push_tail(api->pending[req->priority], c);
+        ret = true;
+    } else {
+        /* no loop, so whoever drives the multi is on their own, and
+         * there is no rate limiting either
+         */
+        ret = (curl_multi_add_handle(api->curl, c) == CURLM_OK);
+        if (!ret) {
+            g_hash_table_remove(api->syncs, c);
+            g_hash_table_steal(api->requests, c);
+        }
+    }
+    pthread_mutex_unlock(&api->mtx);
+
+    if (ret && api->submit != NULL) {
+        event_active(api->submit, 0, 0);
+    }
 
 cleanup:
 
     if (!ret) {
+        /* the easy handle goes back to the pool, not down with the sync
+         */
+        dc_api_sync_detach(sync);
         dc_unref(sync);
         sync = NULL;
+
+        if (req != NULL) {
+            dc_api_request_put(api, req);
+        }
     }
 
     return sync;
 }
 
+static int dc_api_dump(char const *buffer, size_t size, void *arg)
+{
+    g_string_append_len((GString*)arg, buffer, size);
+    return 0;
+}
+
+static dc_api_sync_t
+dc_api_request(dc_api_t api, char const *token,
+               char const *verb, char const *method,
+               json_t *j, dc_api_sync_done_t done,
+               dc_api_sync_element_t element, void *arg)
+{
+    GString *body = NULL;
+
+    if (j != NULL) {
+        body = dc_api_scratch_body();
+        return_if_true(body == NULL, NULL);
+        return_if_true(json_dump_callback(j, dc_api_dump, body,
+                                          JSON_COMPACT) != 0, NULL);
+    }
+
+    return dc_api_do(api, verb, method, token,
+                     (body != NULL ? body->str : NULL),
+                     (body != NULL ? body->len : 0),
+                     done, element, arg
+        );
+}
+
 dc_api_sync_t dc_api_call(dc_api_t api, char const *token,
                           char const *verb, char const *method,
                           json_t *j)
 {
-    char *data = NULL;
-    char *url = NULL;
+    return dc_api_request(api, token, verb, method, j, NULL, NULL, NULL);
+}
+
+typedef struct {
+    dc_api_t api;
+    dc_api_reply_t cb;
+    dc_api_element_t element;
+    void *data;
+} dc_api_async_t;
+
+static void dc_api_async_element(dc_api_sync_t sync, json_t *element,
+                                 void *arg)
+{
+    dc_api_async_t *a = (dc_api_async_t*)arg;
+    a->element(a->api, element, a->data);
+}
+
+static void dc_api_async_done(dc_api_sync_t sync, void *arg)
+{
+    dc_api_async_t *a = (dc_api_async_t*)arg;
+    json_t *reply = NULL, *cached = dc_api_sync_reply(sync), *val = NULL;
+    int code = dc_api_sync_code(sync);
+    size_t i = 0;
+
+    if (code == CURLE_OK && cached != NULL) {
+        /* from the cache, so it was never split while it came in
+         */
+        if (a->element != NULL && json_is_array(cached)) {
+            json_array_foreach(cached, i, val) {
+                a->element(a->api, val, a->data);
+            }
+        } else {
+            reply = json_incref(cached);
+        }
+    } else if (code == CURLE_OK && dc_api_sync_datalen(sync) > 0 &&
+               !dc_api_sync_split_up(sync)) {
+        /* an empty body is a valid answer to many calls, and the callback
+         * gets NULL for it. One that was split up may still have been kept
+         * whole for the cache, but its elements have already been given
+         * out.
+         */
+        reply = json_loadb(dc_api_sync_data(sync),
+                           dc_api_sync_datalen(sync),
+                           JSON_DECODE_ANY, NULL
+            );
+    }
+
+    a->cb(a->api, code, reply, a->data);
+
+    json_decref(reply);
+    free(a);
+}
+
+bool dc_api_call_buffer(dc_api_t api, char const *verb,
+                        char const *token, char const *method,
+                        char const *body, size_t len,
+                        dc_api_element_t element,
+                        dc_api_reply_t cb, void *data)
+{
+    dc_api_async_t *a = NULL;
     dc_api_sync_t s = NULL;
 
-    asprintf(&url, "%s/%s", DISCORD_URL, method);
-    goto_if_true(url == NULL, cleanup);
+    return_if_true(api == NULL || cb == NULL, false);
+
+    a = calloc(1, sizeof(dc_api_async_t));
+    return_if_true(a == NULL, false);
+
+    a->api = api;
+    a->cb = cb;
+    a->element = element;
+    a->data = data;
+
+    s = dc_api_do(api, verb, method, token, body, len, dc_api_async_done,
+                  (element != NULL ? dc_api_async_element : NULL), a
+        );
+    if (s == NULL) {
+        free(a);
+        return false;
+    }
+
+    /* the API keeps it until it is done
+     */
+    dc_unref(s);
+    return true;
+}
+
+bool dc_api_call_stream(dc_api_t api, char const *verb,
+                        char const *token, char const *method,
+                        json_t *j, dc_api_element_t element,
+                        dc_api_reply_t cb, void *data)
+{
+    GString *body = NULL;
 
     if (j != NULL) {
-        data = json_dumps(j, JSON_COMPACT);
-        goto_if_true(data == NULL, cleanup);
+        body = dc_api_scratch_body();
+        return_if_true(body == NULL, false);
+        return_if_true(json_dump_callback(j, dc_api_dump, body,
+                                          JSON_COMPACT) != 0, false);
     }
 
-    s = dc_api_do(api, verb, url, token, data, -1);
-    goto_if_true(s == NULL, cleanup);
+    return dc_api_call_buffer(api, verb, token, method,
+                              (body != NULL ? body->str : NULL),
+                              (body != NULL ? body->len : 0),
+                              element, cb, data
+        );
+}
 
-cleanup:
+void dc_api_empty_reply(dc_api_t api, int code, json_t *reply, void *arg)
+{
+    /* most calls that change something answer with no data at all
+     * if they worked
+     */
+    dc_api_complete(api, (dc_api_context_t*)arg,
+                    (code == CURLE_OK && reply == NULL), NULL, NULL
+        );
+}
+
+bool dc_api_call_async(dc_api_t api, char const *verb,
+                       char const *token, char const *method,
+                       json_t *j, dc_api_reply_t cb, void *data)
+{
+    return dc_api_call_stream(api, verb, token, method, j, NULL, cb, data);
+}
 
-    free(data);
-    data = NULL;
+dc_api_context_t *dc_api_context_new(dc_api_callback_t cb, void *data,
+                                     void *object)
+{
+    dc_api_context_t *ctx = calloc(1, sizeof(dc_api_context_t));
+    return_if_true(ctx == NULL, NULL);
 
-    free(url);
-    url = NULL;
+    ctx->cb = cb;
+    ctx->data = data;
+    ctx->object = dc_ref(object);
 
-    return s;
+    return ctx;
 }
 
-json_t *dc_api_call_sync(dc_api_t api, char const *token,
-                         char const *verb, char const *method,
+void dc_api_context_free(dc_api_context_t *ctx)
+{
+    return_if_true(ctx == NULL,);
+
+    dc_unref(ctx->object);
+
+    if (ctx->objects != NULL) {
+        g_ptr_array_unref(ctx->objects);
+        ctx->objects = NULL;
+    }
+
+    free(ctx);
+}
+
+typedef struct {
+    dc_api_t api;
+    dc_api_callback_t cb;
+    void *data;
+    bool ok;
+    void *result;
+    GDestroyNotify destroy;
+} dc_api_completion_t;
+
+static void dc_api_deliver(int sock, short what, void *arg)
+{
+    dc_api_completion_t *c = (dc_api_completion_t*)arg;
+
+    c->cb(c->api, c->ok, c->result, c->data);
+    if (c->result != NULL && c->destroy != NULL) {
+        c->destroy(c->result);
+    }
+
+    free(c);
+}
+
+void dc_api_complete(dc_api_t api, dc_api_context_t *ctx, bool ok,
+                     void *result, GDestroyNotify destroy)
+{
+    dc_api_completion_t *c = NULL;
+    struct timeval now = {0};
+
+    return_if_true(ctx == NULL,);
+
+    /* blocking calls wait on what might be the very thread running the
+     * callback base, so they are always woken up from here
+     */
+    if (ctx->cb != NULL && api->callback_base != NULL &&
+        ctx->cb != dc_api_wait_done) {
+        c = calloc(1, sizeof(dc_api_completion_t));
+        if (c != NULL) {
+            c->api = api;
+            c->cb = ctx->cb;
+            c->data = ctx->data;
+            c->ok = ok;
+            c->result = result;
+            c->destroy = destroy;
+
+            if (event_base_once(api->callback_base, -1, EV_TIMEOUT,
+                                dc_api_deliver, c, &now) == 0) {
+                dc_api_context_free(ctx);
+                return;
+            }
+            free(c);
+        }
+    }
+
+    if (ctx->cb != NULL) {
+        ctx->cb(api, ok, result, ctx->data);
+    }
+
+    if (result != NULL && destroy != NULL) {
+        destroy(result);
+    }
+
+    dc_api_context_free(ctx);
+}
+
+void dc_api_wait_init(dc_api_wait_t *w, void *(*keep)(void *))
+{
+    return_if_true(w == NULL,);
+
+    memset(w, 0, sizeof(dc_api_wait_t));
+    w->keep = keep;
+    pthread_mutex_init(&w->mtx, NULL);
+    pthread_cond_init(&w->cnd, NULL);
+}
+
+void dc_api_wait_done(dc_api_t api, bool ok, void *result, void *data)
+{
+    dc_api_wait_t *w = (dc_api_wait_t*)data;
+
+    pthread_mutex_lock(&w->mtx);
+    w->ok = ok;
+    if (result != NULL && w->keep != NULL) {
+        w->result = w->keep(result);
+    }
+    w->done = true;
+    pthread_cond_broadcast(&w->cnd);
+    pthread_mutex_unlock(&w->mtx);
+}
+
+bool dc_api_wait(dc_api_wait_t *w)
+{
+    bool ok = false;
+
+    return_if_true(w == NULL, false);
+
+    pthread_mutex_lock(&w->mtx);
+    while (!w->done) {
+        pthread_cond_wait(&w->cnd, &w->mtx);
+    }
+    ok = w->ok;
+    pthread_mutex_unlock(&w->mtx);
+
+    pthread_cond_destroy(&w->cnd);
+    pthread_mutex_destroy(&w->mtx);
+
+    return ok;
+}
+
+json_t *dc_api_call_sync(dc_api_t api, char const *verb,
+                         char const *token, char const *method,
                          json_t *j)
 {
     dc_api_sync_t s = NULL;
     json_t *reply = NULL;
 
-    s = dc_api_call(api, verb, token, method, j);
+    s = dc_api_call(api, token, verb, method, j);
     goto_if_true(s == NULL, cleanup);
 
     if (!dc_api_sync_wait(s)) {
         goto cleanup;
     }
 
+    if (dc_api_sync_reply(s) != NULL) {
+        reply = json_incref(dc_api_sync_reply(s));
+        goto cleanup;
+    }
+
     reply = json_loadb(dc_api_sync_data(s),
                        dc_api_sync_datalen(s),
                        0, NULL
@@ -33,6 +33,25 @@ struct dc_api_sync_
 
     pthread_mutex_t mtx;
     pthread_cond_t cnd;
+    bool finished;
+
+    dc_api_sync_done_t done;
+    void *data;
+
+    /* if set, a body that is an array is split into its elements while
+     * it comes in, and the elements are passed here one by one, instead
+     * of the whole body ending up in "buffer"
+     */
+    dc_api_sync_element_t element;
+    GByteArray *elembuf;
+    int depth;
+    bool array;
+    bool plain;
+    bool string;
+    bool escape;
+    bool buffered;
+
+    json_t *reply;
 
     CURL *easy;
     CURLM *curl;
@@ -66,6 +85,14 @@ static void dc_api_sync_free(dc_api_sync_t s)
         s->stream = NULL;
     }
 
+    if (s->elembuf != NULL) {
+        g_byte_array_unref(s->elembuf);
+        s->elembuf = NULL;
+    }
+
+    json_decref(s->reply);
+    s->reply = NULL;
+
     free(s->buffer);
     s->buffer = NULL;
     s->bufferlen = 0;
@@ -90,11 +117,183 @@ dc_api_sync_t dc_api_sync_new(CURLM *curl, CURL *easy)
     pthread_mutex_init(&ptr->mtx, NULL);
     pthread_cond_init(&ptr->cnd, NULL);
 
-    ptr->list = curl_slist_append(NULL, "");
-
     return dc_ref(ptr);
 }
 
+void dc_api_sync_set_element(dc_api_sync_t sync,
+                             dc_api_sync_element_t element)
+{
+    return_if_true(sync == NULL,);
+
+    sync->element = element;
+    if (element != NULL && sync->elembuf == NULL) {
+        sync->elembuf = g_byte_array_new();
+    }
+}
+
+void dc_api_sync_set_buffered(dc_api_sync_t sync, bool buffered)
+{
+    return_if_true(sync == NULL,);
+    sync->buffered = buffered;
+}
+
+void dc_api_sync_set_reply(dc_api_sync_t sync, json_t *reply)
+{
+    return_if_true(sync == NULL,);
+
+    json_decref(sync->reply);
+    sync->reply = json_incref(reply);
+}
+
+json_t *dc_api_sync_reply(dc_api_sync_t sync)
+{
+    return_if_true(sync == NULL, NULL);
+    return sync->reply;
+}
+
+bool dc_api_sync_split_up(dc_api_sync_t sync)
+{
+    return_if_true(sync == NULL, false);
+    return (sync->element != NULL && sync->array);
+}
+
+static bool dc_api_sync_emit(dc_api_sync_t s)
+{
+    json_t *j = NULL;
+    size_t i = 0;
+
+    /* whitespace between the elements
+     */
+    for (i = 0; i < s->elembuf->len; i++) {
+        if (!g_ascii_isspace(s->elembuf->data[i])) {
+            break;
+        }
+    }
+    if (i == s->elembuf->len) {
+        g_byte_array_set_size(s->elembuf, 0);
+        return true;
+    }
+
+    j = json_loadb((char const *)s->elembuf->data, s->elembuf->len,
+                   JSON_DECODE_ANY, NULL
+        );
+    g_byte_array_set_size(s->elembuf, 0);
+    return_if_true(j == NULL, false);
+
+    s->element(s, j, s->data);
+    json_decref(j);
+
+    return true;
+}
+
+#define dc_api_sync_keep(s, p, from, to)                                \
+    g_byte_array_append((s)->elembuf, (guint8 const *)(p) + (from),     \
+                        (to) - (from))
+
+/* Only tracks strings, and nesting, which is enough to find where each
+ * element of the top level array ends. Each element is then parsed on
+ * its own, as soon as it is complete.
+ */
+static bool dc_api_sync_split(dc_api_sync_t s, char const *p, size_t len)
+{
+    size_t i = 0, start = 0;
+
+    for (i = 0; i < len; i++) {
+        char c = p[i];
+
+        if (!s->array) {
+            continue_if_true(g_ascii_isspace(c));
+
+            if (c != '[') {
+                /* an error object, or something else that is not a list
+                 */
+                s->plain = true;
+                return_if_true(s->buffered, true);
+                return (fwrite(p + i, 1, len - i, s->stream) == len - i);
+            }
+
+            s->array = true;
+            s->depth = 1;
+            start = i + 1;
+            continue;
+        }
+
+        return_if_true(s->depth == 0, true);
+
+        if (s->string) {
+            if (s->escape) {
+                s->escape = false;
+            } else if (c == '\\') {
+                s->escape = true;
+            } else if (c == '"') {
+                s->string = false;
+            }
+            continue;
+        }
+
+        switch (c) {
+        case '"': s->string = true; break;
+        case '{':
+        case '[': ++s->depth; break;
+        case '}':
+        case ']':
+        {
+            --s->depth;
+            if (s->depth == 1) {
+                dc_api_sync_keep(s, p, start, i + 1);
+                return_if_true(!dc_api_sync_emit(s), false);
+                start = i + 1;
+            } else if (s->depth == 0) {
+                /* end of the list, anything after it is ignored
+                 */
+                dc_api_sync_keep(s, p, start, i);
+                return dc_api_sync_emit(s);
+            }
+        } break;
+
+        case ',':
+        {
+            if (s->depth == 1) {
+                dc_api_sync_keep(s, p, start, i);
+                return_if_true(!dc_api_sync_emit(s), false);
+                start = i + 1;
+            }
+        } break;
+        }
+    }
+
+    if (s->array && s->depth > 0 && start < len) {
+        dc_api_sync_keep(s, p, start, len);
+    }
+
+    return true;
+}
+
+size_t dc_api_sync_write(char *ptr, size_t size, size_t n, void *arg)
+{
+    dc_api_sync_t s = (dc_api_sync_t)arg;
+    size_t len = size * n;
+
+    if (s->element == NULL || s->plain) {
+        return fwrite(ptr, 1, len, s->stream);
+    }
+
+    if (s->buffered && fwrite(ptr, 1, len, s->stream) != len) {
+        return 0;
+    }
+
+    return (dc_api_sync_split(s, ptr, len) ? len : 0);
+}
+
+void dc_api_sync_set_done(dc_api_sync_t sync, dc_api_sync_done_t done,
+                          void *data)
+{
+    return_if_true(sync == NULL,);
+
+    sync->done = done;
+    sync->data = data;
+}
+
 struct curl_slist *dc_api_sync_list(dc_api_sync_t sync)
 {
     return_if_true(sync == NULL, NULL);
@@ -125,19 +324,72 @@ int dc_api_sync_code(dc_api_sync_t sync)
     return sync->code;
 }
 
-bool dc_api_sync_wait(dc_api_sync_t sync)
+CURL *dc_api_sync_detach(dc_api_sync_t sync)
+{
+    CURL *easy = NULL;
+
+    return_if_true(sync == NULL, NULL);
+
+    pthread_mutex_lock(&sync->mtx);
+    easy = sync->easy;
+    sync->easy = NULL;
+    pthread_mutex_unlock(&sync->mtx);
+
+    return easy;
+}
+
+bool dc_api_sync_reset(dc_api_sync_t sync)
 {
+    bool ret = false;
+
     return_if_true(sync == NULL, false);
 
-    if (sync->stream == NULL && sync->buffer != NULL) {
-        return true;
+    pthread_mutex_lock(&sync->mtx);
+
+    if (sync->stream != NULL) {
+        fclose(sync->stream);
+        sync->stream = NULL;
+    }
+
+    free(sync->buffer);
+    sync->buffer = NULL;
+    sync->bufferlen = 0;
+
+    sync->stream = open_memstream(&sync->buffer, &sync->bufferlen);
+    ret = (sync->stream != NULL);
+
+    sync->depth = 0;
+    sync->array = sync->plain = false;
+    sync->string = sync->escape = false;
+    if (sync->elembuf != NULL) {
+        g_byte_array_set_size(sync->elembuf, 0);
     }
 
+    json_decref(sync->reply);
+    sync->reply = NULL;
+
+    pthread_mutex_unlock(&sync->mtx);
+
+    return ret;
+}
+
+bool dc_api_sync_wait(dc_api_sync_t sync)
+{
+    bool ret = false;
+
+    return_if_true(sync == NULL, false);
+
+    /* the transfer may well have finished before we got here, and
+     * condition variables wake up spuriously
+     */
     pthread_mutex_lock(&sync->mtx);
-    pthread_cond_wait(&sync->cnd, &sync->mtx);
+    while (!sync->finished) {
+        pthread_cond_wait(&sync->cnd, &sync->mtx);
+    }
+    ret = (sync->buffer != NULL);
     pthread_mutex_unlock(&sync->mtx);
 
-    return (sync->stream == NULL && sync->buffer != NULL);
+    return ret;
 }
 
 void dc_api_sync_finish(dc_api_sync_t sync, int code)
@@ -150,6 +402,11 @@ void dc_api_sync_finish(dc_api_sync_t sync, int code)
         fclose(sync->stream);
         sync->stream = NULL;
     }
+    sync->finished = true;
     pthread_cond_broadcast(&sync->cnd);
     pthread_mutex_unlock(&sync->mtx);
+
+    if (sync->done != NULL) {
+        sync->done(sync, sync->data);
+    }
 }
@@ -0,0 +1,486 @@
+/*
+ * Part of ncdc - a discord client for the console
+ * Copyright (C) 2019 Florian Stinglmayr <fstinglmayr@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "internal.h"
+
+/* Bodies of GET calls that came with an ETag or a Last-Modified header.
+ * The next call for the same thing sends them back, and if the server
+ * answers 304 the body from here is used. It is parsed once, the first
+ * time it is needed, and the parsed reply is kept.
+ *
+ * Entries are keyed by a digest of token and method, since what
+ * "users/@me" is depends on who asks, and the token should not end up
+ * in a file name. On disk each entry is a file of its own: the ETag on
+ * the first line, Last-Modified on the second, then the body.
+ *
+ * Neither may grow without end: memory keeps the most recently used
+ * entries, and whatever is left over on disk beyond the newest files is
+ * deleted when the directory is set.
+ */
+
+#define DC_CACHE_MAX 256
+#define DC_CACHE_FILES_MAX 1024
+
+typedef struct {
+    /* also the key in the hash table
+     */
+    char *key;
+    char *etag;
+    char *modified;
+    char *body;
+    size_t len;
+    json_t *reply;
+} dc_cache_entry_t;
+
+struct dc_cache_
+{
+    pthread_mutex_t mtx;
+
+    /* key -> dc_cache_entry_t
+     */
+    GHashTable *entries;
+    /* the same entries, most recently used first
+     */
+    GQueue *lru;
+    char *dir;
+};
+
+static void dc_cache_entry_free(dc_cache_entry_t *e)
+{
+    return_if_true(e == NULL,);
+
+    g_free(e->key);
+    g_free(e->etag);
+    g_free(e->modified);
+    g_free(e->body);
+    json_decref(e->reply);
+    free(e);
+}
+
+dc_cache_t *dc_cache_new(void)
+{
+    dc_cache_t *c = calloc(1, sizeof(dc_cache_t));
+    return_if_true(c == NULL, NULL);
+
+    c->entries = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                       (GDestroyNotify)dc_cache_entry_free
+        );
+    goto_if_true(c->entries == NULL, error);
+
+    c->lru = g_queue_new();
+    goto_if_true(c->lru == NULL, error);
+
+    pthread_mutex_init(&c->mtx, NULL);
+
+    return c;
+
+error:
+
+    if (c->entries != NULL) {
+        g_hash_table_unref(c->entries);
+    }
+    free(c);
+
+    return NULL;
+}
+
+void dc_cache_free(dc_cache_t *c)
+{
+    return_if_true(c == NULL,);
+
+    g_hash_table_unref(c->entries);
+    g_queue_free(c->lru);
+    g_free(c->dir);
+    pthread_mutex_destroy(&c->mtx);
+    free(c);
+}
+
+typedef struct {
+    time_t mtime;
+    char *path;
+} dc_cache_file_t;
+
+static gint dc_cache_newer(gconstpointer a, gconstpointer b)
+{
+    dc_cache_file_t const *fa = a, *fb = b;
+
+    return (fa->mtime > fb->mtime ? -1 : (fa->mtime < fb->mtime ? 1 : 0));
+}
+
+/* deletes all but the DC_CACHE_FILES_MAX most recently written files
+ */
+static void dc_cache_prune(char const *dir)
+{
+    GDir *d = NULL;
+    GArray *files = NULL;
+    char const *name = NULL;
+    struct stat st;
+    dc_cache_file_t f = {0};
+    size_t i = 0;
+
+    d = g_dir_open(dir, 0, NULL);
+    return_if_true(d == NULL,);
+
+    files = g_array_new(FALSE, FALSE, sizeof(dc_cache_file_t));
+    goto_if_true(files == NULL, cleanup);
+
+    while ((name = g_dir_read_name(d)) != NULL) {
+        f.path = g_build_filename(dir, name, NULL);
+        if (stat(f.path, &st) < 0 || !S_ISREG(st.st_mode)) {
+            g_free(f.path);
+            continue;
+        }
+        f.mtime = st.st_mtime;
+        g_array_append_val(files, f);
+    }
+
+    g_array_sort(files, dc_cache_newer);
+
+    for (i = 0; i < files->len; i++) {
+        dc_cache_file_t *p = &g_array_index(files, dc_cache_file_t, i);
+
+        if (i >= DC_CACHE_FILES_MAX) {
+            unlink(p->path);
+        }
+        g_free(p->path);
+    }
+
+cleanup:
+
+    if (files != NULL) {
+        g_array_free(files, TRUE);
+    }
+    g_dir_close(d);
+}
+
+bool dc_cache_set_dir(dc_cache_t *c, char const *dir)
+{
+    return_if_true(c == NULL, false);
+
+    if (dir != NULL && g_mkdir_with_parents(dir, 0700) < 0) {
+        return false;
+    }
+
+    if (dir != NULL) {
+        dc_cache_prune(dir);
+    }
+
+    pthread_mutex_lock(&c->mtx);
+    g_free(c->dir);
+    c->dir = g_strdup(dir);
+    pthread_mutex_unlock(&c->mtx);
+
+    return true;
+}
+
+void dc_cache_key(GString *out, char const *token, char const *method)
+{
+    GChecksum *sum = NULL;
+
+    return_if_true(out == NULL || method == NULL,);
+
+    g_string_truncate(out, 0);
+
+    sum = g_checksum_new(G_CHECKSUM_SHA256);
+    return_if_true(sum == NULL,);
+
+    if (token != NULL) {
+        g_checksum_update(sum, (guchar const *)token, strlen(token));
+    }
+    g_checksum_update(sum, (guchar const *)"\n", 1);
+    g_checksum_update(sum, (guchar const *)method, strlen(method));
+
+    g_string_assign(out, g_checksum_get_string(sum));
+    g_checksum_free(sum);
+}
+
+static char *dc_cache_copy(char const *p, size_t len)
+{
+    char *copy = g_malloc(len + 1);
+
+    memcpy(copy, p, len);
+    copy[len] = '\0';
+
+    return copy;
+}
+
+static char *dc_cache_line(char **p, char *end)
+{
+    char *nl = memchr(*p, '\n', end - *p);
+    char *line = NULL;
+
+    return_if_true(nl == NULL, NULL);
+
+    line = (nl > *p ? dc_cache_copy(*p, nl - *p) : NULL);
+    *p = nl + 1;
+
+    return line;
+}
+
+static void dc_cache_drop(dc_cache_t *c, dc_cache_entry_t *e)
+{
+    g_queue_remove(c->lru, e);
+    /* frees e, and the key with it
+     */
+    g_hash_table_remove(c->entries, e->key);
+}
+
+/* e takes the place of whatever was there under its key, and the least
+ * recently used entries go once there are too many
+ */
+static void dc_cache_insert(dc_cache_t *c, dc_cache_entry_t *e)
+{
+    dc_cache_entry_t *old = g_hash_table_lookup(c->entries, e->key);
+
+    if (old != NULL) {
+        dc_cache_drop(c, old);
+    }
+
+    g_hash_table_replace(c->entries, e->key, e);
+    g_queue_push_head(c->lru, e);
+
+    while (g_queue_get_length(c->lru) > DC_CACHE_MAX) {
+        dc_cache_drop(c, g_queue_peek_tail(c->lru));
+    }
+}
+
+static dc_cache_entry_t *dc_cache_load(dc_cache_t *c, char const *key)
+{
+    dc_cache_entry_t *e = NULL;
+    char *path = NULL, *data = NULL, *p = NULL, *end = NULL;
+    gsize len = 0;
+
+    return_if_true(c->dir == NULL, NULL);
+
+    path = g_build_filename(c->dir, key, NULL);
+    goto_if_true(path == NULL, cleanup);
+    goto_if_true(!g_file_get_contents(path, &data, &len, NULL), cleanup);
+
+    e = calloc(1, sizeof(dc_cache_entry_t));
+    goto_if_true(e == NULL, cleanup);
+
+    p = data;
+    end = data + len;
+
+    if (memchr(p, '\n', end - p) == NULL) {
+        goto cleanup;
+    }
+    e->etag = dc_cache_line(&p, end);
+
+    if (memchr(p, '\n', end - p) == NULL) {
+        goto cleanup;
+    }
+    e->modified = dc_cache_line(&p, end);
+
+    e->len = end - p;
+    e->body = dc_cache_copy(p, e->len);
+    e->key = g_strdup(key);
+
+    dc_cache_insert(c, e);
+
+cleanup:
+
+    if (e != NULL && e->body == NULL) {
+        /* a broken file is as good as none
+         */
+        dc_cache_entry_free(e);
+        e = NULL;
+    }
+
+    g_free(data);
+    g_free(path);
+
+    return e;
+}
+
+static void dc_cache_save(dc_cache_t *c, char const *key,
+                          dc_cache_entry_t const *e)
+{
+    GString *data = NULL;
+    char *path = NULL;
+
+    return_if_true(c->dir == NULL,);
+
+    path = g_build_filename(c->dir, key, NULL);
+    return_if_true(path == NULL,);
+
+    data = g_string_sized_new(e->len + 128);
+    g_string_append(data, (e->etag != NULL ? e->etag : ""));
+    g_string_append_c(data, '\n');
+    g_string_append(data, (e->modified != NULL ? e->modified : ""));
+    g_string_append_c(data, '\n');
+    g_string_append_len(data, e->body, e->len);
+
+    /* goes through a temporary file, so a crash never leaves half of it
+     */
+    g_file_set_contents(path, data->str, data->len, NULL);
+
+    g_string_free(data, TRUE);
+    g_free(path);
+}
+
+static dc_cache_entry_t *dc_cache_lookup(dc_cache_t *c, char const *key)
+{
+    dc_cache_entry_t *e = g_hash_table_lookup(c->entries, key);
+
+    if (e == NULL) {
+        /* comes in at the front
+         */
+        return dc_cache_load(c, key);
+    }
+
+    g_queue_remove(c->lru, e);
+    g_queue_push_head(c->lru, e);
+
+    return e;
+}
+
+struct curl_slist *dc_cache_headers(dc_cache_t *c, char const *key,
+                                    struct curl_slist const *base)
+{
+    dc_cache_entry_t *e = NULL;
+    struct curl_slist *l = NULL;
+    struct curl_slist const *i = NULL;
+    char *tmp = NULL;
+
+    return_if_true(c == NULL || key == NULL, NULL);
+
+    pthread_mutex_lock(&c->mtx);
+
+    e = dc_cache_lookup(c, key);
+    goto_if_true(e == NULL, cleanup);
+    goto_if_true(e->etag == NULL && e->modified == NULL, cleanup);
+
+    for (i = base; i != NULL; i = i->next) {
+        l = curl_slist_append(l, i->data);
+    }
+
+    if (e->etag != NULL) {
+        asprintf(&tmp, "If-None-Match: %s", e->etag);
+        l = curl_slist_append(l, tmp);
+        free(tmp);
+        tmp = NULL;
+    }
+
+    if (e->modified != NULL) {
+        asprintf(&tmp, "If-Modified-Since: %s", e->modified);
+        l = curl_slist_append(l, tmp);
+        free(tmp);
+        tmp = NULL;
+    }
+
+cleanup:
+
+    pthread_mutex_unlock(&c->mtx);
+
+    return l;
+}
+
+json_t *dc_cache_reply(dc_cache_t *c, char const *key)
+{
+    dc_cache_entry_t *e = NULL;
+    json_t *reply = NULL;
+
+    return_if_true(c == NULL || key == NULL, NULL);
+
+    pthread_mutex_lock(&c->mtx);
+
+    e = dc_cache_lookup(c, key);
+    if (e != NULL && e->reply == NULL && e->len > 0) {
+        e->reply = json_loadb(e->body, e->len, JSON_DECODE_ANY, NULL);
+        if (e->reply == NULL) {
+            /* won't be any better next time
+             */
+            dc_cache_drop(c, e);
+            e = NULL;
+        }
+    }
+
+    if (e != NULL) {
+        reply = json_incref(e->reply);
+    }
+
+    pthread_mutex_unlock(&c->mtx);
+
+    return reply;
+}
+
+void dc_cache_store(dc_cache_t *c, char const *key,
+                    char const *etag, char const *modified,
+                    char const *body, size_t len)
+{
+    dc_cache_entry_t *e = NULL;
+
+    return_if_true(c == NULL || key == NULL || body == NULL,);
+    return_if_true(etag == NULL && modified == NULL,);
+
+    e = calloc(1, sizeof(dc_cache_entry_t));
+    return_if_true(e == NULL,);
+
+    e->key = g_strdup(key);
+    e->etag = g_strdup(etag);
+    e->modified = g_strdup(modified);
+    e->body = dc_cache_copy(body, len);
+    e->len = len;
+
+    pthread_mutex_lock(&c->mtx);
+    dc_cache_save(c, key, e);
+    dc_cache_insert(c, e);
+    pthread_mutex_unlock(&c->mtx);
+}
+
+void dc_cache_header(GString *etag, GString *modified,
+                     char const *line, size_t len)
+{
+    char const *colon = NULL;
+    size_t name = 0, vlen = 0;
+
+    return_if_true(etag == NULL || modified == NULL || line == NULL,);
+
+    /* headers of a new response (e.g. after a redirect)
+     */
+    if (len > 5 && strncmp(line, "HTTP/", 5) == 0) {
+        g_string_truncate(etag, 0);
+        g_string_truncate(modified, 0);
+        return;
+    }
+
+    colon = memchr(line, ':', len);
+    return_if_true(colon == NULL,);
+    name = colon - line;
+
+    ++colon;
+    while (colon < line + len && (*colon == ' ' || *colon == '\t')) {
+        ++colon;
+    }
+    vlen = (line + len) - colon;
+    while (vlen > 0 && (colon[vlen-1] == '\r' || colon[vlen-1] == '\n' ||
+                        colon[vlen-1] == ' ')) {
+        --vlen;
+    }
+    return_if_true(vlen == 0,);
+
+    if (name == strlen("ETag") && strncasecmp(line, "ETag", name) == 0) {
+        g_string_truncate(etag, 0);
+        g_string_append_len(etag, colon, vlen);
+    } else if (name == strlen("Last-Modified") &&
+               strncasecmp(line, "Last-Modified", name) == 0) {
+        g_string_truncate(modified, 0);
+        g_string_append_len(modified, colon, vlen);
+    }
+}
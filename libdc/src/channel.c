@@ -362,6 +362,45 @@ void dc_channel_add_messages(dc_channel_t c, dc_message_t *m, size_t s)
     g_ptr_array_sort(c->messages, (GCompareFunc)dc_message_compare);
 }
 
+void dc_channel_update_message(dc_channel_t c, dc_message_t m)
+{
+    dc_message_t old = NULL;
+    char const *id = NULL;
+    guint idx = 0;
+
+    return_if_true(c == NULL || c->messages == NULL || m == NULL,);
+
+    id = dc_message_id(m);
+    old = g_hash_table_lookup(c->messages_byid, id);
+    return_if_true(old == NULL,);
+
+    /* the edit takes the place of the old message, which might still be
+     * looked at by whoever got it from us
+     */
+    if (g_ptr_array_find(c->messages, old, &idx)) {
+        dc_unref(g_ptr_array_index(c->messages, idx));
+        g_ptr_array_index(c->messages, idx) = dc_ref(m);
+    }
+    g_hash_table_replace(c->messages_byid, strdup(id), dc_ref(m));
+
+    c->new_messages = true;
+}
+
+void dc_channel_remove_message(dc_channel_t c, char const *id)
+{
+    dc_message_t old = NULL;
+
+    return_if_true(c == NULL || c->messages == NULL || id == NULL,);
+
+    old = g_hash_table_lookup(c->messages_byid, id);
+    return_if_true(old == NULL,);
+
+    /* the array holds a reference of its own
+     */
+    g_ptr_array_remove(c->messages, old);
+    g_hash_table_remove(c->messages_byid, id);
+}
+
 bool dc_channel_compare(dc_channel_t a, dc_channel_t b)
 {
     return_if_true(a == NULL || b == NULL, false);
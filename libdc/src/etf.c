@@ -0,0 +1,498 @@
+/*
+ * Part of ncdc - a discord client for the console
+ * Copyright (C) 2019 Florian Stinglmayr <fstinglmayr@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <dc/etf.h>
+#include "internal.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+
+typedef enum {
+    ETF_VERSION = 131,
+    ETF_NEW_FLOAT = 70,
+    ETF_SMALL_INTEGER = 97,
+    ETF_INTEGER = 98,
+    ETF_FLOAT = 99,
+    ETF_ATOM = 100,
+    ETF_SMALL_TUPLE = 104,
+    ETF_LARGE_TUPLE = 105,
+    ETF_NIL = 106,
+    ETF_STRING = 107,
+    ETF_LIST = 108,
+    ETF_BINARY = 109,
+    ETF_SMALL_BIG = 110,
+    ETF_LARGE_BIG = 111,
+    ETF_SMALL_ATOM = 115,
+    ETF_MAP = 116,
+    ETF_ATOM_UTF8 = 118,
+    ETF_SMALL_ATOM_UTF8 = 119,
+} dc_etf_tag_t;
+
+/* nobody nests this deep, except those that want to blow our stack
+ */
+#define ETF_MAX_DEPTH 256
+
+typedef struct {
+    uint8_t const *data;
+    size_t len;
+    size_t pos;
+} dc_etf_reader_t;
+
+static json_t *dc_etf_decode_term(dc_etf_reader_t *r, int depth);
+
+static bool dc_etf_has(dc_etf_reader_t *r, size_t n)
+{
+    return (n <= r->len - r->pos);
+}
+
+static uint8_t dc_etf_u8(dc_etf_reader_t *r)
+{
+    return r->data[r->pos++];
+}
+
+static uint16_t dc_etf_u16(dc_etf_reader_t *r)
+{
+    uint16_t v = 0;
+    memcpy(&v, r->data + r->pos, sizeof(v));
+    r->pos += sizeof(v);
+    return GUINT16_FROM_BE(v);
+}
+
+static uint32_t dc_etf_u32(dc_etf_reader_t *r)
+{
+    uint32_t v = 0;
+    memcpy(&v, r->data + r->pos, sizeof(v));
+    r->pos += sizeof(v);
+    return GUINT32_FROM_BE(v);
+}
+
+static json_t *dc_etf_atom(dc_etf_reader_t *r, size_t len)
+{
+    char const *a = (char const *)r->data + r->pos;
+
+    return_if_true(!dc_etf_has(r, len), NULL);
+    r->pos += len;
+
+    if ((len == 3 && strncmp(a, "nil", 3) == 0) ||
+        (len == 4 && strncmp(a, "null", 4) == 0)) {
+        return json_null();
+    } else if (len == 4 && strncmp(a, "true", 4) == 0) {
+        return json_true();
+    } else if (len == 5 && strncmp(a, "false", 5) == 0) {
+        return json_false();
+    }
+
+    return json_stringn(a, len);
+}
+
+static json_t *dc_etf_big(dc_etf_reader_t *r, size_t n)
+{
+    uint8_t sign = 0;
+    uint64_t v = 0;
+    size_t i = 0;
+    char buf[30] = {0};
+
+    return_if_true(!dc_etf_has(r, n + 1), NULL);
+    sign = dc_etf_u8(r);
+
+    /* we have no use for anything larger than 64 bit
+     */
+    return_if_true(n > sizeof(v), NULL);
+
+    for (i = 0; i < n; i++) {
+        v |= ((uint64_t)r->data[r->pos + i]) << (8 * i);
+    }
+    r->pos += n;
+
+    snprintf(buf, sizeof(buf), "%s%" PRIu64, (sign ? "-" : ""), v);
+    return json_string(buf);
+}
+
+static json_t *dc_etf_list(dc_etf_reader_t *r, size_t n, int depth)
+{
+    json_t *a = json_array(), *v = NULL;
+    size_t i = 0;
+
+    return_if_true(a == NULL, NULL);
+
+    for (i = 0; i < n; i++) {
+        v = dc_etf_decode_term(r, depth + 1);
+        goto_if_true(v == NULL, error);
+        json_array_append_new(a, v);
+    }
+
+    return a;
+
+error:
+
+    json_decref(a);
+    return NULL;
+}
+
+static json_t *dc_etf_map(dc_etf_reader_t *r, size_t n, int depth)
+{
+    json_t *o = json_object(), *k = NULL, *v = NULL;
+    char buf[30] = {0};
+    char const *key = NULL;
+    size_t i = 0;
+
+    return_if_true(o == NULL, NULL);
+
+    for (i = 0; i < n; i++) {
+        k = dc_etf_decode_term(r, depth + 1);
+        goto_if_true(k == NULL, error);
+
+        if (json_is_string(k)) {
+            key = json_string_value(k);
+        } else if (json_is_integer(k)) {
+            snprintf(buf, sizeof(buf), "%" JSON_INTEGER_FORMAT,
+                     json_integer_value(k)
+                );
+            key = buf;
+        } else {
+            goto error;
+        }
+
+        v = dc_etf_decode_term(r, depth + 1);
+        goto_if_true(v == NULL, error);
+
+        json_object_set_new(o, key, v);
+        json_decref(k);
+        k = NULL;
+    }
+
+    return o;
+
+error:
+
+    json_decref(k);
+    json_decref(o);
+    return NULL;
+}
+
+static json_t *dc_etf_decode_term(dc_etf_reader_t *r, int depth)
+{
+    uint8_t tag = 0;
+    size_t n = 0;
+
+    return_if_true(depth > ETF_MAX_DEPTH, NULL);
+    return_if_true(!dc_etf_has(r, 1), NULL);
+
+    tag = dc_etf_u8(r);
+
+    switch (tag) {
+    case ETF_SMALL_INTEGER:
+    {
+        return_if_true(!dc_etf_has(r, 1), NULL);
+        return json_integer(dc_etf_u8(r));
+    } break;
+
+    case ETF_INTEGER:
+    {
+        return_if_true(!dc_etf_has(r, 4), NULL);
+        return json_integer((int32_t)dc_etf_u32(r));
+    } break;
+
+    case ETF_NEW_FLOAT:
+    {
+        uint64_t bits = 0;
+        double d = 0;
+
+        return_if_true(!dc_etf_has(r, sizeof(bits)), NULL);
+        memcpy(&bits, r->data + r->pos, sizeof(bits));
+        r->pos += sizeof(bits);
+
+        bits = GUINT64_FROM_BE(bits);
+        memcpy(&d, &bits, sizeof(d));
+
+        return json_real(d);
+    } break;
+
+    case ETF_FLOAT:
+    {
+        char buf[32] = {0};
+
+        return_if_true(!dc_etf_has(r, 31), NULL);
+        memcpy(buf, r->data + r->pos, 31);
+        r->pos += 31;
+
+        return json_real(strtod(buf, NULL));
+    } break;
+
+    case ETF_ATOM:
+    case ETF_ATOM_UTF8:
+    {
+        return_if_true(!dc_etf_has(r, 2), NULL);
+        n = dc_etf_u16(r);
+        return dc_etf_atom(r, n);
+    } break;
+
+    case ETF_SMALL_ATOM:
+    case ETF_SMALL_ATOM_UTF8:
+    {
+        return_if_true(!dc_etf_has(r, 1), NULL);
+        n = dc_etf_u8(r);
+        return dc_etf_atom(r, n);
+    } break;
+
+    case ETF_BINARY:
+    {
+        char const *b = NULL;
+
+        return_if_true(!dc_etf_has(r, 4), NULL);
+        n = dc_etf_u32(r);
+        return_if_true(!dc_etf_has(r, n), NULL);
+
+        b = (char const *)r->data + r->pos;
+        r->pos += n;
+
+        return json_stringn(b, n);
+    } break;
+
+    case ETF_SMALL_BIG:
+    {
+        return_if_true(!dc_etf_has(r, 1), NULL);
+        n = dc_etf_u8(r);
+        return dc_etf_big(r, n);
+    } break;
+
+    case ETF_LARGE_BIG:
+    {
+        return_if_true(!dc_etf_has(r, 4), NULL);
+        n = dc_etf_u32(r);
+        return dc_etf_big(r, n);
+    } break;
+
+    case ETF_NIL:
+    {
+        return json_array();
+    } break;
+
+    case ETF_STRING:
+    {
+        /* erlang's idea of a string is a list of small integers
+         */
+        json_t *a = NULL;
+        size_t i = 0;
+
+        return_if_true(!dc_etf_has(r, 2), NULL);
+        n = dc_etf_u16(r);
+        return_if_true(!dc_etf_has(r, n), NULL);
+
+        a = json_array();
+        return_if_true(a == NULL, NULL);
+
+        for (i = 0; i < n; i++) {
+            json_array_append_new(a, json_integer(dc_etf_u8(r)));
+        }
+
+        return a;
+    } break;
+
+    case ETF_LIST:
+    {
+        json_t *a = NULL, *tail = NULL;
+
+        return_if_true(!dc_etf_has(r, 4), NULL);
+        n = dc_etf_u32(r);
+
+        a = dc_etf_list(r, n, depth);
+        return_if_true(a == NULL, NULL);
+
+        /* proper lists end in NIL, everything else we ignore
+         */
+        tail = dc_etf_decode_term(r, depth + 1);
+        if (tail == NULL) {
+            json_decref(a);
+            return NULL;
+        }
+        json_decref(tail);
+
+        return a;
+    } break;
+
+    case ETF_SMALL_TUPLE:
+    {
+        return_if_true(!dc_etf_has(r, 1), NULL);
+        n = dc_etf_u8(r);
+        return dc_etf_list(r, n, depth);
+    } break;
+
+    case ETF_LARGE_TUPLE:
+    {
+        return_if_true(!dc_etf_has(r, 4), NULL);
+        n = dc_etf_u32(r);
+        return dc_etf_list(r, n, depth);
+    } break;
+
+    case ETF_MAP:
+    {
+        return_if_true(!dc_etf_has(r, 4), NULL);
+        n = dc_etf_u32(r);
+        return dc_etf_map(r, n, depth);
+    } break;
+
+    default: break;
+    }
+
+    return NULL;
+}
+
+json_t *dc_etf_decode(uint8_t const *data, size_t len)
+{
+    dc_etf_reader_t r = {0};
+
+    return_if_true(data == NULL || len < 2, NULL);
+    return_if_true(data[0] != ETF_VERSION, NULL);
+
+    r.data = data;
+    r.len = len;
+    r.pos = 1;
+
+    return dc_etf_decode_term(&r, 0);
+}
+
+static void dc_etf_put_u8(GByteArray *b, uint8_t v)
+{
+    g_byte_array_append(b, &v, 1);
+}
+
+static void dc_etf_put_u32(GByteArray *b, uint32_t v)
+{
+    v = GUINT32_TO_BE(v);
+    g_byte_array_append(b, (uint8_t const *)&v, sizeof(v));
+}
+
+static void dc_etf_put_atom(GByteArray *b, char const *a)
+{
+    dc_etf_put_u8(b, ETF_SMALL_ATOM_UTF8);
+    dc_etf_put_u8(b, strlen(a));
+    g_byte_array_append(b, (uint8_t const *)a, strlen(a));
+}
+
+static void dc_etf_put_binary(GByteArray *b, char const *s, size_t len)
+{
+    dc_etf_put_u8(b, ETF_BINARY);
+    dc_etf_put_u32(b, len);
+    g_byte_array_append(b, (uint8_t const *)s, len);
+}
+
+static bool dc_etf_encode_term(GByteArray *b, json_t *j, int depth)
+{
+    return_if_true(depth > ETF_MAX_DEPTH, false);
+
+    switch (json_typeof(j)) {
+    case JSON_OBJECT:
+    {
+        char const *key = NULL;
+        json_t *val = NULL;
+
+        dc_etf_put_u8(b, ETF_MAP);
+        dc_etf_put_u32(b, json_object_size(j));
+
+        json_object_foreach(j, key, val) {
+            dc_etf_put_binary(b, key, strlen(key));
+            return_if_true(!dc_etf_encode_term(b, val, depth + 1), false);
+        }
+    } break;
+
+    case JSON_ARRAY:
+    {
+        json_t *val = NULL;
+        size_t idx = 0;
+
+        if (json_array_size(j) > 0) {
+            dc_etf_put_u8(b, ETF_LIST);
+            dc_etf_put_u32(b, json_array_size(j));
+
+            json_array_foreach(j, idx, val) {
+                return_if_true(!dc_etf_encode_term(b, val, depth + 1), false);
+            }
+        }
+
+        dc_etf_put_u8(b, ETF_NIL);
+    } break;
+
+    case JSON_STRING:
+    {
+        dc_etf_put_binary(b, json_string_value(j), json_string_length(j));
+    } break;
+
+    case JSON_INTEGER:
+    {
+        json_int_t v = json_integer_value(j);
+
+        if (v >= 0 && v <= UINT8_MAX) {
+            dc_etf_put_u8(b, ETF_SMALL_INTEGER);
+            dc_etf_put_u8(b, v);
+        } else if (v >= INT32_MIN && v <= INT32_MAX) {
+            dc_etf_put_u8(b, ETF_INTEGER);
+            dc_etf_put_u32(b, (uint32_t)(int32_t)v);
+        } else {
+            uint64_t u = (v < 0 ? -(uint64_t)v : (uint64_t)v);
+            size_t i = 0;
+
+            dc_etf_put_u8(b, ETF_SMALL_BIG);
+            dc_etf_put_u8(b, sizeof(u));
+            dc_etf_put_u8(b, (v < 0 ? 1 : 0));
+            for (i = 0; i < sizeof(u); i++) {
+                dc_etf_put_u8(b, (u >> (8 * i)) & 0xFF);
+            }
+        }
+    } break;
+
+    case JSON_REAL:
+    {
+        double d = json_real_value(j);
+        uint64_t bits = 0;
+
+        memcpy(&bits, &d, sizeof(bits));
+        bits = GUINT64_TO_BE(bits);
+
+        dc_etf_put_u8(b, ETF_NEW_FLOAT);
+        g_byte_array_append(b, (uint8_t const *)&bits, sizeof(bits));
+    } break;
+
+    case JSON_TRUE: dc_etf_put_atom(b, "true"); break;
+    case JSON_FALSE: dc_etf_put_atom(b, "false"); break;
+    case JSON_NULL: dc_etf_put_atom(b, "nil"); break;
+    }
+
+    return true;
+}
+
+uint8_t *dc_etf_encode(json_t *j, size_t *outlen)
+{
+    GByteArray *b = NULL;
+
+    return_if_true(j == NULL || outlen == NULL, NULL);
+
+    b = g_byte_array_new();
+    return_if_true(b == NULL, NULL);
+
+    dc_etf_put_u8(b, ETF_VERSION);
+
+    if (!dc_etf_encode_term(b, j, 0)) {
+        g_byte_array_unref(b);
+        return NULL;
+    }
+
+    *outlen = b->len;
+
+    return g_byte_array_free(b, FALSE);
+}
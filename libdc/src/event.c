@@ -23,16 +23,97 @@ struct dc_event_
 {
     dc_refable_t ref;
 
-    char *type;
+    dc_event_type_t code;
+    /* points into the type table for known types, otherwise it is a copy
+     * of the string discord sent
+     */
+    char const *type;
+    char *unknown;
     json_t *payload;
+    dc_ready_t ready;
+};
+
+static char const *types[DC_EVENT_TYPE_LAST] = {
+    [DC_EVENT_TYPE_UNKNOWN] = "UNKNOWN",
+    [DC_EVENT_TYPE_READY] = "READY",
+    [DC_EVENT_TYPE_RESUMED] = "RESUMED",
+    [DC_EVENT_TYPE_CHANNEL_CREATE] = "CHANNEL_CREATE",
+    [DC_EVENT_TYPE_CHANNEL_UPDATE] = "CHANNEL_UPDATE",
+    [DC_EVENT_TYPE_CHANNEL_DELETE] = "CHANNEL_DELETE",
+    [DC_EVENT_TYPE_CHANNEL_PINS_UPDATE] = "CHANNEL_PINS_UPDATE",
+    [DC_EVENT_TYPE_CHANNEL_RECIPIENT_ADD] = "CHANNEL_RECIPIENT_ADD",
+    [DC_EVENT_TYPE_CHANNEL_RECIPIENT_REMOVE] = "CHANNEL_RECIPIENT_REMOVE",
+    [DC_EVENT_TYPE_GUILD_CREATE] = "GUILD_CREATE",
+    [DC_EVENT_TYPE_GUILD_UPDATE] = "GUILD_UPDATE",
+    [DC_EVENT_TYPE_GUILD_DELETE] = "GUILD_DELETE",
+    [DC_EVENT_TYPE_GUILD_BAN_ADD] = "GUILD_BAN_ADD",
+    [DC_EVENT_TYPE_GUILD_BAN_REMOVE] = "GUILD_BAN_REMOVE",
+    [DC_EVENT_TYPE_GUILD_EMOJIS_UPDATE] = "GUILD_EMOJIS_UPDATE",
+    [DC_EVENT_TYPE_GUILD_INTEGRATIONS_UPDATE] = "GUILD_INTEGRATIONS_UPDATE",
+    [DC_EVENT_TYPE_GUILD_MEMBER_ADD] = "GUILD_MEMBER_ADD",
+    [DC_EVENT_TYPE_GUILD_MEMBER_REMOVE] = "GUILD_MEMBER_REMOVE",
+    [DC_EVENT_TYPE_GUILD_MEMBER_UPDATE] = "GUILD_MEMBER_UPDATE",
+    [DC_EVENT_TYPE_GUILD_MEMBERS_CHUNK] = "GUILD_MEMBERS_CHUNK",
+    [DC_EVENT_TYPE_GUILD_MEMBER_LIST_UPDATE] = "GUILD_MEMBER_LIST_UPDATE",
+    [DC_EVENT_TYPE_GUILD_ROLE_CREATE] = "GUILD_ROLE_CREATE",
+    [DC_EVENT_TYPE_GUILD_ROLE_UPDATE] = "GUILD_ROLE_UPDATE",
+    [DC_EVENT_TYPE_GUILD_ROLE_DELETE] = "GUILD_ROLE_DELETE",
+    [DC_EVENT_TYPE_INVITE_CREATE] = "INVITE_CREATE",
+    [DC_EVENT_TYPE_INVITE_DELETE] = "INVITE_DELETE",
+    [DC_EVENT_TYPE_MESSAGE_CREATE] = "MESSAGE_CREATE",
+    [DC_EVENT_TYPE_MESSAGE_UPDATE] = "MESSAGE_UPDATE",
+    [DC_EVENT_TYPE_MESSAGE_DELETE] = "MESSAGE_DELETE",
+    [DC_EVENT_TYPE_MESSAGE_DELETE_BULK] = "MESSAGE_DELETE_BULK",
+    [DC_EVENT_TYPE_MESSAGE_ACK] = "MESSAGE_ACK",
+    [DC_EVENT_TYPE_MESSAGE_REACTION_ADD] = "MESSAGE_REACTION_ADD",
+    [DC_EVENT_TYPE_MESSAGE_REACTION_REMOVE] = "MESSAGE_REACTION_REMOVE",
+    [DC_EVENT_TYPE_MESSAGE_REACTION_REMOVE_ALL] = "MESSAGE_REACTION_REMOVE_ALL",
+    [DC_EVENT_TYPE_MESSAGE_REACTION_REMOVE_EMOJI] = "MESSAGE_REACTION_REMOVE_EMOJI",
+    [DC_EVENT_TYPE_PRESENCE_UPDATE] = "PRESENCE_UPDATE",
+    [DC_EVENT_TYPE_PRESENCES_REPLACE] = "PRESENCES_REPLACE",
+    [DC_EVENT_TYPE_SESSIONS_REPLACE] = "SESSIONS_REPLACE",
+    [DC_EVENT_TYPE_TYPING_START] = "TYPING_START",
+    [DC_EVENT_TYPE_RELATIONSHIP_ADD] = "RELATIONSHIP_ADD",
+    [DC_EVENT_TYPE_RELATIONSHIP_REMOVE] = "RELATIONSHIP_REMOVE",
+    [DC_EVENT_TYPE_USER_UPDATE] = "USER_UPDATE",
+    [DC_EVENT_TYPE_USER_SETTINGS_UPDATE] = "USER_SETTINGS_UPDATE",
+    [DC_EVENT_TYPE_USER_GUILD_SETTINGS_UPDATE] = "USER_GUILD_SETTINGS_UPDATE",
+    [DC_EVENT_TYPE_USER_NOTE_UPDATE] = "USER_NOTE_UPDATE",
+    [DC_EVENT_TYPE_VOICE_STATE_UPDATE] = "VOICE_STATE_UPDATE",
+    [DC_EVENT_TYPE_VOICE_SERVER_UPDATE] = "VOICE_SERVER_UPDATE",
+    [DC_EVENT_TYPE_WEBHOOKS_UPDATE] = "WEBHOOKS_UPDATE",
+};
+
+/* Perfect hash over all type names. The hash is FNV-1a started from
+ * DC_EVENT_HASH_SEED, and bits 16 and up of it pick the slot, which holds
+ * the type code or zero. The seed was searched for so that no two names
+ * share a slot, so adding a type means finding a new seed, and rebuilding
+ * the table.
+ */
+#define DC_EVENT_HASH_SEED 4271
+#define DC_EVENT_HASH_SIZE 128
+
+static uint8_t const slots[DC_EVENT_HASH_SIZE] = {
+     0,  0, 29,  3, 34,  0,  0, 11,  0,  1, 42,  0,
+    20,  0,  0,  9, 24,  0,  0,  0, 16, 19,  0,  0,
+     6,  0,  0, 26,  0,  0,  0,  0, 25,  0, 45,  0,
+     0,  0,  0, 33,  0,  0, 36,  0, 31,  0,  0,  0,
+     0,  0,  0,  0,  0,  0, 23,  0,  0,  0,  0,  0,
+     0, 32,  0, 15, 43,  2, 14,  0,  0,  0,  8,  0,
+     0,  4,  0,  0, 22, 40, 39, 12,  0,  0,  0,  0,
+     0,  0,  0, 13,  0, 37,  0, 35, 17,  0,  0, 21,
+     0, 27,  0,  5,  0, 30,  0,  0,  0, 18, 41,  0,
+     0,  0, 44,  0,  0,  0,  7,  0,  0, 47, 38, 46,
+     0,  0,  0,  0, 28,  0, 10,  0,
 };
 
 static void dc_event_free(dc_event_t e)
 {
     return_if_true(e == NULL,);
 
-    free(e->type);
+    free(e->unknown);
     json_decref(e->payload);
+    dc_unref(e->ready);
 
     free(e);
 }
@@ -53,7 +134,13 @@ dc_event_t dc_event_new(char const *type, json_t *payload)
      * astonishment, and wonder, and then he'd say "strdup" in the worst
      * German accent. Even after 15 years that scene stuck with me.
      */
-    e->type = strdup(type);
+    e->code = dc_event_type_lookup(type);
+    if (e->code != DC_EVENT_TYPE_UNKNOWN) {
+        e->type = types[e->code];
+    } else {
+        e->unknown = strdup(type);
+        e->type = e->unknown;
+    }
 
     if (payload != NULL) {
         e->payload = json_incref(payload);
@@ -76,21 +163,50 @@ json_t *dc_event_payload(dc_event_t e)
     return e->payload;
 }
 
-dc_event_type_t dc_event_type_code(dc_event_t e)
+dc_ready_t dc_event_ready(dc_event_t e)
+{
+    return_if_true(e == NULL, NULL);
+    return e->ready;
+}
+
+void dc_event_set_ready(dc_event_t e, dc_ready_t r)
+{
+    return_if_true(e == NULL,);
+
+    dc_unref(e->ready);
+    e->ready = (r != NULL ? dc_ref(r) : NULL);
+}
+
+char const *dc_event_type_name(dc_event_type_t t)
+{
+    return_if_true(t < DC_EVENT_TYPE_UNKNOWN || t >= DC_EVENT_TYPE_LAST, NULL);
+    return types[t];
+}
+
+dc_event_type_t dc_event_type_lookup(char const *type)
 {
-    static char const *types[DC_EVENT_TYPE_LAST] = {
-        [DC_EVENT_TYPE_UNKNOWN] = "UNKNOWN",
-        [DC_EVENT_TYPE_READY] = "READY",
-        [DC_EVENT_TYPE_MESSAGE_CREATE] = "MESSAGE_CREATE",
-    };
-
-    int i = 0;
-
-    for (i = 0; i < DC_EVENT_TYPE_LAST; i++) {
-        if (strcmp(types[i], e->type) == 0) {
-            return (dc_event_type_t)i;
-        }
+    uint32_t h = DC_EVENT_HASH_SEED;
+    char const *c = NULL;
+    dc_event_type_t code = DC_EVENT_TYPE_UNKNOWN;
+
+    return_if_true(type == NULL, DC_EVENT_TYPE_UNKNOWN);
+
+    for (c = type; *c != '\0'; c++) {
+        h = (h ^ (uint8_t)*c) * 0x01000193;
     }
 
-    return DC_EVENT_TYPE_UNKNOWN;
+    code = (dc_event_type_t)slots[(h >> 16) % DC_EVENT_HASH_SIZE];
+
+    /* anything discord adds later lands on some slot as well
+     */
+    return_if_true(code == DC_EVENT_TYPE_UNKNOWN, DC_EVENT_TYPE_UNKNOWN);
+    return_if_true(strcmp(types[code], type) != 0, DC_EVENT_TYPE_UNKNOWN);
+
+    return code;
+}
+
+dc_event_type_t dc_event_type_code(dc_event_t e)
+{
+    return_if_true(e == NULL, DC_EVENT_TYPE_UNKNOWN);
+    return e->code;
 }
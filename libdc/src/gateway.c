@@ -17,8 +17,78 @@
  */
 
 #include <dc/gateway.h>
+#include <dc/etf.h>
+#include <dc/ready.h>
 #include "internal.h"
 #include <jansson.h>
+#include <zlib.h>
+
+#include <event2/bufferevent_ssl.h>
+#include <event2/dns.h>
+#include <openssl/ssl.h>
+
+/* Sizes of the blocks we read from the websocket. We start with the minimum,
+ * and double it whenever a read fills the whole block (i.e. READY, or a burst
+ * of events), and halve it again once things calm down.
+ */
+#define DC_GATEWAY_READ_MIN (64 * 1024)
+#define DC_GATEWAY_READ_MAX (1024 * 1024)
+
+/* Reconnect backoff in microseconds. The n-th consecutive failure waits a
+ * random time between zero and base * 2^n, but never more than the cap.
+ * After BREAKER failures in a row we stop trying for a good while, and then
+ * probe with a single attempt.
+ */
+#define DC_GATEWAY_BACKOFF_BASE (1 * G_USEC_PER_SEC)
+#define DC_GATEWAY_BACKOFF_CAP (60 * G_USEC_PER_SEC)
+#define DC_GATEWAY_BREAKER 10
+#define DC_GATEWAY_BREAKER_COOLDOWN (5 * 60 * G_USEC_PER_SEC)
+
+/* After an INVALID_SESSION that cannot be resumed discord wants us to wait
+ * a random time between one and five seconds before we IDENTIFY again
+ */
+#define DC_GATEWAY_INVALID_MIN (1 * G_USEC_PER_SEC)
+#define DC_GATEWAY_INVALID_MAX (5 * G_USEC_PER_SEC)
+
+/* How long we wait for the upgrade response and HELLO, and how large the
+ * upgrade response may get
+ */
+#define DC_GATEWAY_HANDSHAKE_TIMEOUT 30
+#define DC_GATEWAY_UPGRADE_MAX (16 * 1024)
+
+#define DC_WEBSOCKET_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+/* A piece of payload within the receive buffer. Offsets rather than pointers
+ * since the buffer may be reallocated when more data arrives.
+ */
+typedef struct {
+    size_t offset;
+    size_t len;
+} dc_gateway_slice_t;
+
+/* The top level fields of an op, as far as they could be found without
+ * parsing all of it. "s" is -1, and "t" empty if they are null.
+ */
+typedef struct {
+    int64_t op;
+    int64_t s;
+    char t[64];
+} dc_gateway_peek_t;
+
+/* Payload codecs, selected by dc_gateway_set_encoding(). decode() gets the
+ * payload as one or more pieces of memory, encode() returns a malloc()'d
+ * buffer that is sent in a frame of the given type. peek() is optional,
+ * and fills in the top level fields of a payload without decoding it.
+ */
+typedef struct {
+    char const *name;
+    uint8_t frame;
+    json_t *(*decode)(dc_gateway_t gw, struct evbuffer_iovec const *v,
+                      size_t len);
+    uint8_t *(*encode)(json_t *j, size_t *outlen);
+    bool (*peek)(struct evbuffer_iovec const *v, size_t len,
+                 dc_gateway_peek_t *p);
+} dc_gateway_codec_t;
 
 struct dc_gateway_
 {
@@ -26,28 +96,470 @@ struct dc_gateway_
 
     GPtrArray *ops;
     GPtrArray *out;
+
+    /* Receive buffer. Everything before "offset" has been handled, and
+     * "scan" is where the next frame starts. They only differ while the
+     * fragments of a split message are collected. With the bufferevent
+     * transport the input evbuffer of the bufferevent takes the place of
+     * "buffer".
+     */
     GByteArray *buffer;
+    size_t offset;
+    size_t scan;
+    GArray *fragments;
+    size_t readsize;
+    /* the pieces of memory the message being decoded is made of
+     */
+    GArray *vecs;
+
+    /* zlib-stream transport compression, one inflate context for the
+     * whole connection
+     */
+    bool compress;
+    bool zinit;
+    z_stream zs;
+    GByteArray *inflated;
+
+    dc_gateway_encoding_t encoding;
+    dc_gateway_codec_t const *codec;
+    /* fragmented payloads, for codecs that cannot read from slices
+     */
+    GByteArray *joined;
+
+    /* Send buffer. All queued ops are framed into it back to back, and
+     * then written in as few writes as the socket allows. "outsent" is
+     * how much of it has been written so far.
+     */
+    GByteArray *outbuf;
+    size_t outsent;
+    /* payload of the last PING, answered with the next flush
+     */
+    GByteArray *ping;
+    bool pong;
 
+    dc_gateway_stats_t stats;
+
+    dc_gateway_transport_t transport;
+
+    /* bufferevent transport, "inlen" is how much of the input evbuffer we
+     * have accounted for in the stats
+     */
+    struct bufferevent *bev;
+    struct evdns_base *dns;
+    SSL_CTX *ssl;
+    size_t inlen;
+
+    /* curl transport
+     */
     CURL *easy;
+    /* if set, DNS, TCP and TLS are done by this multi handle instead of
+     * blocking in curl_easy_perform()
+     */
+    CURLM *multi;
+    /* DNS and TLS session cache shared with the other handles of the loop,
+     * so that reconnects do not start from scratch
+     */
+    dc_share_t share;
+    /* Sec-WebSocket-Key of the current connection
+     */
+    char key[32];
+
+    /* libevent handles for the websocket, the gateway will register
+     * these with the base given to dc_gateway_set_event_base()
+     */
+    struct event_base *base;
+    struct event *read_ev;
+    struct event *write_ev;
+    struct event *heartbeat_ev;
+    struct event *identify_ev;
 
     dc_account_t login;
 
+    /* sent with IDENTIFY, see dc_gateway_set_intents()
+     */
+    uint32_t intents;
+    bool guild_subscriptions;
+    /* event types we want, NULL if we want all of them
+     */
+    GHashTable *events;
+
     dc_gateway_event_callback_t callback;
     void *callback_data;
 
+    /* Heartbeats, all times are g_get_monotonic_time() in microseconds.
+     * If discord hasn't acknowledged the last heartbeat by the time the
+     * next one is due, the connection is dead, and we drop it.
+     */
     uint64_t heartbeat_interval;
-    time_t last_heartbeat;
+    int64_t last_heartbeat;
+    int64_t next_heartbeat;
+    bool heartbeat_acked;
+    int64_t latency;
+    /* when the RESUME, or IDENTIFY after an INVALID_SESSION is due
+     */
+    int64_t next_identify;
+
+    /* Session to resume after a reconnect, and the sequence number of the
+     * last event we have seen. Both survive dc_gateway_disconnect(), so
+     * that discord only replays what we missed.
+     */
+    char *session_id;
+    int64_t seq;
+
+    /* objects of a streamed READY, until its event goes out
+     */
+    dc_ready_t ready;
+    /* READY is being built on another thread. Events that come in
+     * meanwhile are held back, so that they are dispatched after it.
+     */
+    struct dc_gateway_ready_job_ *building;
+    GPtrArray *held;
+
+    /* reconnect state machine, see dc_gateway_state()
+     */
+    dc_gateway_state_t state;
+    unsigned int failures;
+    int64_t next_attempt;
+};
+
+typedef struct {
+    struct evbuffer_iovec const *v;
+    size_t len;
+    size_t idx;
+    size_t pos;
+} dc_gateway_reader_t;
+
+/* A READY handed off to a builder thread. "done" is activated from that
+ * thread, which needs libevent to have been set up for threads. If the
+ * gateway gives up on it first, "done" is freed, and the thread frees the
+ * job once it is finished. Whichever of the two comes last frees it, the
+ * lock decides which one that is.
+ */
+typedef struct dc_gateway_ready_job_ {
+    pthread_mutex_t mtx;
+    bool cancelled;
+    bool built;
+    dc_gateway_t gw;
+    struct event *done;
+    json_t *op;
+    dc_ready_t ready;
+    size_t len;
+    char data[];
+} dc_gateway_ready_job_t;
+
+static void dc_gateway_ready_cancel(dc_gateway_t gw);
+
+static size_t dc_gateway_read_vecs(void *buffer, size_t buflen, void *arg)
+{
+    dc_gateway_reader_t *r = (dc_gateway_reader_t *)arg;
+    size_t done = 0, n = 0;
+
+    while (done < buflen && r->idx < r->len) {
+        struct evbuffer_iovec const *v = r->v + r->idx;
+
+        n = MIN(buflen - done, v->iov_len - r->pos);
+        memcpy((uint8_t*)buffer + done, (uint8_t*)v->iov_base + r->pos, n);
+
+        done += n;
+        r->pos += n;
+
+        if (r->pos >= v->iov_len) {
+            ++r->idx;
+            r->pos = 0;
+        }
+    }
+
+    return done;
+}
+
+static json_t *dc_gateway_decode_json(dc_gateway_t gw,
+                                      struct evbuffer_iovec const *v,
+                                      size_t len)
+{
+    dc_gateway_reader_t r = {0};
+
+    if (len == 1) {
+        return json_loadb((char const*)v->iov_base, v->iov_len,
+                          JSON_DISABLE_EOF_CHECK, NULL
+            );
+    }
+
+    r.v = v;
+    r.len = len;
+
+    return json_load_callback(dc_gateway_read_vecs, &r,
+                              JSON_DISABLE_EOF_CHECK, NULL
+        );
+}
+
+static int dc_gateway_peekc(dc_gateway_reader_t *r)
+{
+    while (r->idx < r->len && r->pos >= r->v[r->idx].iov_len) {
+        ++r->idx;
+        r->pos = 0;
+    }
+    return_if_true(r->idx >= r->len, -1);
+
+    return ((uint8_t const *)r->v[r->idx].iov_base)[r->pos];
+}
+
+static int dc_gateway_getc(dc_gateway_reader_t *r)
+{
+    int c = dc_gateway_peekc(r);
+
+    if (c >= 0) {
+        ++r->pos;
+    }
+
+    return c;
+}
+
+static void dc_gateway_skip_ws(dc_gateway_reader_t *r)
+{
+    int c = 0;
+
+    while ((c = dc_gateway_peekc(r)) == ' ' || c == '\t' ||
+           c == '\n' || c == '\r') {
+        ++r->pos;
+    }
+}
+
+/* Reads the rest of a string whose opening quote has been read. Escapes
+ * never show up in the names we look for, so a string with any in it, or
+ * one too long for out, comes back empty.
+ */
+static bool dc_gateway_scan_string(dc_gateway_reader_t *r,
+                                   char *out, size_t outlen)
+{
+    size_t n = 0;
+    bool clean = true;
+    int c = 0;
+
+    while ((c = dc_gateway_getc(r)) >= 0) {
+        if (c == '"') {
+            if (out != NULL) {
+                out[(clean ? n : 0)] = '\0';
+            }
+            return true;
+        }
+
+        if (c == '\\') {
+            return_if_true(dc_gateway_getc(r) < 0, false);
+            clean = false;
+        } else if (out != NULL && clean) {
+            if (n + 1 >= outlen) {
+                clean = false;
+            } else {
+                out[n++] = (char)c;
+            }
+        }
+    }
+
+    return false;
+}
+
+static bool dc_gateway_skip_value(dc_gateway_reader_t *r)
+{
+    int c = dc_gateway_peekc(r), depth = 0;
+
+    if (c == '"') {
+        dc_gateway_getc(r);
+        return dc_gateway_scan_string(r, NULL, 0);
+    }
+
+    if (c != '{' && c != '[') {
+        /* numbers, true, false, and null
+         */
+        while ((c = dc_gateway_peekc(r)) >= 0 && c != ',' && c != '}' &&
+               c != ']' && c != ' ' && c != '\t' && c != '\n' &&
+               c != '\r') {
+            ++r->pos;
+        }
+        return (c >= 0);
+    }
+
+    while ((c = dc_gateway_getc(r)) >= 0) {
+        switch (c) {
+        case '"':
+        {
+            return_if_true(!dc_gateway_scan_string(r, NULL, 0), false);
+        } break;
+        case '{':
+        case '[': ++depth; break;
+        case '}':
+        case ']':
+        {
+            --depth;
+            return_if_true(depth == 0, true);
+        } break;
+        default: break;
+        }
+    }
+
+    return false;
+}
+
+static bool dc_gateway_scan_int(dc_gateway_reader_t *r, int64_t *out)
+{
+    int64_t v = 0;
+    bool neg = false, any = false;
+    int c = dc_gateway_peekc(r);
+
+    if (c == 'n') {
+        *out = -1;
+        return dc_gateway_skip_value(r);
+    }
+
+    if (c == '-') {
+        neg = true;
+        dc_gateway_getc(r);
+    }
+
+    while ((c = dc_gateway_peekc(r)) >= '0' && c <= '9') {
+        v = v * 10 + (c - '0');
+        any = true;
+        ++r->pos;
+    }
+
+    *out = (neg ? -v : v);
+    return any;
+}
+
+/* Finds "op", "s" and "t" of a JSON payload. Discord sends these before
+ * "d", so usually only a few bytes are looked at.
+ */
+static bool dc_gateway_peek_json(struct evbuffer_iovec const *v, size_t len,
+                                 dc_gateway_peek_t *p)
+{
+    dc_gateway_reader_t r = {0};
+    char key[4] = {0};
+    bool op = false, s = false, t = false;
+    int c = 0;
+
+    r.v = v;
+    r.len = len;
+
+    p->op = -1;
+    p->s = -1;
+    p->t[0] = '\0';
+
+    dc_gateway_skip_ws(&r);
+    return_if_true(dc_gateway_getc(&r) != '{', false);
+
+    while (!(op && s && t)) {
+        dc_gateway_skip_ws(&r);
+        c = dc_gateway_getc(&r);
+        if (c == '}') {
+            break;
+        }
+
+        return_if_true(c != '"', false);
+        return_if_true(!dc_gateway_scan_string(&r, key, sizeof(key)), false);
+
+        dc_gateway_skip_ws(&r);
+        return_if_true(dc_gateway_getc(&r) != ':', false);
+        dc_gateway_skip_ws(&r);
+
+        if (strcmp(key, "op") == 0) {
+            op = dc_gateway_scan_int(&r, &p->op);
+            return_if_true(!op, false);
+        } else if (strcmp(key, "s") == 0) {
+            s = dc_gateway_scan_int(&r, &p->s);
+            return_if_true(!s, false);
+        } else if (strcmp(key, "t") == 0 && dc_gateway_peekc(&r) == '"') {
+            dc_gateway_getc(&r);
+            t = dc_gateway_scan_string(&r, p->t, sizeof(p->t));
+            return_if_true(!t, false);
+        } else {
+            t = t || (strcmp(key, "t") == 0);
+            return_if_true(!dc_gateway_skip_value(&r), false);
+        }
+
+        dc_gateway_skip_ws(&r);
+        c = dc_gateway_getc(&r);
+        if (c == '}') {
+            break;
+        }
+        return_if_true(c != ',', false);
+    }
+
+    return op;
+}
+
+static uint8_t *dc_gateway_encode_json(json_t *j, size_t *outlen)
+{
+    char *str = json_dumps(j, JSON_COMPACT);
+
+    return_if_true(str == NULL, NULL);
+    *outlen = strlen(str);
+
+    return (uint8_t*)str;
+}
+
+static json_t *dc_gateway_decode_etf(dc_gateway_t gw,
+                                     struct evbuffer_iovec const *v,
+                                     size_t len)
+{
+    size_t i = 0;
+
+    if (len == 1) {
+        return dc_etf_decode(v->iov_base, v->iov_len);
+    }
+
+    /* terms have to be in one piece, so this is the only place where
+     * fragments are copied
+     */
+    g_byte_array_set_size(gw->joined, 0);
+    for (i = 0; i < len; i++) {
+        g_byte_array_append(gw->joined, v[i].iov_base, v[i].iov_len);
+    }
+
+    return dc_etf_decode(gw->joined->data, gw->joined->len);
+}
+
+static dc_gateway_codec_t const dc_gateway_codecs[] = {
+    [GATEWAY_ENCODING_JSON] = {
+        "json", GATEWAY_FRAME_TEXT_DATA,
+        dc_gateway_decode_json, dc_gateway_encode_json,
+        dc_gateway_peek_json
+    },
+    [GATEWAY_ENCODING_ETF] = {
+        "etf", GATEWAY_FRAME_BINARY_DATA,
+        dc_gateway_decode_etf, dc_etf_encode,
+        NULL
+    },
 };
 
+void dc_gateway_set_share(dc_gateway_t gw, dc_share_t share)
+{
+    return_if_true(gw == NULL,);
+    /* the open connection is still using the old one
+     */
+    return_if_true(gw->easy != NULL,);
+
+    dc_unref(gw->share);
+    gw->share = dc_ref(share);
+}
+
+static void dc_gateway_free_events(dc_gateway_t g);
+
 static void dc_gateway_free(dc_gateway_t g)
 {
     return_if_true(g == NULL,);
 
+    dc_gateway_ready_cancel(g);
+    dc_gateway_free_events(g);
+
     if (g->ops != NULL) {
         g_ptr_array_unref(g->ops);
         g->ops = NULL;
     }
 
+    if (g->held != NULL) {
+        g_ptr_array_unref(g->held);
+        g->held = NULL;
+    }
+
     if (g->out != NULL) {
         g_ptr_array_unref(g->out);
         g->out = NULL;
@@ -58,12 +570,75 @@ static void dc_gateway_free(dc_gateway_t g)
         g->buffer = NULL;
     }
 
+    if (g->fragments != NULL) {
+        g_array_unref(g->fragments);
+        g->fragments = NULL;
+    }
+
+    if (g->zinit) {
+        inflateEnd(&g->zs);
+        g->zinit = false;
+    }
+
+    if (g->inflated != NULL) {
+        g_byte_array_unref(g->inflated);
+        g->inflated = NULL;
+    }
+
+    if (g->joined != NULL) {
+        g_byte_array_unref(g->joined);
+        g->joined = NULL;
+    }
+
+    if (g->events != NULL) {
+        g_hash_table_unref(g->events);
+        g->events = NULL;
+    }
+
+    if (g->outbuf != NULL) {
+        g_byte_array_unref(g->outbuf);
+        g->outbuf = NULL;
+    }
+
+    if (g->ping != NULL) {
+        g_byte_array_unref(g->ping);
+        g->ping = NULL;
+    }
+
     if (g->easy != NULL) {
+        if (g->multi != NULL) {
+            curl_multi_remove_handle(g->multi, g->easy);
+        }
         curl_easy_cleanup(g->easy);
         g->easy = NULL;
     }
 
+    if (g->bev != NULL) {
+        bufferevent_free(g->bev);
+        g->bev = NULL;
+    }
+
+    if (g->dns != NULL) {
+        evdns_base_free(g->dns, 0);
+        g->dns = NULL;
+    }
+
+    if (g->ssl != NULL) {
+        SSL_CTX_free(g->ssl);
+        g->ssl = NULL;
+    }
+
+    if (g->vecs != NULL) {
+        g_array_unref(g->vecs);
+        g->vecs = NULL;
+    }
+
+    dc_unref(g->ready);
     dc_unref(g->login);
+    dc_unref(g->share);
+
+    free(g->session_id);
+    g->session_id = NULL;
 
     free(g);
 }
@@ -81,9 +656,35 @@ dc_gateway_t dc_gateway_new(void)
     g->out = g_ptr_array_new_with_free_func((GDestroyNotify)json_decref);
     goto_if_true(g->out == NULL, error);
 
+    g->held = g_ptr_array_new_with_free_func((GDestroyNotify)json_decref);
+    goto_if_true(g->held == NULL, error);
+
     g->buffer = g_byte_array_new();
     goto_if_true(g->buffer == NULL, error);
 
+    g->fragments = g_array_new(FALSE, FALSE, sizeof(dc_gateway_slice_t));
+    goto_if_true(g->fragments == NULL, error);
+
+    g->ping = g_byte_array_new();
+    goto_if_true(g->ping == NULL, error);
+
+    g->vecs = g_array_new(FALSE, FALSE, sizeof(struct evbuffer_iovec));
+    goto_if_true(g->vecs == NULL, error);
+
+    g->readsize = DC_GATEWAY_READ_MIN;
+
+    g->inflated = g_byte_array_new();
+    goto_if_true(g->inflated == NULL, error);
+
+    g->joined = g_byte_array_new();
+    goto_if_true(g->joined == NULL, error);
+
+    g->outbuf = g_byte_array_new();
+    goto_if_true(g->outbuf == NULL, error);
+
+    dc_gateway_set_encoding(g, GATEWAY_ENCODING_JSON);
+    g->guild_subscriptions = true;
+
     return dc_ref(g);
 
 error:
@@ -107,330 +708,1800 @@ void dc_gateway_set_callback(dc_gateway_t gw, dc_gateway_event_callback_t c,
     gw->callback_data = userdata;
 }
 
-bool dc_gateway_connect(dc_gateway_t gw)
+void dc_gateway_set_compress(dc_gateway_t gw, bool compress)
+{
+    return_if_true(gw == NULL,);
+    gw->compress = compress;
+}
+
+void dc_gateway_set_encoding(dc_gateway_t gw, dc_gateway_encoding_t e)
 {
-    return_if_true(gw == NULL || gw->easy != NULL, true);
+    return_if_true(gw == NULL,);
+    return_if_true(e < GATEWAY_ENCODING_JSON || e > GATEWAY_ENCODING_ETF,);
 
-    char header[1000] = {0};
-    size_t outlen = 0;
-    int r = 0;
+    gw->encoding = e;
+}
+
+void dc_gateway_set_intents(dc_gateway_t gw, uint32_t intents)
+{
+    return_if_true(gw == NULL,);
+    gw->intents = intents;
+}
+
+void dc_gateway_set_guild_subscriptions(dc_gateway_t gw, bool subscribe)
+{
+    return_if_true(gw == NULL,);
+    gw->guild_subscriptions = subscribe;
+}
+
+void dc_gateway_subscribe(dc_gateway_t gw, char const *type)
+{
+    return_if_true(gw == NULL || type == NULL,);
+
+    if (gw->events == NULL) {
+        gw->events = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                           free, NULL
+            );
+        return_if_true(gw->events == NULL,);
+    }
+
+    g_hash_table_add(gw->events, strdup(type));
+}
+
+/* READY, and RESUMED drive the session state, so they are never dropped
+ */
+static bool dc_gateway_wants(dc_gateway_t gw, char const *type)
+{
+    return_if_true(gw->events == NULL || type == NULL, true);
+    return_if_true(strcmp(type, "READY") == 0, true);
+    return_if_true(strcmp(type, "RESUMED") == 0, true);
+
+    return g_hash_table_contains(gw->events, type);
+}
+
+static void dc_gateway_close(dc_gateway_t gw);
+
+void dc_gateway_set_event_base(dc_gateway_t gw, struct event_base *base)
+{
+    return_if_true(gw == NULL,);
+    return_if_true(gw->base == base,);
+
+    /* events, the connection and the resolver all live on the old base
+     */
+    dc_gateway_close(gw);
+
+    if (gw->dns != NULL) {
+        evdns_base_free(gw->dns, 0);
+        gw->dns = NULL;
+    }
+
+    gw->base = base;
+}
+
+void dc_gateway_set_transport(dc_gateway_t gw, dc_gateway_transport_t t)
+{
+    return_if_true(gw == NULL,);
+    return_if_true(t < GATEWAY_TRANSPORT_CURL ||
+                   t > GATEWAY_TRANSPORT_BUFFEREVENT,);
+
+    gw->transport = t;
+}
+
+void dc_gateway_set_curl_multi(dc_gateway_t gw, CURLM *multi)
+{
+    return_if_true(gw == NULL,);
+    gw->multi = multi;
+}
+
+static void dc_gateway_free_events(dc_gateway_t g)
+{
+    if (g->read_ev != NULL) {
+        event_free(g->read_ev);
+        g->read_ev = NULL;
+    }
+
+    if (g->write_ev != NULL) {
+        event_free(g->write_ev);
+        g->write_ev = NULL;
+    }
+
+    if (g->heartbeat_ev != NULL) {
+        event_free(g->heartbeat_ev);
+        g->heartbeat_ev = NULL;
+    }
+
+    if (g->identify_ev != NULL) {
+        event_free(g->identify_ev);
+        g->identify_ev = NULL;
+    }
+}
+
+static void dc_gateway_flush(dc_gateway_t gw);
+static void dc_gateway_queue_heartbeat(dc_gateway_t gw);
+
+static void dc_gateway_read_handler(evutil_socket_t s, short what, void *arg)
+{
+    dc_gateway_t gw = (dc_gateway_t)arg;
+    dc_gateway_process(gw);
+}
+
+static void dc_gateway_write_handler(evutil_socket_t s, short what, void *arg)
+{
+    dc_gateway_t gw = (dc_gateway_t)arg;
+    dc_gateway_flush(gw);
+}
+
+static void dc_gateway_heartbeat(dc_gateway_t gw);
+
+static void dc_gateway_heartbeat_handler(evutil_socket_t s, short what,
+                                         void *arg)
+{
+    dc_gateway_t gw = (dc_gateway_t)arg;
+
+    if (gw->heartbeat_interval == 0) {
+        /* neither the upgrade response, nor HELLO came in time
+         */
+        dc_gateway_disconnect(gw);
+        return;
+    }
+
+    dc_gateway_heartbeat(gw);
+    dc_gateway_flush(gw);
+}
+
+static void dc_gateway_login(dc_gateway_t gw);
+
+static void dc_gateway_identify_handler(evutil_socket_t s, short what,
+                                        void *arg)
+{
+    dc_gateway_t gw = (dc_gateway_t)arg;
+
+    dc_gateway_login(gw);
+    dc_gateway_flush(gw);
+}
+
+static bool dc_gateway_register_events(dc_gateway_t gw)
+{
+    curl_socket_t sock = CURL_SOCKET_BAD;
+
+    /* without an event base the user calls dc_gateway_process() on his own
+     */
+    return_if_true(gw->base == NULL, true);
+
+    gw->heartbeat_ev = evtimer_new(gw->base,
+                                   dc_gateway_heartbeat_handler, gw
+        );
+    return_if_true(gw->heartbeat_ev == NULL, false);
+
+    gw->identify_ev = evtimer_new(gw->base,
+                                  dc_gateway_identify_handler, gw
+        );
+    return_if_true(gw->identify_ev == NULL, false);
+
+    /* the bufferevent watches its socket itself
+     */
+    return_if_true(gw->bev != NULL, true);
+
+    if (curl_easy_getinfo(gw->easy, CURLINFO_ACTIVESOCKET, &sock)
+        != CURLE_OK || sock == CURL_SOCKET_BAD) {
+        return false;
+    }
+
+    gw->read_ev = event_new(gw->base, sock, EV_READ|EV_PERSIST,
+                            dc_gateway_read_handler, gw
+        );
+    return_if_true(gw->read_ev == NULL, false);
+
+    gw->write_ev = event_new(gw->base, sock, EV_WRITE,
+                             dc_gateway_write_handler, gw
+        );
+    return_if_true(gw->write_ev == NULL, false);
+
+    event_add(gw->read_ev, NULL);
+
+    return true;
+}
+
+static void dc_gateway_backoff(dc_gateway_t gw)
+{
+    int64_t delay = DC_GATEWAY_BACKOFF_CAP;
+
+    ++gw->failures;
+
+    if (gw->failures >= DC_GATEWAY_BREAKER) {
+        gw->state = GATEWAY_STATE_CIRCUIT_OPEN;
+        delay = DC_GATEWAY_BREAKER_COOLDOWN;
+    } else {
+        gw->state = GATEWAY_STATE_BACKOFF;
+        if (gw->failures < 7) {
+            delay = MIN(delay, DC_GATEWAY_BACKOFF_BASE << (gw->failures - 1));
+        }
+        /* full jitter
+         */
+        delay = (int64_t)(delay * g_random_double());
+    }
+
+    gw->next_attempt = g_get_monotonic_time() + delay;
+}
+
+static bool dc_gateway_open(dc_gateway_t gw)
+{
+    return (gw->easy != NULL || gw->bev != NULL);
+}
+
+/* discord asked us to go, which is no failure of ours, so the loop may
+ * connect again right away
+ */
+static void dc_gateway_reconnect(dc_gateway_t gw)
+{
+    return_if_true(!dc_gateway_open(gw),);
+
+    dc_gateway_close(gw);
+
+    gw->state = GATEWAY_STATE_DISCONNECTED;
+    gw->next_attempt = 0;
+}
+
+/* Close codes after which connecting again only gets us the same close
+ * code: bad token, bad shard, bad API version, and bad intents.
+ */
+static bool dc_gateway_fatal(uint16_t code)
+{
+    switch (code) {
+    case 4004:
+    case 4010:
+    case 4011:
+    case 4012:
+    case 4013:
+    case 4014:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static size_t dc_gateway_avail(dc_gateway_t gw);
+
+/* Tears down the connection, but leaves the reconnect state alone
+ */
+static void dc_gateway_close(dc_gateway_t gw)
+{
+    dc_gateway_free_events(gw);
+
+    if (gw->bev != NULL) {
+        /* also closes the socket, and frees the SSL
+         */
+        bufferevent_free(gw->bev);
+        gw->bev = NULL;
+        gw->inlen = 0;
+    }
+
+    if (gw->easy != NULL) {
+        if (gw->multi != NULL) {
+            curl_multi_remove_handle(gw->multi, gw->easy);
+        }
+        curl_easy_cleanup(gw->easy);
+        gw->easy = NULL;
+    }
+
+    if (gw->zinit) {
+        inflateEnd(&gw->zs);
+        gw->zinit = false;
+    }
+    g_byte_array_set_size(gw->inflated, 0);
+
+    /* whatever is left belongs to the old connection
+     */
+    g_byte_array_set_size(gw->buffer, 0);
+    g_array_set_size(gw->fragments, 0);
+    gw->offset = gw->scan = 0;
+    g_ptr_array_set_size(gw->ops, 0);
+    g_ptr_array_set_size(gw->out, 0);
+    g_ptr_array_set_size(gw->held, 0);
+    dc_gateway_ready_cancel(gw);
+    g_byte_array_set_size(gw->outbuf, 0);
+    gw->outsent = 0;
+    g_byte_array_set_size(gw->ping, 0);
+    gw->pong = false;
+    gw->heartbeat_interval = 0;
+    gw->next_heartbeat = 0;
+    gw->next_identify = 0;
+}
+
+static void dc_gateway_make_key(dc_gateway_t gw)
+{
+    uint32_t rnd[4] = {0};
+    gchar *key = NULL;
+    size_t i = 0;
+
+    for (i = 0; i < G_N_ELEMENTS(rnd); i++) {
+        rnd[i] = g_random_int();
+    }
+
+    key = g_base64_encode((guchar const *)rnd, sizeof(rnd));
+    g_strlcpy(gw->key, key, sizeof(gw->key));
+    g_free(key);
+}
+
+/* The transport is up, send the upgrade request. The response is handled
+ * by dc_gateway_process_upgrade() once it arrives.
+ */
+static bool dc_gateway_upgrade(dc_gateway_t gw)
+{
+    char header[1000] = {0};
+    char path[100] = {0};
+    struct timeval tv = { DC_GATEWAY_HANDSHAKE_TIMEOUT, 0 };
+    int len = 0;
+
+    gw->codec = &dc_gateway_codecs[gw->encoding];
+
+    snprintf(path, sizeof(path)-1, "%s%s%s%s",
+             DISCORD_GATEWAY_URL,
+             DISCORD_GATEWAY_ENCODING, gw->codec->name,
+             (gw->compress ? DISCORD_GATEWAY_COMPRESS : "")
+        );
+
+    if (gw->compress) {
+        memset(&gw->zs, 0, sizeof(gw->zs));
+        return_if_true(inflateInit(&gw->zs) != Z_OK, false);
+        gw->zinit = true;
+        g_byte_array_set_size(gw->inflated, 0);
+    }
+
+    dc_gateway_make_key(gw);
+
+    len = snprintf(header, sizeof(header),
+                   "GET %s HTTP/1.1\r\n"
+                   "Host: %s\r\n"
+                   "User-Agent: %s\r\n"
+                   "Pragma: no-cache\r\n"
+                   "Cache-Control: no-cache\r\n"
+                   "Connection: Upgrade\r\n"
+                   "Sec-WebSocket-Key: %s\r\n"
+                   "Sec-WebSocket-Version: 13\r\n"
+                   "Upgrade: websocket\r\n"
+                   "\r\n",
+                   path,
+                   DISCORD_GATEWAY_HOST,
+                   DISCORD_USERAGENT,
+                   gw->key
+        );
+    return_if_true(len <= 0 || (size_t)len >= sizeof(header), false);
+
+    return_if_true(!dc_gateway_register_events(gw), false);
+
+    gw->state = GATEWAY_STATE_UPGRADING;
+
+    if (gw->heartbeat_ev != NULL) {
+        evtimer_add(gw->heartbeat_ev, &tv);
+    }
+
+    if (gw->bev != NULL) {
+        return (bufferevent_write(gw->bev, header, len) == 0);
+    }
+
+    /* goes out like any other data, so a full socket is no problem
+     */
+    g_byte_array_set_size(gw->outbuf, 0);
+    g_byte_array_append(gw->outbuf, (uint8_t const *)header, len);
+    gw->outsent = 0;
+    dc_gateway_flush(gw);
+
+    return dc_gateway_open(gw);
+}
+
+/* Checks that the response to our upgrade request is a 101, and that it
+ * carries the Sec-WebSocket-Accept that belongs to our key.
+ */
+static bool dc_gateway_check_upgrade(dc_gateway_t gw, char const *data,
+                                     size_t len)
+{
+    static char const accept[] = "Sec-WebSocket-Accept:";
+    GChecksum *sha1 = NULL;
+    guint8 digest[20] = {0};
+    gsize digestlen = sizeof(digest);
+    gchar *expected = NULL;
+    char const *line = data, *eol = NULL, *value = NULL;
+    bool ok = false;
+
+    return_if_true(len < 12 || strncmp(data, "HTTP/1.1 101", 12) != 0, false);
+
+    sha1 = g_checksum_new(G_CHECKSUM_SHA1);
+    return_if_true(sha1 == NULL, false);
+
+    g_checksum_update(sha1, (guchar const *)gw->key, strlen(gw->key));
+    g_checksum_update(sha1, (guchar const *)DC_WEBSOCKET_GUID,
+                      strlen(DC_WEBSOCKET_GUID)
+        );
+    g_checksum_get_digest(sha1, digest, &digestlen);
+    g_checksum_free(sha1);
+
+    expected = g_base64_encode(digest, digestlen);
+    return_if_true(expected == NULL, false);
+
+    while (line < data + len) {
+        eol = g_strstr_len(line, data + len - line, "\r\n");
+        if (eol == NULL) {
+            break;
+        }
+
+        if ((size_t)(eol - line) > strlen(accept) &&
+            g_ascii_strncasecmp(line, accept, strlen(accept)) == 0) {
+            value = line + strlen(accept);
+            while (value < eol && (*value == ' ' || *value == '\t')) {
+                ++value;
+            }
+            ok = ((size_t)(eol - value) == strlen(expected) &&
+                  strncmp(value, expected, eol - value) == 0);
+            break;
+        }
+
+        line = eol + 2;
+    }
+
+    g_free(expected);
+
+    return ok;
+}
+
+/* Returns true once the upgrade response has arrived, and was fine
+ */
+static bool dc_gateway_process_upgrade(dc_gateway_t gw)
+{
+    static char const eoh[] = "\r\n\r\n";
+    char const *data = NULL, *end = NULL;
+    size_t len = dc_gateway_avail(gw) - gw->offset;
+
+    if (gw->bev != NULL) {
+        struct evbuffer *in = bufferevent_get_input(gw->bev);
+        struct evbuffer_ptr pos;
+
+        evbuffer_ptr_set(in, &pos, gw->offset, EVBUFFER_PTR_SET);
+        pos = evbuffer_search(in, eoh, strlen(eoh), &pos);
+
+        /* the headers are small, so making them contiguous is fine
+         */
+        if (pos.pos >= 0) {
+            data = (char const *)evbuffer_pullup(in, pos.pos + strlen(eoh));
+            data += gw->offset;
+            end = (char const *)data + (pos.pos - gw->offset);
+        }
+    } else {
+        data = (char const *)gw->buffer->data + gw->offset;
+        end = g_strstr_len(data, len, eoh);
+    }
+
+    if (end == NULL) {
+        if (len > DC_GATEWAY_UPGRADE_MAX) {
+            dc_gateway_disconnect(gw);
+        }
+        return false;
+    }
+
+    end += strlen(eoh);
+
+    if (!dc_gateway_check_upgrade(gw, data, end - data)) {
+        dc_gateway_disconnect(gw);
+        return false;
+    }
+
+    /* discord might send HELLO in the same go as the upgrade response,
+     * which is then parsed right where it is
+     */
+    gw->offset += (end - data);
+    gw->scan = gw->offset;
+
+    gw->state = GATEWAY_STATE_CONNECTED;
+
+    return true;
+}
+
+static void dc_gateway_bev_read(struct bufferevent *bev, void *arg)
+{
+    dc_gateway_t gw = (dc_gateway_t)arg;
+    dc_gateway_process(gw);
+}
+
+static void dc_gateway_bev_event(struct bufferevent *bev, short what,
+                                 void *arg)
+{
+    dc_gateway_t gw = (dc_gateway_t)arg;
+
+    if ((what & BEV_EVENT_CONNECTED) == BEV_EVENT_CONNECTED) {
+        /* the connect timeout is over, heartbeats take over from here
+         */
+        bufferevent_set_timeouts(bev, NULL, NULL);
+
+        if (!dc_gateway_upgrade(gw)) {
+            dc_gateway_disconnect(gw);
+        }
+    } else if ((what & (BEV_EVENT_EOF|BEV_EVENT_ERROR|BEV_EVENT_TIMEOUT))) {
+        dc_gateway_disconnect(gw);
+    }
+}
+
+/* libevent does DNS, TCP, TLS and all of the reading and writing. The data
+ * lands in the input evbuffer of the bufferevent, and is parsed from there.
+ */
+static bool dc_gateway_connect_bev(dc_gateway_t gw)
+{
+    struct timeval tv = { DC_GATEWAY_HANDSHAKE_TIMEOUT, 0 };
+    SSL *ssl = NULL;
+
+    /* there is no blocking fallback for this one
+     */
+    return_if_true(gw->base == NULL, false);
+
+    if (gw->dns == NULL) {
+        gw->dns = evdns_base_new(gw->base, EVDNS_BASE_INITIALIZE_NAMESERVERS);
+        return_if_true(gw->dns == NULL, false);
+    }
+
+    if (gw->ssl == NULL) {
+        gw->ssl = SSL_CTX_new(TLS_client_method());
+        return_if_true(gw->ssl == NULL, false);
+
+        SSL_CTX_set_default_verify_paths(gw->ssl);
+        SSL_CTX_set_verify(gw->ssl, SSL_VERIFY_PEER, NULL);
+    }
+
+    ssl = SSL_new(gw->ssl);
+    return_if_true(ssl == NULL, false);
+
+    SSL_set_tlsext_host_name(ssl, DISCORD_GATEWAY_HOST);
+    SSL_set1_host(ssl, DISCORD_GATEWAY_HOST);
+
+    gw->bev = bufferevent_openssl_socket_new(gw->base, -1, ssl,
+                                             BUFFEREVENT_SSL_CONNECTING,
+                                             BEV_OPT_CLOSE_ON_FREE
+        );
+    if (gw->bev == NULL) {
+        SSL_free(ssl);
+        return false;
+    }
+
+    bufferevent_openssl_set_allow_dirty_shutdown(gw->bev, 1);
+    bufferevent_setcb(gw->bev, dc_gateway_bev_read, NULL,
+                      dc_gateway_bev_event, gw
+        );
+    bufferevent_set_timeouts(gw->bev, &tv, &tv);
+    bufferevent_enable(gw->bev, EV_READ|EV_WRITE);
+
+    return (bufferevent_socket_connect_hostname(gw->bev, gw->dns, AF_UNSPEC,
+                                                DISCORD_GATEWAY_HOST, 443)
+            == 0);
+}
+
+bool dc_gateway_connect(dc_gateway_t gw)
+{
+    return_if_true(gw == NULL || dc_gateway_open(gw), true);
+
+    if (gw->transport == GATEWAY_TRANSPORT_BUFFEREVENT) {
+        gw->state = GATEWAY_STATE_CONNECTING;
+        goto_if_true(!dc_gateway_connect_bev(gw), error);
+        return true;
+    }
+
+    gw->easy = curl_easy_init();
+    goto_if_true(gw->easy == NULL, error);
+
+    /* I had already introduced libcurl in a combination with libevent for all
+     * the low level API stuff (i.e. POST/PUT/DELETE), and at the time of writing
+     * the websocket code it was too late to rip it out, and replace with something
+     * else (e.g. libwebsockets).
+     *
+     * CURL has no inbuilt way to handle websockets (yet), and thus we have to do
+     * it ourselves by using CONNECT_ONLY. It works, but it is obviously a crutch.
+     */
+
+    dc_share_attach(gw->share, gw->easy);
+
+    curl_easy_setopt(gw->easy, CURLOPT_URL, DISCORD_GATEWAY);
+    curl_easy_setopt(gw->easy, CURLOPT_FRESH_CONNECT, 1L);
+    curl_easy_setopt(gw->easy, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
+    curl_easy_setopt(gw->easy, CURLOPT_CONNECT_ONLY, 1L);
+    curl_easy_setopt(gw->easy, CURLOPT_CONNECTTIMEOUT,
+                     (long)DC_GATEWAY_HANDSHAKE_TIMEOUT
+        );
+
+    gw->state = GATEWAY_STATE_CONNECTING;
+
+    if (gw->multi != NULL) {
+        /* the loop connects for us, and tells us through
+         * dc_gateway_signal() once it is done
+         */
+        goto_if_true(curl_multi_add_handle(gw->multi, gw->easy) != CURLM_OK,
+                     error
+            );
+        return true;
+    }
+
+    /* nobody to drive us, so do it the blocking way
+     */
+    goto_if_true(curl_easy_perform(gw->easy) != CURLE_OK, error);
+
+    if (!dc_gateway_upgrade(gw)) {
+        /* might have been disconnected already
+         */
+        dc_gateway_disconnect(gw);
+        return false;
+    }
+
+    return true;
+
+error:
+
+    dc_gateway_close(gw);
+    dc_gateway_backoff(gw);
+
+    return false;
+}
+
+bool dc_gateway_signal(dc_gateway_t gw, CURL *easy, CURLcode code)
+{
+    return_if_true(gw == NULL || easy == NULL || gw->easy != easy, false);
+    return_if_true(gw->state != GATEWAY_STATE_CONNECTING, true);
+
+    if (code != CURLE_OK || !dc_gateway_upgrade(gw)) {
+        dc_gateway_disconnect(gw);
+    }
+
+    return true;
+}
+
+void dc_gateway_disconnect(dc_gateway_t gw)
+{
+    return_if_true(gw == NULL || !dc_gateway_open(gw),);
+
+    dc_gateway_close(gw);
+
+    /* connection lost, the loop will reconnect once the backoff is over
+     */
+    dc_gateway_backoff(gw);
+}
+
+bool dc_gateway_connected(dc_gateway_t gw)
+{
+    return_if_true(gw == NULL || !dc_gateway_open(gw), false);
+    return (gw->state == GATEWAY_STATE_CONNECTED);
+}
+
+dc_gateway_state_t dc_gateway_state(dc_gateway_t gw)
+{
+    return_if_true(gw == NULL, GATEWAY_STATE_DISCONNECTED);
+    return gw->state;
+}
+
+int64_t dc_gateway_reconnect_in(dc_gateway_t gw)
+{
+    int64_t now = g_get_monotonic_time();
+
+    return_if_true(gw == NULL || dc_gateway_open(gw), -1);
+    return_if_true(gw->state == GATEWAY_STATE_FAILED, -1);
+    return_if_true(gw->next_attempt <= now, 0);
+
+    return gw->next_attempt - now;
+}
+
+static json_t *dc_gateway_answer(dc_gateway_t gw)
+{
+    json_t *j = NULL;
+    char const *token = NULL;
+
+    j = json_object();
+    return_if_true(j == NULL, NULL);
+
+    token = dc_account_token(gw->login);
+    if (token != NULL) {
+        json_object_set_new(j, "token", json_string(token));
+    }
+
+    return j;
+}
+
+static void dc_gateway_queue(dc_gateway_t gw, int code, json_t *d)
+{
+    json_t *j = NULL;
+
+    j = json_object();
+    return_if_true(j == NULL,);
+
+    if (d == NULL) {
+        d = dc_gateway_answer(gw);
+    }
+
+    json_object_set_new(j, "t", json_null());
+    json_object_set_new(j, "s", json_null());
+    json_object_set_new(j, "d", d);
+    json_object_set_new(j, "op", json_integer(code));
+
+    g_ptr_array_add(gw->out, j);
+
+    /* flush once the socket becomes writable
+     */
+    if (gw->write_ev != NULL) {
+        event_add(gw->write_ev, NULL);
+    }
+}
+
+/* Heartbeats carry the last sequence number we have seen
+ */
+static json_t *dc_gateway_sequence(dc_gateway_t gw)
+{
+    return (gw->seq > 0 ? json_integer(gw->seq) : json_null());
+}
+
+static void dc_gateway_queue_heartbeat(dc_gateway_t gw)
+{
+    dc_gateway_queue(gw, GATEWAY_OPCODE_PING, dc_gateway_sequence(gw));
+    gw->last_heartbeat = g_get_monotonic_time();
+    gw->heartbeat_acked = false;
+}
+
+static void dc_gateway_schedule_heartbeat(dc_gateway_t gw, int64_t usec)
+{
+    gw->next_heartbeat = g_get_monotonic_time() + usec;
+
+    if (gw->heartbeat_ev != NULL) {
+        struct timeval tv = {0};
+
+        tv.tv_sec = usec / G_USEC_PER_SEC;
+        tv.tv_usec = usec % G_USEC_PER_SEC;
+        evtimer_add(gw->heartbeat_ev, &tv);
+    }
+}
+
+/* Called whenever a heartbeat is due
+ */
+static void dc_gateway_heartbeat(dc_gateway_t gw)
+{
+    return_if_true(!dc_gateway_connected(gw) || gw->heartbeat_interval == 0,);
+
+    if (!gw->heartbeat_acked) {
+        /* zombie connection, the session will reconnect
+         */
+        dc_gateway_disconnect(gw);
+        return;
+    }
+
+    dc_gateway_queue_heartbeat(gw);
+    dc_gateway_schedule_heartbeat(gw, gw->heartbeat_interval * 1000);
+}
+
+static void dc_gateway_queue_identify(dc_gateway_t gw)
+{
+    json_t *j = json_object(), *dev = json_object();
+    char const *token = dc_account_token(gw->login);
+
+    if (j == NULL || dev == NULL) {
+        json_decref(j);
+        json_decref(dev);
+        return;
+    }
+
+    json_object_set_new(dev, "$os", json_string("linux"));
+    json_object_set_new(dev, "$browser", json_string("libdc"));
+    json_object_set_new(dev, "$device", json_string("libdc"));
+
+    json_object_set_new(j, "token", json_string(token));
+    json_object_set_new(j, "properties", dev);
+    json_object_set_new(j, "guild_subscriptions",
+                        json_boolean(gw->guild_subscriptions)
+        );
+
+    if ((gw->intents & DISCORD_GATEWAY_INTENTS) != 0) {
+        json_object_set_new(j, "intents",
+                            json_integer(gw->intents & DISCORD_GATEWAY_INTENTS)
+            );
+    }
+
+    dc_gateway_queue(gw, GATEWAY_OPCODE_IDENTIFY, j);
+}
+
+static void dc_gateway_queue_resume(dc_gateway_t gw)
+{
+    json_t *j = json_object();
+    char const *token = dc_account_token(gw->login);
+
+    return_if_true(j == NULL,);
+
+    json_object_set_new(j, "token", json_string(token));
+    json_object_set_new(j, "session_id", json_string(gw->session_id));
+    json_object_set_new(j, "seq", json_integer(gw->seq));
+
+    dc_gateway_queue(gw, GATEWAY_OPCODE_RESUME, j);
+}
+
+static void dc_gateway_forget_session(dc_gateway_t gw)
+{
+    free(gw->session_id);
+    gw->session_id = NULL;
+    gw->seq = 0;
+}
+
+/* pick up where we left off if we can, otherwise start from scratch
+ */
+static void dc_gateway_login(dc_gateway_t gw)
+{
+    gw->next_identify = 0;
+
+    if (gw->session_id != NULL) {
+        dc_gateway_queue_resume(gw);
+    } else {
+        dc_gateway_queue_identify(gw);
+    }
+}
+
+static bool dc_gateway_handle_hello(dc_gateway_t gw, char const *s, json_t *d)
+{
+    json_t *val = NULL;
+
+    val = json_object_get(d, "heartbeat_interval");
+    return_if_true(val == NULL || !json_is_integer(val), false);
+
+    dc_gateway_login(gw);
+
+    gw->heartbeat_interval = json_integer_value(val);
+    gw->heartbeat_acked = true;
+
+    /* the first heartbeat goes out after a random fraction of the interval,
+     * so that not all clients hammer discord at once after an outage
+     */
+    dc_gateway_schedule_heartbeat(gw, (int64_t)(gw->heartbeat_interval *
+                                                1000 * g_random_double())
+        );
+
+    return true;
+}
+
+static bool dc_gateway_handle_ack(dc_gateway_t gw)
+{
+    return_if_true(gw->heartbeat_acked, true);
+
+    gw->heartbeat_acked = true;
+    gw->latency = g_get_monotonic_time() - gw->last_heartbeat;
+
+    return true;
+}
+
+static bool dc_gateway_handle_update(dc_gateway_t gw, char const *s, json_t *d)
+{
+    /* TODO
+     */
+    return true;
+}
+
+static bool dc_gateway_handle_invalid(dc_gateway_t gw)
+{
+    int64_t usec = (int64_t)g_random_double_range(DC_GATEWAY_INVALID_MIN,
+                                                  DC_GATEWAY_INVALID_MAX
+        );
+
+    dc_gateway_forget_session(gw);
+
+    /* retrying right away would only get us another INVALID_SESSION
+     */
+    gw->next_identify = g_get_monotonic_time() + usec;
+
+    if (gw->identify_ev != NULL) {
+        struct timeval tv = {0};
+
+        tv.tv_sec = usec / G_USEC_PER_SEC;
+        tv.tv_usec = usec % G_USEC_PER_SEC;
+        evtimer_add(gw->identify_ev, &tv);
+    }
+
+    return true;
+}
+
+static bool dc_gateway_handle_event(dc_gateway_t gw, char const *s, json_t *d)
+{
+    dc_event_t e = NULL;
+
+    /* only now that discord accepted our session do we know that the
+     * connection is good, HELLO alone comes before any of that
+     */
+    if (s != NULL && (strcmp(s, "READY") == 0 || strcmp(s, "RESUMED") == 0)) {
+        gw->failures = 0;
+    }
+
+    if (s != NULL && strcmp(s, "READY") == 0) {
+        json_t *id = json_object_get(d, "session_id");
+
+        free(gw->session_id);
+        gw->session_id = NULL;
+
+        if (id != NULL && json_is_string(id)) {
+            gw->session_id = strdup(json_string_value(id));
+        }
+    }
+
+    if (!dc_gateway_wants(gw, s)) {
+        ++gw->stats.filtered;
+        return true;
+    }
+
+    e = dc_event_new(s, d);
+
+    if (e != NULL && gw->ready != NULL &&
+        dc_event_type_code(e) == DC_EVENT_TYPE_READY) {
+        dc_event_set_ready(e, gw->ready);
+        dc_unref(gw->ready);
+        gw->ready = NULL;
+    }
+
+    if (gw->callback != NULL && e != NULL) {
+        gw->callback(gw, e, gw->callback_data);
+    }
+
+    dc_unref(e);
+
+    return true;
+}
+
+static bool dc_gateway_handle_op(dc_gateway_t gw, json_t *j)
+{
+    json_t *val = NULL;
+    dc_gateway_opcode_t op = 0;
+    char const *s = NULL;
+
+    val = json_object_get(j, "op");
+    return_if_true(val == NULL || !json_is_integer(val), false);
+    op = (dc_gateway_opcode_t)json_integer_value(val);
+
+    val = json_object_get(j, "t");
+    if (val != NULL && json_is_string(val)) {
+        s = json_string_value(val);
+    }
+
+    /* filtered events may have moved it on already
+     */
+    val = json_object_get(j, "s");
+    if (op == GATEWAY_OPCODE_EVENT && val != NULL && json_is_integer(val) &&
+        json_integer_value(val) > gw->seq) {
+        gw->seq = json_integer_value(val);
+    }
+
+    /* not every op carries an object, HEARTBEAT_ACK for one has none
+     */
+    val = json_object_get(j, "d");
+
+    switch (op) {
+    case GATEWAY_OPCODE_PONG: dc_gateway_handle_ack(gw); break;
+    case GATEWAY_OPCODE_PING:
+    {
+        /* discord wants a heartbeat right now, this doesn't change the
+         * schedule of the regular ones
+         */
+        dc_gateway_queue(gw, GATEWAY_OPCODE_PING, dc_gateway_sequence(gw));
+    } break;
+    case GATEWAY_OPCODE_RECONNECT:
+    {
+        /* discord wants us to reconnect, and resume
+         */
+        dc_gateway_reconnect(gw);
+        return true;
+    } break;
+    case GATEWAY_OPCODE_INVALID_SESSION:
+    {
+        /* d tells us whether the session can still be resumed, which
+         * discord wants done on a fresh connection
+         */
+        if (json_is_true(val)) {
+            dc_gateway_reconnect(gw);
+            return true;
+        }
+        dc_gateway_handle_invalid(gw);
+    } break;
+    default: break;
+    }
+
+    return_if_true(val == NULL || !json_is_object(val), false);
+
+    switch (op) {
+    case GATEWAY_OPCODE_EVENT: dc_gateway_handle_event(gw, s, val); break;
+    case GATEWAY_OPCODE_HELLO: dc_gateway_handle_hello(gw, s, val); break;
+    case GATEWAY_OPCODE_UPDATE: dc_gateway_handle_update(gw, s, val); break;
+    default: break;
+    }
+
+    return true;
+}
+
+/* The receive buffer is either our own byte array, or the input evbuffer of
+ * the bufferevent. These hide the difference from the frame parser.
+ */
+static size_t dc_gateway_avail(dc_gateway_t gw)
+{
+    if (gw->bev != NULL) {
+        return evbuffer_get_length(bufferevent_get_input(gw->bev));
+    }
+    return gw->buffer->len;
+}
+
+static void dc_gateway_copyout(dc_gateway_t gw, size_t offset,
+                               void *out, size_t len)
+{
+    struct evbuffer_ptr ptr;
+
+    if (gw->bev != NULL) {
+        struct evbuffer *in = bufferevent_get_input(gw->bev);
+
+        evbuffer_ptr_set(in, &ptr, offset, EVBUFFER_PTR_SET);
+        evbuffer_copyout_from(in, &ptr, out, len);
+    } else {
+        memcpy(out, gw->buffer->data + offset, len);
+    }
+}
+
+/* Turns the slices of a message into pointers into the receive buffer,
+ * valid until the buffer is next touched. Nothing is copied, an evbuffer
+ * may just hand out more than one piece per slice.
+ */
+static void dc_gateway_vecs(dc_gateway_t gw, dc_gateway_slice_t const *s,
+                            size_t len)
+{
+    struct evbuffer *in = NULL;
+    struct evbuffer_iovec *v = NULL;
+    struct evbuffer_ptr ptr;
+    size_t i = 0, old = 0, total = 0, k = 0;
+    int n = 0;
+
+    g_array_set_size(gw->vecs, 0);
+
+    if (gw->bev == NULL) {
+        g_array_set_size(gw->vecs, len);
+        for (i = 0; i < len; i++) {
+            v = &g_array_index(gw->vecs, struct evbuffer_iovec, i);
+            v->iov_base = gw->buffer->data + s[i].offset;
+            v->iov_len = s[i].len;
+        }
+        return;
+    }
+
+    in = bufferevent_get_input(gw->bev);
+
+    for (i = 0; i < len; i++) {
+        continue_if_true(s[i].len == 0);
+
+        evbuffer_ptr_set(in, &ptr, s[i].offset, EVBUFFER_PTR_SET);
+        n = evbuffer_peek(in, s[i].len, &ptr, NULL, 0);
+        continue_if_true(n <= 0);
+
+        old = gw->vecs->len;
+        g_array_set_size(gw->vecs, old + n);
+        v = &g_array_index(gw->vecs, struct evbuffer_iovec, old);
+        evbuffer_peek(in, s[i].len, &ptr, v, n);
+
+        /* the last piece may reach beyond the slice
+         */
+        for (k = 0, total = 0; k < (size_t)n; k++) {
+            if (total + v[k].iov_len > s[i].len) {
+                v[k].iov_len = s[i].len - total;
+            }
+            total += v[k].iov_len;
+        }
+    }
+}
+
+static void dc_gateway_compact(dc_gateway_t gw)
+{
+    size_t i = 0, drop = 0;
+
+    if (gw->bev != NULL) {
+        /* dropping data from the front of an evbuffer is cheap
+         */
+        drop = gw->offset;
+        evbuffer_drain(bufferevent_get_input(gw->bev), drop);
+        gw->inlen -= drop;
+    } else if (gw->offset == gw->buffer->len) {
+        /* everything has been handled, which is the common case
+         */
+        g_byte_array_set_size(gw->buffer, 0);
+        gw->offset = gw->scan = 0;
+    } else if (gw->offset > 0 && gw->offset >= gw->buffer->len / 2) {
+        /* only move the remains down once they are smaller than what has
+         * been handled already, so each byte is moved once at most
+         */
+        drop = gw->offset;
+        g_byte_array_remove_range(gw->buffer, 0, drop);
+    }
 
-    gw->easy = curl_easy_init();
-    goto_if_true(gw->easy == NULL, error);
+    return_if_true(drop == 0,);
 
-    /* I had already introduced libcurl in a combination with libevent for all
-     * the low level API stuff (i.e. POST/PUT/DELETE), and at the time of writing
-     * the websocket code it was too late to rip it out, and replace with something
-     * else (e.g. libwebsockets).
-     *
-     * CURL has no inbuilt way to handle websockets (yet), and thus we have to do
-     * it ourselves by using CONNECT_ONLY. It works, but it is obviously a crutch.
-     */
+    gw->scan -= drop;
+    for (i = 0; i < gw->fragments->len; i++) {
+        g_array_index(gw->fragments, dc_gateway_slice_t, i).offset -= drop;
+    }
+    gw->offset = 0;
+}
 
-    curl_easy_setopt(gw->easy, CURLOPT_URL, DISCORD_GATEWAY);
-    curl_easy_setopt(gw->easy, CURLOPT_FRESH_CONNECT, 1L);
-    curl_easy_setopt(gw->easy, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
-    curl_easy_setopt(gw->easy, CURLOPT_CONNECT_ONLY, 1L);
+static void dc_gateway_process_read(dc_gateway_t gw)
+{
+    int ret = 0;
+    size_t outlen = 0, old = 0, total = 0;
 
-    goto_if_true(curl_easy_perform(gw->easy) != CURLE_OK, error);
+    dc_gateway_compact(gw);
 
-    snprintf(header, sizeof(header)-1,
-             "GET %s HTTP/1.1\r\n"
-             "Host: %s\r\n"
-             "User-Agent: %s\r\n"
-             "Pragma: no-cache\r\n"
-             "Cache-Control: no-cache\r\n"
-             "Sec-WebSocket-Key: cbYK1Jm6cpk3Rua\r\n"
-             "Sec-WebSocket-Version: 13\r\n"
-             "Upgrade: websocket\r\n"
-             "\r\n",
-             DISCORD_GATEWAY_URL,
-             DISCORD_GATEWAY_HOST,
-             DISCORD_USERAGENT
-        );
+    if (gw->bev != NULL) {
+        /* libevent has done the reading already
+         */
+        total = dc_gateway_avail(gw) - gw->inlen;
+        gw->inlen += total;
+        gw->stats.bytes += total;
+        gw->stats.last_bytes = total;
+        return;
+    }
 
-    r = curl_easy_send(gw->easy, header, strlen(header), &outlen);
-    goto_if_true(r != CURLE_OK || outlen != strlen(header), error);
+    return_if_true(gw->easy == NULL,);
 
     do {
-        r = curl_easy_recv(gw->easy, header, sizeof(header), &outlen);
-        if (r == CURLE_OK && outlen > 0) {
-            break;
+        /* read straight into the end of the buffer
+         */
+        old = gw->buffer->len;
+        g_byte_array_set_size(gw->buffer, old + gw->readsize);
+
+        outlen = 0;
+        ret = curl_easy_recv(gw->easy, gw->buffer->data + old, gw->readsize,
+                             &outlen
+            );
+        if (ret != CURLE_OK) {
+            outlen = 0;
         }
-        if (r != CURLE_AGAIN) {
-            goto error;
+        g_byte_array_set_size(gw->buffer, old + outlen);
+
+        if (ret == CURLE_OK && outlen == 0) {
+            /* remote end closed the connection
+             */
+            break;
         }
-    } while (true);
 
-    goto_if_true(strstr(header, "HTTP/1.1 101") == NULL, error);
+        total += outlen;
 
-    return true;
+        if (outlen == gw->readsize && gw->readsize < DC_GATEWAY_READ_MAX) {
+            gw->readsize *= 2;
+        }
+    } while (ret == CURLE_OK);
 
-error:
+    if (total < gw->readsize / 4 && gw->readsize > DC_GATEWAY_READ_MIN) {
+        gw->readsize /= 2;
+    }
 
-    curl_easy_cleanup(gw->easy);
-    gw->easy = NULL;
+    gw->stats.bytes += total;
+    gw->stats.last_bytes = total;
 
-    return false;
+    if (ret != CURLE_AGAIN) {
+        /* either an error, or the other side hung up
+         */
+        dc_gateway_disconnect(gw);
+    }
 }
 
-void dc_gateway_disconnect(dc_gateway_t gw)
+/* Drops events nobody subscribed to before they are parsed. Their
+ * sequence number still counts, or a resume would replay them.
+ */
+static bool dc_gateway_filter(dc_gateway_t gw, dc_gateway_peek_t const *p)
 {
-    return_if_true(gw == NULL || gw->easy == NULL,);
+    return_if_true(gw->events == NULL, false);
+    return_if_true(p->op != GATEWAY_OPCODE_EVENT || p->t[0] == '\0', false);
+    return_if_true(dc_gateway_wants(gw, p->t), false);
 
-    curl_easy_cleanup(gw->easy);
-    gw->easy = NULL;
-}
+    if (p->s > gw->seq) {
+        gw->seq = p->s;
+    }
+    ++gw->stats.filtered;
 
-bool dc_gateway_connected(dc_gateway_t gw)
-{
-    return_if_true(gw == NULL || gw->easy == NULL, false);
     return true;
 }
 
-static json_t *dc_gateway_answer(dc_gateway_t gw)
+/* READY is streamed into objects, instead of being parsed as a whole
+ */
+static json_t *dc_gateway_decode_ready(dc_gateway_t gw,
+                                       struct evbuffer_iovec const *v,
+                                       size_t len)
 {
+    dc_gateway_reader_t r = {0};
     json_t *j = NULL;
-    char const *token = NULL;
 
-    j = json_object();
-    return_if_true(j == NULL, NULL);
+    r.v = v;
+    r.len = len;
 
-    token = dc_account_token(gw->login);
-    if (token != NULL) {
-        json_object_set_new(j, "token", json_string(token));
-    }
+    dc_unref(gw->ready);
+    gw->ready = dc_ready_load_callback(dc_gateway_read_vecs, &r, &j);
 
     return j;
 }
 
-static void dc_gateway_queue(dc_gateway_t gw, int code, json_t *d)
+static void dc_gateway_ready_free(dc_gateway_ready_job_t *job)
 {
-    json_t *j = NULL;
+    json_decref(job->op);
+    dc_unref(job->ready);
+    pthread_mutex_destroy(&job->mtx);
+    free(job);
+}
 
-    j = json_object();
-    return_if_true(j == NULL,);
+static void *dc_gateway_ready_thread(void *arg)
+{
+    dc_gateway_ready_job_t *job = (dc_gateway_ready_job_t *)arg;
+    bool cancelled = false;
 
-    if (d == NULL) {
-        d = dc_gateway_answer(gw);
+    job->ready = dc_ready_loadb_parallel(job->data, job->len, &job->op, 0);
+
+    pthread_mutex_lock(&job->mtx);
+    job->built = true;
+    cancelled = job->cancelled;
+    if (!cancelled) {
+        event_active(job->done, 0, 0);
     }
+    pthread_mutex_unlock(&job->mtx);
 
-    json_object_set_new(j, "t", json_null());
-    json_object_set_new(j, "s", json_null());
-    json_object_set_new(j, "d", d);
-    json_object_set_new(j, "op", json_integer(code));
+    if (cancelled) {
+        dc_gateway_ready_free(job);
+    }
 
-    g_ptr_array_add(gw->out, j);
+    return NULL;
 }
 
-static void dc_gateway_queue_heartbeat(dc_gateway_t gw)
+/* the connection, or the gateway, is going away, nobody wants that READY
+ */
+static void dc_gateway_ready_cancel(dc_gateway_t gw)
 {
-    dc_gateway_queue(gw, GATEWAY_OPCODE_PING, NULL);
-    gw->last_heartbeat = time(NULL);
+    dc_gateway_ready_job_t *job = gw->building;
+    bool built = false;
+
+    return_if_true(job == NULL,);
+    gw->building = NULL;
+
+    pthread_mutex_lock(&job->mtx);
+    /* also takes it off the loop, if it has been activated already
+     */
+    event_free(job->done);
+    job->done = NULL;
+    job->cancelled = true;
+    built = job->built;
+    pthread_mutex_unlock(&job->mtx);
+
+    if (built) {
+        dc_gateway_ready_free(job);
+    }
 }
 
-static void dc_gateway_queue_identify(dc_gateway_t gw)
+static void dc_gateway_ready_done(evutil_socket_t fd, short what, void *arg)
 {
-    json_t *j = json_object(), *dev = json_object();
-    char const *token = dc_account_token(gw->login);
+    dc_gateway_ready_job_t *job = (dc_gateway_ready_job_t *)arg;
+    dc_gateway_t gw = job->gw;
 
-    if (j == NULL || dev == NULL) {
-        json_decref(j);
-        json_decref(dev);
-        return;
+    event_free(job->done);
+    job->done = NULL;
+    gw->building = NULL;
+
+    if (job->op == NULL) {
+        /* the builder choked on it, let jansson have a go
+         */
+        job->op = json_loadb(job->data, job->len, 0, NULL);
     }
 
-    json_object_set_new(dev, "$os", json_string("linux"));
-    json_object_set_new(dev, "$browser", json_string("libdc"));
-    json_object_set_new(dev, "$device", json_string("libdc"));
+    if (job->op != NULL) {
+        dc_unref(gw->ready);
+        gw->ready = job->ready;
+        job->ready = NULL;
+        dc_gateway_handle_op(gw, job->op);
+    }
 
-    json_object_set_new(j, "token", json_string(token));
-    json_object_set_new(j, "properties", dev);
+    /* and now everything that came in while READY was built, taking each
+     * off before handling it, like dc_gateway_process_in() does
+     */
+    while (gw->held->len > 0) {
+        json_t *j = json_incref(g_ptr_array_index(gw->held, 0));
+        g_ptr_array_remove_index(gw->held, 0);
+        dc_gateway_handle_op(gw, j);
+        json_decref(j);
+    }
 
-    dc_gateway_queue(gw, GATEWAY_OPCODE_IDENTIFY, j);
+    dc_gateway_flush(gw);
+
+    dc_gateway_ready_free(job);
 }
 
-static bool dc_gateway_handle_hello(dc_gateway_t gw, char const *s, json_t *d)
+/* Builds READY on a thread of its own, so that heartbeats, and everything
+ * else on the loop keep going. It is copied out of the receive buffer,
+ * which is going to be reused long before the build is done.
+ */
+static bool dc_gateway_build_ready(dc_gateway_t gw,
+                                   struct evbuffer_iovec const *v, size_t len)
 {
-    json_t *val = NULL;
+    dc_gateway_ready_job_t *job = NULL;
+    pthread_t thread;
+    size_t total = 0, i = 0;
 
-    val = json_object_get(d, "heartbeat_interval");
-    return_if_true(val == NULL || !json_is_integer(val), false);
+    return_if_true(gw->base == NULL || gw->building != NULL, false);
+
+    for (i = 0; i < len; i++) {
+        total += v[i].iov_len;
+    }
+
+    job = calloc(1, sizeof(dc_gateway_ready_job_t) + total);
+    return_if_true(job == NULL, false);
+
+    for (i = 0; i < len; i++) {
+        memcpy(job->data + job->len, v[i].iov_base, v[i].iov_len);
+        job->len += v[i].iov_len;
+    }
+
+    job->done = event_new(gw->base, -1, 0, dc_gateway_ready_done, job);
+    goto_if_true(job->done == NULL, error);
 
-    /* send an identify first
+    /* no reference, the gateway cancels the job before it goes away
      */
-    dc_gateway_queue_identify(gw);
+    job->gw = gw;
+    pthread_mutex_init(&job->mtx, NULL);
 
-    gw->heartbeat_interval = json_integer_value(val);
-    dc_gateway_queue_heartbeat(gw);
+    if (pthread_create(&thread, NULL, dc_gateway_ready_thread, job) != 0) {
+        pthread_mutex_destroy(&job->mtx);
+        goto error;
+    }
+    pthread_detach(thread);
 
+    gw->building = job;
     return true;
+
+error:
+
+    if (job->done != NULL) {
+        event_free(job->done);
+    }
+    free(job);
+
+    return false;
 }
 
-static bool dc_gateway_handle_update(dc_gateway_t gw, char const *s, json_t *d)
+static void dc_gateway_decode_payload(dc_gateway_t gw,
+                                      struct evbuffer_iovec const *v,
+                                      size_t len)
 {
-    /* TODO
-     */
-    return true;
+    dc_gateway_peek_t p;
+    json_t *j = NULL;
+
+    if (gw->codec->peek != NULL && gw->codec->peek(v, len, &p)) {
+        return_if_true(dc_gateway_filter(gw, &p),);
+
+        if (p.op == GATEWAY_OPCODE_EVENT && strcmp(p.t, "READY") == 0) {
+            if (dc_gateway_build_ready(gw, v, len)) {
+                gw->seq = MAX(gw->seq, p.s);
+                return;
+            }
+            j = dc_gateway_decode_ready(gw, v, len);
+        }
+    }
+
+    if (j == NULL) {
+        j = gw->codec->decode(gw, v, len);
+    }
+
+    if (j != NULL) {
+        g_ptr_array_add(gw->ops, j);
+    }
 }
 
-static bool dc_gateway_handle_event(dc_gateway_t gw, char const *s, json_t *d)
+/* With zlib-stream every message ends with the Z_SYNC_FLUSH marker once a
+ * complete payload has been sent. A payload may span multiple messages.
+ */
+static bool dc_gateway_sync_flush(struct evbuffer_iovec const *v, size_t len)
 {
-    dc_event_t e = dc_event_new(s, d);
-
-    if (gw->callback != NULL && e != NULL) {
-        gw->callback(gw, e, gw->callback_data);
+    static uint8_t const marker[4] = { 0x00, 0x00, 0xFF, 0xFF };
+    size_t found = 0, i = 0;
+
+    for (i = len; i > 0 && found < sizeof(marker); i--) {
+        uint8_t const *d = v[i-1].iov_base;
+        size_t n = v[i-1].iov_len;
+
+        while (n > 0 && found < sizeof(marker)) {
+            if (d[n-1] != marker[sizeof(marker) - 1 - found]) {
+                return false;
+            }
+            --n;
+            ++found;
+        }
     }
 
-    dc_unref(e);
+    return (found == sizeof(marker));
+}
+
+static bool dc_gateway_inflate(dc_gateway_t gw,
+                               struct evbuffer_iovec const *v, size_t len)
+{
+    size_t i = 0, old = 0, avail = 0;
+    int ret = Z_OK;
+
+    for (i = 0; i < len; i++) {
+        /* inflate right out of the receive buffer
+         */
+        gw->zs.next_in = v[i].iov_base;
+        gw->zs.avail_in = v[i].iov_len;
+
+        do {
+            old = gw->inflated->len;
+            avail = MAX(v[i].iov_len * 4, 16 * 1024);
+            g_byte_array_set_size(gw->inflated, old + avail);
+
+            gw->zs.next_out = gw->inflated->data + old;
+            gw->zs.avail_out = avail;
+
+            ret = inflate(&gw->zs, Z_SYNC_FLUSH);
+            g_byte_array_set_size(gw->inflated,
+                                  old + (avail - gw->zs.avail_out)
+                );
+
+            if (ret != Z_OK && ret != Z_BUF_ERROR) {
+                return false;
+            }
+        } while (gw->zs.avail_in > 0 || gw->zs.avail_out == 0);
+    }
 
     return true;
 }
 
-static bool dc_gateway_handle_op(dc_gateway_t gw, json_t *j)
+/* Decodes a message that is spread over one or more slices of the receive
+ * buffer, without gluing the pieces together first.
+ */
+static void dc_gateway_decode(dc_gateway_t gw,
+                              dc_gateway_slice_t const *s, size_t len)
 {
-    json_t *val = NULL;
-    dc_gateway_opcode_t op = 0;
-    char const *s = NULL;
+    struct evbuffer_iovec all = {0};
+    struct evbuffer_iovec const *v = NULL;
+    size_t n = 0;
 
-    val = json_object_get(j, "op");
-    return_if_true(val == NULL || !json_is_integer(val), false);
-    op = (dc_gateway_opcode_t)json_integer_value(val);
+    dc_gateway_vecs(gw, s, len);
+    v = (struct evbuffer_iovec const *)gw->vecs->data;
+    n = gw->vecs->len;
 
-    val = json_object_get(j, "t");
-    if (val != NULL && json_is_string(val)) {
-        s = json_string_value(val);
+    if (!gw->compress) {
+        dc_gateway_decode_payload(gw, v, n);
+        return;
     }
 
-    val = json_object_get(j, "d");
-    return_if_true(val == NULL || !json_is_object(val), false);
-
-    switch (op) {
-    case GATEWAY_OPCODE_EVENT: dc_gateway_handle_event(gw, s, val); break;
-    case GATEWAY_OPCODE_HELLO: dc_gateway_handle_hello(gw, s, val); break;
-    case GATEWAY_OPCODE_UPDATE: dc_gateway_handle_update(gw, s, val); break;
-    case GATEWAY_OPCODE_PONG: break;
-    default: break;
+    if (!dc_gateway_inflate(gw, v, n)) {
+        /* the stream is broken for good, start over
+         */
+        dc_gateway_disconnect(gw);
+        return;
     }
 
-    return true;
+    if (dc_gateway_sync_flush(v, n)) {
+        all.iov_base = gw->inflated->data;
+        all.iov_len = gw->inflated->len;
+        dc_gateway_decode_payload(gw, &all, 1);
+        g_byte_array_set_size(gw->inflated, 0);
+    }
 }
 
-static void dc_gateway_process_read(dc_gateway_t gw)
+/* how long the header starting with these bytes is, once it is all there
+ */
+static size_t dc_gateway_header_size(uint8_t const *header, size_t avail)
 {
-    int ret = 0;
-    char buf[100] = {0};
-    size_t outlen = 0;
+    return_if_true(avail < 2, 2);
 
-    return_if_true(gw->easy == NULL,);
-
-    do {
-        ret = curl_easy_recv(gw->easy, buf, sizeof(buf), &outlen);
-        if (ret == CURLE_OK && outlen > 0) {
-            g_byte_array_append(gw->buffer, (uint8_t const*)buf, outlen);
-        }
-    } while (ret == CURLE_OK && outlen > 0);
+    switch (header[1] & 0x7F) {
+    case 126: return 4;
+    case 127: return 10;
+    default: return 2;
+    }
 }
 
-static void dc_gateway_process_frame(dc_gateway_t gw)
+static bool dc_gateway_process_frame(dc_gateway_t gw)
 {
-    size_t ret = 0;
-    uint8_t *data = NULL;
-    size_t datalen = 0;
+    uint8_t header[14] = {0};
+    size_t ret = 0, avail = dc_gateway_avail(gw) - gw->scan;
     uint8_t type = 0;
+    dc_gateway_slice_t slice = {0};
 
-    ret = dc_gateway_parseframe(gw->buffer->data, gw->buffer->len,
-                                &type, &data, &datalen
+    /* only the header is copied, the payload stays where it is
+     */
+    dc_gateway_copyout(gw, gw->scan, header, MIN(avail, sizeof(header)));
+    ret = dc_gateway_parseheader(header, MIN(avail, sizeof(header)),
+                                 &type, &slice.len
         );
-    return_if_true(ret == 0,);
 
-    g_byte_array_remove_range(gw->buffer, 0, ret);
+    if (ret == 0 && avail >= dc_gateway_header_size(header, avail)) {
+        /* the header is all there, and still makes no sense. Nothing
+         * after it can be read either
+         */
+        dc_gateway_disconnect(gw);
+        return true;
+    }
+    return_if_true(ret == 0 || slice.len > avail - ret, false);
+
+    slice.offset = gw->scan + ret;
+    gw->scan += ret + slice.len;
+
+    ++gw->stats.frames;
+    ++gw->stats.last_frames;
 
     switch (type) {
     case GATEWAY_FRAME_TEXT_DATA:
+    case GATEWAY_FRAME_BINARY_DATA:
+    {
+        dc_gateway_decode(gw, &slice, 1);
+    } break;
+
+    case GATEWAY_FRAME_TEXT_DATA_START:
+    case GATEWAY_FRAME_BINARY_DATA_START:
+    {
+        g_array_set_size(gw->fragments, 0);
+        g_array_append_val(gw->fragments, slice);
+    } break;
+
+    case GATEWAY_FRAME_CONTINUE:
+    case GATEWAY_FRAME_CONTINUE_END:
     {
-        json_t *j = NULL;
+        /* continuation without a start, ignore it
+         */
+        if (gw->fragments->len == 0) {
+            break;
+        }
 
-        j = json_loadb((char const*)data, datalen,
-                       JSON_DISABLE_EOF_CHECK, NULL);
-        if (j != NULL) {
-            g_ptr_array_add(gw->ops, j);
+        g_array_append_val(gw->fragments, slice);
+
+        if (type == GATEWAY_FRAME_CONTINUE_END) {
+            dc_gateway_decode(gw, (dc_gateway_slice_t*)gw->fragments->data,
+                              gw->fragments->len
+                );
+            g_array_set_size(gw->fragments, 0);
         }
     } break;
 
     case GATEWAY_FRAME_DISCONNECT:
     {
+        uint8_t code[2] = {0};
+        uint16_t c = 0;
+
+        /* the close code, if there is one, comes first in network byte
+         * order
+         */
+        if (slice.len >= sizeof(code)) {
+            dc_gateway_copyout(gw, slice.offset, code, sizeof(code));
+            c = (code[0] << 8) | code[1];
+        }
+
+        if (c == 4007 || c == 4009) {
+            /* bad sequence, or timed out: RESUME would fail as well
+             */
+            dc_gateway_forget_session(gw);
+        }
+
         dc_gateway_disconnect(gw);
+
+        if (dc_gateway_fatal(c)) {
+            gw->state = GATEWAY_STATE_FAILED;
+        }
+        return true;
+    } break;
+
+    case GATEWAY_FRAME_PING:
+    {
+        /* only the last one needs an answer
+         */
+        g_byte_array_set_size(gw->ping, slice.len);
+        dc_gateway_copyout(gw, slice.offset, gw->ping->data, slice.len);
+        gw->pong = true;
     } break;
 
     }
 
-    free(data);
-    data = NULL;
-    datalen = 0;
+    /* the fragments of an incomplete message must stay in the buffer
+     */
+    if (gw->fragments->len == 0) {
+        gw->offset = gw->scan;
+    }
+
+    return true;
 }
 
 static void dc_gateway_process_in(dc_gateway_t gw)
 {
+    /* an op may disconnect the gateway, which empties the queue, so take
+     * each op off the queue before handling it
+     */
     while (gw->ops->len > 0) {
-        json_t *j = g_ptr_array_index(gw->ops, 0);
-        dc_gateway_handle_op(gw, j);
+        json_t *j = json_incref(g_ptr_array_index(gw->ops, 0));
         g_ptr_array_remove_index(gw->ops, 0);
+
+        /* heartbeat ACKs, and the like still go through
+         */
+        if (gw->building != NULL &&
+            json_integer_value(json_object_get(j, "op")) ==
+            GATEWAY_OPCODE_EVENT) {
+            g_ptr_array_add(gw->held, j);
+            continue;
+        }
+
+        dc_gateway_handle_op(gw, j);
+        json_decref(j);
     }
 }
 
-static bool dc_gateway_process_out(dc_gateway_t gw, json_t *j)
+/* Frames one op onto the end of the send buffer, or with the bufferevent
+ * straight into its output buffer
+ */
+static bool dc_gateway_frame_out(dc_gateway_t gw, uint8_t const *data,
+                                 size_t len, uint8_t type)
 {
-    char *str = NULL;
-    uint8_t *mask = NULL;
-    size_t outlen = 0, outlen2 = 0;
-    int ret = 0;
-    bool r = false;
+    size_t old = gw->outbuf->len, outlen = 0;
+
+    if (gw->bev != NULL) {
+        struct evbuffer *out = bufferevent_get_output(gw->bev);
+        struct evbuffer_iovec v = {0};
+
+        if (evbuffer_reserve_space(out, dc_gateway_frame_size(len),
+                                   &v, 1) == 1) {
+            outlen = dc_gateway_makeframe_into(v.iov_base, v.iov_len,
+                                               data, len, type
+                );
+            v.iov_len = outlen;
+            evbuffer_commit_space(out, &v, 1);
+            gw->stats.bytes_sent += outlen;
+        }
 
-    str = json_dumps(j, JSON_COMPACT);
-    goto_if_true(str == NULL, cleanup);
+        return (outlen > 0);
+    }
 
-    mask = dc_gateway_makeframe((uint8_t const *)str, strlen(str),
-                                GATEWAY_FRAME_TEXT_DATA,
-                                &outlen
+    g_byte_array_set_size(gw->outbuf, old + dc_gateway_frame_size(len));
+    outlen = dc_gateway_makeframe_into(gw->outbuf->data + old,
+                                       gw->outbuf->len - old,
+                                       data, len, type
         );
-    goto_if_true(mask == NULL, cleanup);
+    g_byte_array_set_size(gw->outbuf, old + outlen);
 
-    ret = curl_easy_send(gw->easy, mask, outlen, &outlen2);
-    goto_if_true(ret != CURLE_OK || outlen2 != outlen, cleanup);
+    return (outlen > 0);
+}
 
-    r = true;
+static bool dc_gateway_process_out(dc_gateway_t gw, json_t *j)
+{
+    uint8_t *str = NULL;
+    size_t len = 0;
+    bool ret = false;
 
-cleanup:
+    str = gw->codec->encode(j, &len);
+    return_if_true(str == NULL, false);
 
+    ret = dc_gateway_frame_out(gw, str, len, gw->codec->frame);
     free(str);
-    str = NULL;
 
-    free(mask);
-    mask = NULL;
+    return ret;
+}
+
+/* the answer to a PING goes out before anything else that is queued
+ */
+static void dc_gateway_process_pong(dc_gateway_t gw)
+{
+    return_if_true(!gw->pong,);
 
-    return r;
+    dc_gateway_frame_out(gw, gw->ping->data, gw->ping->len,
+                         GATEWAY_FRAME_PONG
+        );
+    g_byte_array_set_size(gw->ping, 0);
+    gw->pong = false;
 }
 
-void dc_gateway_process(dc_gateway_t gw)
+static void dc_gateway_flush(dc_gateway_t gw)
 {
-    time_t diff = 0;
+    size_t sent = 0;
+    CURLcode ret = CURLE_OK;
 
-    if (!dc_gateway_connected(gw)) {
+    /* the upgrade request goes through here as well
+     */
+    return_if_true(!dc_gateway_open(gw),);
+    return_if_true(gw->state == GATEWAY_STATE_CONNECTING,);
+
+    if (gw->bev != NULL) {
+        /* the bufferevent does the writing, and buffering for us
+         */
+        dc_gateway_process_pong(gw);
+        while (gw->out->len > 0) {
+            json_t *j = g_ptr_array_index(gw->out, 0);
+            dc_gateway_process_out(gw, j);
+            g_ptr_array_remove_index(gw->out, 0);
+        }
         return;
     }
 
-    if (gw->heartbeat_interval > 0) {
-        diff = time(NULL) - gw->last_heartbeat;
-        if (diff >= (gw->heartbeat_interval / 1000)) {
-            dc_gateway_queue_heartbeat(gw);
+    /* A write that would have blocked must be retried with exactly the
+     * same data (TLS insists on that), so new ops are only framed once
+     * the send buffer has been drained.
+     */
+    if (gw->outsent >= gw->outbuf->len) {
+        g_byte_array_set_size(gw->outbuf, 0);
+        gw->outsent = 0;
+
+        dc_gateway_process_pong(gw);
+        while (gw->out->len > 0) {
+            json_t *j = g_ptr_array_index(gw->out, 0);
+            dc_gateway_process_out(gw, j);
+            g_ptr_array_remove_index(gw->out, 0);
+        }
+    }
+
+    while (gw->outsent < gw->outbuf->len) {
+        ret = curl_easy_send(gw->easy, gw->outbuf->data + gw->outsent,
+                             gw->outbuf->len - gw->outsent, &sent
+            );
+
+        if (ret == CURLE_AGAIN) {
+            /* try again once the socket is writable
+             */
+            if (gw->write_ev != NULL) {
+                event_add(gw->write_ev, NULL);
+            }
+            return;
+        } else if (ret != CURLE_OK) {
+            dc_gateway_disconnect(gw);
+            return;
+        }
+
+        gw->outsent += sent;
+        ++gw->stats.writes;
+        gw->stats.bytes_sent += sent;
+    }
+
+    g_byte_array_set_size(gw->outbuf, 0);
+    gw->outsent = 0;
+}
+
+int64_t dc_gateway_latency(dc_gateway_t gw)
+{
+    return_if_true(gw == NULL || gw->latency == 0, -1);
+    return gw->latency;
+}
+
+void dc_gateway_stats(dc_gateway_t gw, dc_gateway_stats_t *stats)
+{
+    return_if_true(gw == NULL || stats == NULL,);
+
+    *stats = gw->stats;
+    stats->read_size = gw->readsize;
+}
+
+void dc_gateway_process(dc_gateway_t gw)
+{
+    return_if_true(gw == NULL || !dc_gateway_open(gw),);
+
+    /* still waiting for the transport
+     */
+    return_if_true(gw->state == GATEWAY_STATE_CONNECTING,);
+
+    ++gw->stats.wakeups;
+    gw->stats.last_frames = 0;
+
+    /* if we have a timer, it does the heartbeat for us
+     */
+    if (gw->heartbeat_ev == NULL && gw->heartbeat_interval > 0 &&
+        g_get_monotonic_time() >= gw->next_heartbeat) {
+        dc_gateway_heartbeat(gw);
+        if (!dc_gateway_connected(gw)) {
+            return;
         }
     }
 
+    if (gw->identify_ev == NULL && gw->next_identify > 0 &&
+        g_get_monotonic_time() >= gw->next_identify) {
+        dc_gateway_login(gw);
+    }
+
     dc_gateway_process_read(gw);
+    return_if_true(!dc_gateway_open(gw),);
+
+    if (gw->state == GATEWAY_STATE_UPGRADING &&
+        !dc_gateway_process_upgrade(gw)) {
+        return;
+    }
 
-    if (gw->buffer->len > 0) {
-        dc_gateway_process_frame(gw);
+    /* the socket only tells us once that there is data, so handle all
+     * complete frames we have, and not just the first one
+     */
+    while (gw->scan < dc_gateway_avail(gw)) {
+        if (!dc_gateway_process_frame(gw)) {
+            break;
+        }
         if (!dc_gateway_connected(gw)) {
             return;
         }
@@ -440,9 +2511,5 @@ void dc_gateway_process(dc_gateway_t gw)
         dc_gateway_process_in(gw);
     }
 
-    while (gw->out->len > 0) {
-        json_t *j = g_ptr_array_index(gw->out, 0);
-        dc_gateway_process_out(gw, j);
-        g_ptr_array_remove_index(gw->out, 0);
-    }
+    dc_gateway_flush(gw);
 }
@@ -96,6 +96,28 @@ error:
     return NULL;
 }
 
+dc_guild_t dc_guild_copy(dc_guild_t g)
+{
+    dc_guild_t c = NULL;
+    size_t i = 0;
+
+    return_if_true(g == NULL, NULL);
+
+    c = dc_guild_new();
+    return_if_true(c == NULL, NULL);
+
+    dc_guild_set_name(c, g->name);
+    dc_guild_set_id(c, g->id);
+
+    for (i = 0; i < g->channels->len; i++) {
+        g_ptr_array_add(c->channels,
+                        dc_ref(g_ptr_array_index(g->channels, i))
+            );
+    }
+
+    return c;
+}
+
 size_t dc_guild_channels(dc_guild_t d)
 {
     return_if_true(d == NULL || d->channels == NULL, 0);
@@ -124,6 +146,27 @@ dc_channel_t dc_guild_channel_by_name(dc_guild_t g, char const *name)
     return NULL;
 }
 
+void dc_guild_add_channel(dc_guild_t g, dc_channel_t c)
+{
+    return_if_true(g == NULL || c == NULL,);
+    g_ptr_array_add(g->channels, dc_ref(c));
+}
+
+void dc_guild_remove_channel(dc_guild_t g, char const *id)
+{
+    size_t i = 0;
+
+    return_if_true(g == NULL || id == NULL,);
+
+    for (i = 0; i < g->channels->len; i++) {
+        dc_channel_t c = g_ptr_array_index(g->channels, i);
+        if (dc_channel_id(c) != NULL && strcmp(dc_channel_id(c), id) == 0) {
+            g_ptr_array_remove_index(g->channels, i);
+            return;
+        }
+    }
+}
+
 char const *dc_guild_name(dc_guild_t d)
 {
     return_if_true(d == NULL, NULL);
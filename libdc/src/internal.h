@@ -56,10 +56,125 @@
 #define TOKEN(l) (dc_account_token(l))
 
 #define DISCORD_URL          "https://discordapp.com/api/v6"
-#define DISCORD_GATEWAY_URL  "/?encoding=json&v=6"
+#define DISCORD_GATEWAY_URL  "/?v=6"
+/* intents the gateway version above knows about, v6 stops at
+ * DIRECT_MESSAGE_TYPING
+ */
+#define DISCORD_GATEWAY_INTENTS ((1 << 15) - 1)
+#define DISCORD_GATEWAY_ENCODING "&encoding="
+#define DISCORD_GATEWAY_COMPRESS "&compress=zlib-stream"
 #define DISCORD_GATEWAY_HOST "gateway.discord.gg"
-#define DISCORD_GATEWAY      "https://" DISCORD_GATEWAY_HOST DISCORD_GATEWAY_URL
+#define DISCORD_GATEWAY      "https://" DISCORD_GATEWAY_HOST "/"
+
+/* size of the connection pool the REST calls share, in total and per host.
+ * With HTTP/2 all calls to the API end up multiplexed over one of them.
+ */
+#define DC_API_MAX_CONNECTIONS      8
+#define DC_API_MAX_HOST_CONNECTIONS 2
+
+/* how often a call that came back with 429 is tried again
+ */
+#define DC_API_RATELIMIT_RETRIES    3
+
+/* how many finished requests, with their easy handles, are kept for reuse
+ */
+#define DC_API_IDLE_REQUESTS        16
+
+/* how many background calls may be in flight at once
+ */
+#define DC_API_MAX_BACKGROUND       2
+#define DC_API_PRIORITIES           (DC_API_PRIORITY_BACKGROUND + 1)
+
+/* milliseconds a call may take by default, retries and waiting for its
+ * rate limit included, and of that for connecting
+ */
+#define DC_API_TIMEOUT              30000
+#define DC_API_CONNECT_TIMEOUT      10000
+
+/* how often a GET is tried again after a server error, or a broken
+ * connection, and the delay before the first retry in milliseconds, which
+ * doubles for every one after that
+ */
+#define DC_API_RETRIES              3
+#define DC_API_RETRY_BACKOFF        250
+
+/* attempts remembered for dc_api_attempts()
+ */
+#define DC_API_ATTEMPTS             64
 
 #define DISCORD_USERAGENT "Mozilla/5.0 (X11; Linux x86_64; rv:67.0) Gecko/20100101 Firefox/67.0"
 
+/* REST rate limit buckets, see ratelimit.c. Not locked, only the loop
+ * thread may use them.
+ */
+typedef struct dc_ratelimit_ dc_ratelimit_t;
+
+/* rate limit headers of one response
+ */
+typedef struct {
+    int64_t limit;
+    int64_t remaining;
+    double reset_after;
+    double retry_after;
+    bool global;
+    char bucket[64];
+} dc_ratelimit_headers_t;
+
+dc_ratelimit_t *dc_ratelimit_new(void);
+void dc_ratelimit_free(dc_ratelimit_t *r);
+
+/* writes the route of a call, which decides its bucket, i.e. "GET
+ * channels/1234/messages/:id", into out
+ */
+void dc_ratelimit_route(GString *out, char const *verb, char const *method);
+
+/* monotonic time until which a call on route has to be held, or zero
+ * if it may go now. dc_ratelimit_take() once it has gone.
+ */
+int64_t dc_ratelimit_until(dc_ratelimit_t *r, char const *route, int64_t now);
+void dc_ratelimit_take(dc_ratelimit_t *r, char const *route);
+
+void dc_ratelimit_headers_init(dc_ratelimit_headers_t *h);
+void dc_ratelimit_header(dc_ratelimit_headers_t *h,
+                         char const *line, size_t len);
+void dc_ratelimit_update(dc_ratelimit_t *r, char const *route,
+                         dc_ratelimit_headers_t const *h,
+                         long status, int64_t now);
+
+/* GET responses with their validators, see cache.c. Locked, so any thread
+ * may use it.
+ */
+typedef struct dc_cache_ dc_cache_t;
+
+dc_cache_t *dc_cache_new(void);
+void dc_cache_free(dc_cache_t *c);
+
+/* also keep entries in files below dir, and look for them there. Old
+ * files beyond a limit are deleted. NULL keeps them in memory only.
+ */
+bool dc_cache_set_dir(dc_cache_t *c, char const *dir);
+
+/* writes the key of a call into out
+ */
+void dc_cache_key(GString *out, char const *token, char const *method);
+
+/* a copy of base, with If-None-Match and If-Modified-Since added, or NULL
+ * if nothing is cached for key
+ */
+struct curl_slist *dc_cache_headers(dc_cache_t *c, char const *key,
+                                    struct curl_slist const *base);
+
+/* the cached reply for key, parsed, with a new reference, or NULL
+ */
+json_t *dc_cache_reply(dc_cache_t *c, char const *key);
+
+void dc_cache_store(dc_cache_t *c, char const *key,
+                    char const *etag, char const *modified,
+                    char const *body, size_t len);
+
+/* picks ETag and Last-Modified out of a header line
+ */
+void dc_cache_header(GString *etag, GString *modified,
+                     char const *line, size_t len);
+
 #endif
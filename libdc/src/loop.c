@@ -27,7 +27,10 @@ struct dc_loop_
 
     struct event_base *base;
     struct event *timer;
+    struct event *gateway_timer;
+    struct event *abort_ev;
     CURLM *multi;
+    dc_share_t share;
 
     bool base_owner;
     bool multi_owner;
@@ -36,6 +39,20 @@ struct dc_loop_
     GPtrArray *gateways;
 };
 
+static void dc_loop_detach_api(dc_api_t api, gpointer unused)
+{
+    dc_api_set_event_base(api, NULL);
+    dc_api_set_curl_multi(api, NULL);
+}
+
+static void dc_loop_detach_gateway(dc_gateway_t gw, gpointer unused)
+{
+    dc_gateway_disconnect(gw);
+    dc_gateway_set_event_base(gw, NULL);
+    dc_gateway_set_curl_multi(gw, NULL);
+    dc_gateway_set_share(gw, NULL);
+}
+
 static void dc_loop_free(dc_loop_t p)
 {
     return_if_true(p == NULL,);
@@ -46,26 +63,46 @@ static void dc_loop_free(dc_loop_t p)
         p->timer = NULL;
     }
 
-    if (p->multi_owner && p->multi != NULL) {
-        curl_multi_cleanup(p->multi);
-        p->multi = NULL;
+    if (p->gateway_timer != NULL) {
+        event_free(p->gateway_timer);
+        p->gateway_timer = NULL;
     }
 
-    if (p->base_owner && p->base != NULL) {
-        event_base_free(p->base);
-        p->base = NULL;
+    if (p->abort_ev != NULL) {
+        event_free(p->abort_ev);
+        p->abort_ev = NULL;
     }
 
+    /* everything that still has events on the base, or handles in the
+     * multi, lets go of them before either is gone
+     */
     if (p->apis != NULL) {
+        g_ptr_array_foreach(p->apis, (GFunc)dc_loop_detach_api, NULL);
         g_ptr_array_unref(p->apis);
         p->apis = NULL;
     }
 
     if (p->gateways != NULL) {
+        g_ptr_array_foreach(p->gateways, (GFunc)dc_loop_detach_gateway, NULL);
         g_ptr_array_unref(p->gateways);
         p->gateways = NULL;
     }
 
+    if (p->multi_owner && p->multi != NULL) {
+        curl_multi_cleanup(p->multi);
+        p->multi = NULL;
+    }
+
+    if (p->base_owner && p->base != NULL) {
+        event_base_free(p->base);
+        p->base = NULL;
+    }
+
+    /* APIs and gateways hold their own reference
+     */
+    dc_unref(p->share);
+    p->share = NULL;
+
     free(p);
 }
 
@@ -142,6 +179,54 @@ static int mcurl_timer(CURLM *curl, long timeout, void *ptr)
     return 0;
 }
 
+/* Arms the gateway timer for the disconnected gateway that is due next
+ */
+static void schedule_gateways(dc_loop_t loop)
+{
+    int64_t next = -1, in = 0;
+    struct timeval tm = {0};
+    size_t i = 0;
+
+    for (i = 0; i < loop->gateways->len; i++) {
+        dc_gateway_t gw = g_ptr_array_index(loop->gateways, i);
+
+        in = dc_gateway_reconnect_in(gw);
+        if (in >= 0 && (next < 0 || in < next)) {
+            next = in;
+        }
+    }
+
+    return_if_true(next < 0,);
+
+    tm.tv_sec = next / G_USEC_PER_SEC;
+    tm.tv_usec = next % G_USEC_PER_SEC;
+    evtimer_add(loop->gateway_timer, &tm);
+}
+
+static void gateway_handler(int sock, short what, void *data)
+{
+    dc_loop_t loop = (dc_loop_t)data;
+    size_t i = 0;
+
+    for (i = 0; i < loop->gateways->len; i++) {
+        dc_gateway_t gw = g_ptr_array_index(loop->gateways, i);
+
+        if (dc_gateway_reconnect_in(gw) == 0) {
+            /* on failure the gateway works out when to try again
+             */
+            dc_gateway_connect(gw);
+        }
+    }
+
+    schedule_gateways(loop);
+}
+
+static void abort_handler(int sock, short what, void *data)
+{
+    dc_loop_t loop = (dc_loop_t)data;
+    event_base_loopbreak(loop->base);
+}
+
 dc_loop_t dc_loop_new(void)
 {
     return dc_loop_new_full(NULL, NULL);
@@ -172,6 +257,9 @@ dc_loop_t dc_loop_new_full(struct event_base *base, CURLM *multi)
         ptr->multi_owner = true;
     }
 
+    ptr->share = dc_share_new();
+    goto_if_true(ptr->share == NULL, fail);
+
     ptr->apis = g_ptr_array_new_with_free_func((GDestroyNotify)dc_unref);
     goto_if_true(ptr->apis == NULL, fail);
 
@@ -181,12 +269,24 @@ dc_loop_t dc_loop_new_full(struct event_base *base, CURLM *multi)
     ptr->timer = evtimer_new(ptr->base, timer_handler, ptr);
     goto_if_true(ptr->timer == NULL, fail);
 
+    ptr->gateway_timer = evtimer_new(ptr->base, gateway_handler, ptr);
+    goto_if_true(ptr->gateway_timer == NULL, fail);
+
+    ptr->abort_ev = event_new(ptr->base, -1, 0, abort_handler, ptr);
+    goto_if_true(ptr->abort_ev == NULL, fail);
+
     curl_multi_setopt(ptr->multi, CURLMOPT_SOCKETDATA, ptr);
     curl_multi_setopt(ptr->multi, CURLMOPT_SOCKETFUNCTION, mcurl_handler);
 
     curl_multi_setopt(ptr->multi, CURLMOPT_TIMERDATA, ptr);
     curl_multi_setopt(ptr->multi, CURLMOPT_TIMERFUNCTION, mcurl_timer);
 
+    curl_multi_setopt(ptr->multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+    curl_multi_setopt(ptr->multi, CURLMOPT_MAXCONNECTS,
+                      (long)DC_API_MAX_CONNECTIONS);
+    curl_multi_setopt(ptr->multi, CURLMOPT_MAX_HOST_CONNECTIONS,
+                      (long)DC_API_MAX_HOST_CONNECTIONS);
+
     return dc_ref(ptr);
 
 fail:
@@ -201,6 +301,12 @@ CURLM *dc_loop_curl(dc_loop_t l)
     return l->multi;
 }
 
+dc_share_t dc_loop_share(dc_loop_t l)
+{
+    return_if_true(l == NULL, NULL);
+    return l->share;
+}
+
 struct event_base *dc_loop_event_base(dc_loop_t l)
 {
     return_if_true(l == NULL, NULL);
@@ -214,6 +320,7 @@ void dc_loop_add_api(dc_loop_t l, dc_api_t a)
 
     dc_api_set_event_base(p, l->base);
     dc_api_set_curl_multi(p, l->multi);
+    dc_api_set_share(p, l->share);
 
     g_ptr_array_add(l->apis, p);
 }
@@ -223,8 +330,7 @@ void dc_loop_remove_api(dc_loop_t loop, dc_api_t api)
     return_if_true(loop == NULL || api == NULL,);
 
     if (g_ptr_array_find(loop->apis, api, NULL)) {
-        dc_api_set_event_base(api, NULL);
-        dc_api_set_curl_multi(api, NULL);
+        dc_loop_detach_api(api, NULL);
         g_ptr_array_remove(loop->apis, api);
     }
 }
@@ -232,19 +338,36 @@ void dc_loop_remove_api(dc_loop_t loop, dc_api_t api)
 void dc_loop_add_gateway(dc_loop_t l, dc_gateway_t gw)
 {
     return_if_true(l == NULL || gw == NULL,);
-    g_ptr_array_add(l->gateways, dc_ref(gw));
+    dc_gateway_t p = dc_ref(gw);
+
+    dc_gateway_set_event_base(p, l->base);
+    dc_gateway_set_curl_multi(p, l->multi);
+    dc_gateway_set_share(p, l->share);
+    g_ptr_array_add(l->gateways, p);
+
+    /* wakes up the loop, and connects the gateway
+     */
+    event_active(l->gateway_timer, EV_TIMEOUT, 0);
 }
 
 void dc_loop_remove_gateway(dc_loop_t loop, dc_gateway_t gw)
 {
     return_if_true(loop == NULL || gw == NULL,);
-    g_ptr_array_remove(loop->gateways, gw);
+
+    if (g_ptr_array_find(loop->gateways, gw, NULL)) {
+        dc_loop_detach_gateway(gw, NULL);
+        g_ptr_array_remove(loop->gateways, gw);
+    }
 }
 
 void dc_loop_abort(dc_loop_t l)
 {
     return_if_true(l == NULL || l->base == NULL,);
-    event_base_loopbreak(l->base);
+
+    /* an active event survives until the next dc_loop_once() if the loop
+     * is not running right now, a plain loopbreak would not
+     */
+    event_active(l->abort_ev, EV_TIMEOUT, 0);
 }
 
 bool dc_loop_once(dc_loop_t l)
@@ -253,38 +376,50 @@ bool dc_loop_once(dc_loop_t l)
 
     int ret = 0, remain = 0;
     struct CURLMsg *msg = NULL;
+    CURL *easy = NULL;
+    CURLcode result = CURLE_OK;
+    bool gateway = false;
     size_t i = 0;
 
-    ret = event_base_loop(l->base, EVLOOP_ONCE);
+    /* Blocks until either curl, or one of the gateways have something
+     * to do. Gateways handle their websocket from within the callbacks.
+     */
+    ret = event_base_loop(l->base, EVLOOP_ONCE|EVLOOP_NO_EXIT_ON_EMPTY);
     if (ret < 0) {
         return false;
     }
 
-    msg = curl_multi_info_read(l->multi, &remain);
-    if (msg != NULL) {
+    while ((msg = curl_multi_info_read(l->multi, &remain)) != NULL) {
         if (remain <= 0) {
             if (evtimer_pending(l->timer, NULL)) {
                 evtimer_del(l->timer);
             }
         }
         if (msg->msg == CURLMSG_DONE) {
+            /* the gateway might clean up the handle, and msg with it
+             */
+            easy = msg->easy_handle;
+            result = msg->data.result;
+            gateway = false;
+
+            for (i = 0; i < l->gateways->len && !gateway; i++) {
+                dc_gateway_t gw = g_ptr_array_index(l->gateways, i);
+                gateway = dc_gateway_signal(gw, easy, result);
+            }
+            continue_if_true(gateway);
+
             for (i = 0; i < l->apis->len; i++) {
                 dc_api_t api = g_ptr_array_index(l->apis, i);
-                dc_api_signal(api, msg->easy_handle, msg->data.result);
+                dc_api_signal(api, easy, result);
             }
         }
     }
 
-    for (i = 0; i < l->gateways->len; i++) {
-        dc_gateway_t gw = g_ptr_array_index(l->gateways, i);
-
-        if (!dc_gateway_connected(gw)) {
-            if (!dc_gateway_connect(gw)) {
-                continue;
-            }
-        }
-
-        dc_gateway_process(gw);
+    /* reconnect gateways that have lost their connection, once their
+     * backoff is over
+     */
+    if (!evtimer_pending(l->gateway_timer, NULL)) {
+        schedule_gateways(l);
     }
 
     return true;
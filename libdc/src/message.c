@@ -33,6 +33,42 @@ struct dc_message_
     dc_account_t author;
 };
 
+bool dc_message_write_json(dc_message_t m, GString *out)
+{
+    return_if_true(m == NULL || out == NULL, false);
+
+    g_string_append_c(out, '{');
+
+    if (m->id != NULL) {
+        dc_util_json_key(out, "id");
+        dc_util_json_string(out, m->id);
+    }
+
+    if (m->timestamp != NULL) {
+        dc_util_json_key(out, "timestamp");
+        dc_util_json_string(out, m->timestamp);
+    }
+
+    if (m->channel_id != NULL) {
+        dc_util_json_key(out, "channel_id");
+        dc_util_json_string(out, m->channel_id);
+    }
+
+    if (m->author != NULL) {
+        dc_util_json_key(out, "author");
+        if (!dc_account_write_json(m->author, out)) {
+            g_string_append(out, "null");
+        }
+    }
+
+    dc_util_json_key(out, "content");
+    dc_util_json_string(out, m->content);
+
+    g_string_append_c(out, '}');
+
+    return true;
+}
+
 static void dc_message_parse_timestamp(dc_message_t m);
 
 static void dc_message_free(dc_message_t m)
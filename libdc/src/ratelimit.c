@@ -0,0 +1,306 @@
+/*
+ * Part of ncdc - a discord client for the console
+ * Copyright (C) 2019 Florian Stinglmayr <fstinglmayr@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "internal.h"
+
+/* Discord limits REST calls per route, and per "major parameter" of that
+ * route (i.e. the channel, guild or webhook it is about). Several routes
+ * may share one bucket, which the server names in X-RateLimit-Bucket. Until
+ * it has, every route is assumed to have a bucket of its own.
+ */
+
+typedef struct {
+    int64_t limit;
+    int64_t remaining;
+    /* monotonic time at which the bucket is full again
+     */
+    int64_t reset;
+} dc_ratelimit_bucket_t;
+
+struct dc_ratelimit_
+{
+    /* route -> name of the bucket the server told us about
+     */
+    GHashTable *routes;
+    /* name -> dc_ratelimit_bucket_t
+     */
+    GHashTable *buckets;
+    /* nothing goes out before this, if the whole account is limited
+     */
+    int64_t global;
+};
+
+dc_ratelimit_t *dc_ratelimit_new(void)
+{
+    dc_ratelimit_t *r = calloc(1, sizeof(dc_ratelimit_t));
+    return_if_true(r == NULL, NULL);
+
+    r->routes = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    goto_if_true(r->routes == NULL, error);
+
+    r->buckets = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    goto_if_true(r->buckets == NULL, error);
+
+    return r;
+
+error:
+
+    dc_ratelimit_free(r);
+    return NULL;
+}
+
+void dc_ratelimit_free(dc_ratelimit_t *r)
+{
+    return_if_true(r == NULL,);
+
+    if (r->routes != NULL) {
+        g_hash_table_unref(r->routes);
+        r->routes = NULL;
+    }
+
+    if (r->buckets != NULL) {
+        g_hash_table_unref(r->buckets);
+        r->buckets = NULL;
+    }
+
+    free(r);
+}
+
+static bool dc_ratelimit_major(char const *s, size_t len)
+{
+    return ((len == 8 && strncmp(s, "channels", len) == 0) ||
+            (len == 6 && strncmp(s, "guilds", len) == 0) ||
+            (len == 8 && strncmp(s, "webhooks", len) == 0));
+}
+
+void dc_ratelimit_route(GString *out, char const *verb, char const *method)
+{
+    char const *p = method;
+    bool major = false, after_major = false, id = false;
+    size_t len = 0;
+
+    return_if_true(out == NULL || verb == NULL || method == NULL,);
+
+    g_string_assign(out, verb);
+    g_string_append_c(out, ' ');
+
+    /* "channels/1234/messages/5678" becomes "channels/1234/messages/:id",
+     * since only the first (major) ID decides the bucket
+     */
+    while (*p != '\0' && *p != '?') {
+        len = strcspn(p, "/?");
+        id = (len > 0 && strspn(p, "0123456789") >= len);
+
+        if (id && !(after_major && !major)) {
+            g_string_append(out, ":id");
+        } else {
+            major = major || id;
+            g_string_append_len(out, p, len);
+        }
+
+        after_major = dc_ratelimit_major(p, len);
+        p += len;
+
+        if (*p == '/') {
+            g_string_append_c(out, '/');
+            ++p;
+        }
+    }
+}
+
+/* the major parameter of a route, or an empty string
+ */
+static char *dc_ratelimit_route_major(char const *route)
+{
+    gchar **parts = g_strsplit(route, "/", -1);
+    char *major = NULL;
+    size_t i = 0;
+
+    for (i = 1; parts != NULL && parts[i] != NULL && major == NULL; i++) {
+        char const *prev = strrchr(parts[i-1], ' ');
+
+        prev = (prev != NULL ? prev + 1 : parts[i-1]);
+        if (dc_ratelimit_major(prev, strlen(prev)) &&
+            strcmp(parts[i], ":id") != 0) {
+            major = g_strdup(parts[i]);
+        }
+    }
+
+    g_strfreev(parts);
+
+    return (major != NULL ? major : g_strdup(""));
+}
+
+static dc_ratelimit_bucket_t *
+dc_ratelimit_bucket(dc_ratelimit_t *r, char const *route, bool create)
+{
+    char const *name = g_hash_table_lookup(r->routes, route);
+    dc_ratelimit_bucket_t *b = NULL;
+
+    if (name == NULL) {
+        name = route;
+    }
+
+    b = g_hash_table_lookup(r->buckets, name);
+    if (b == NULL && create) {
+        b = g_new0(dc_ratelimit_bucket_t, 1);
+        b->limit = -1;
+        b->remaining = -1;
+        g_hash_table_insert(r->buckets, g_strdup(name), b);
+    }
+
+    return b;
+}
+
+int64_t dc_ratelimit_until(dc_ratelimit_t *r, char const *route, int64_t now)
+{
+    dc_ratelimit_bucket_t *b = NULL;
+
+    return_if_true(r == NULL || route == NULL, 0);
+    return_if_true(r->global > now, r->global);
+
+    b = dc_ratelimit_bucket(r, route, false);
+    return_if_true(b == NULL || b->remaining != 0, 0);
+    return_if_true(b->reset > now, b->reset);
+
+    /* it has refilled in the meantime
+     */
+    b->remaining = (b->limit > 0 ? b->limit : -1);
+    return 0;
+}
+
+void dc_ratelimit_take(dc_ratelimit_t *r, char const *route)
+{
+    dc_ratelimit_bucket_t *b = NULL;
+
+    return_if_true(r == NULL || route == NULL,);
+
+    b = dc_ratelimit_bucket(r, route, false);
+    if (b != NULL && b->remaining > 0) {
+        --b->remaining;
+    }
+}
+
+void dc_ratelimit_headers_init(dc_ratelimit_headers_t *h)
+{
+    return_if_true(h == NULL,);
+
+    memset(h, 0, sizeof(dc_ratelimit_headers_t));
+    h->limit = -1;
+    h->remaining = -1;
+    h->reset_after = -1;
+    h->retry_after = -1;
+}
+
+void dc_ratelimit_header(dc_ratelimit_headers_t *h,
+                         char const *line, size_t len)
+{
+    char value[64] = {0};
+    char const *colon = NULL;
+    size_t name = 0, vlen = 0;
+
+    return_if_true(h == NULL || line == NULL,);
+
+    /* headers of a new response (e.g. after a redirect)
+     */
+    if (len > 5 && strncmp(line, "HTTP/", 5) == 0) {
+        dc_ratelimit_headers_init(h);
+        return;
+    }
+
+    colon = memchr(line, ':', len);
+    return_if_true(colon == NULL,);
+    name = colon - line;
+
+    ++colon;
+    while (colon < line + len && (*colon == ' ' || *colon == '\t')) {
+        ++colon;
+    }
+    vlen = (line + len) - colon;
+    while (vlen > 0 && (colon[vlen-1] == '\r' || colon[vlen-1] == '\n' ||
+                        colon[vlen-1] == ' ')) {
+        --vlen;
+    }
+    return_if_true(vlen == 0 || vlen >= sizeof(value),);
+    memcpy(value, colon, vlen);
+
+#define DC_HEADER_IS(n) (name == strlen(n) && strncasecmp(line, n, name) == 0)
+
+    if (DC_HEADER_IS("X-RateLimit-Limit")) {
+        h->limit = strtoll(value, NULL, 10);
+    } else if (DC_HEADER_IS("X-RateLimit-Remaining")) {
+        h->remaining = strtoll(value, NULL, 10);
+    } else if (DC_HEADER_IS("X-RateLimit-Reset-After")) {
+        h->reset_after = strtod(value, NULL);
+    } else if (DC_HEADER_IS("X-RateLimit-Bucket")) {
+        strcpy(h->bucket, value);
+    } else if (DC_HEADER_IS("X-RateLimit-Global")) {
+        h->global = (strcasecmp(value, "true") == 0);
+    } else if (DC_HEADER_IS("Retry-After")) {
+        h->retry_after = strtod(value, NULL);
+    }
+
+#undef DC_HEADER_IS
+}
+
+void dc_ratelimit_update(dc_ratelimit_t *r, char const *route,
+                         dc_ratelimit_headers_t const *h,
+                         long status, int64_t now)
+{
+    dc_ratelimit_bucket_t *b = NULL;
+    double wait = 0;
+
+    return_if_true(r == NULL || route == NULL || h == NULL,);
+
+    if (h->bucket[0] != '\0') {
+        char *major = dc_ratelimit_route_major(route);
+        g_hash_table_replace(r->routes, g_strdup(route),
+                             g_strdup_printf("%s:%s", h->bucket, major)
+            );
+        g_free(major);
+    }
+
+    b = dc_ratelimit_bucket(r, route, true);
+
+    if (h->limit >= 0) {
+        b->limit = h->limit;
+    }
+    if (h->remaining >= 0) {
+        b->remaining = h->remaining;
+    }
+    if (h->reset_after >= 0) {
+        b->reset = now + (int64_t)(h->reset_after * G_USEC_PER_SEC);
+    }
+
+    return_if_true(status != 429,);
+
+    if (h->retry_after >= 0) {
+        wait = h->retry_after;
+    } else if (h->reset_after >= 0) {
+        wait = h->reset_after;
+    } else {
+        wait = 1.0;
+    }
+
+    if (h->global) {
+        r->global = now + (int64_t)(wait * G_USEC_PER_SEC);
+    } else {
+        b->remaining = 0;
+        b->reset = MAX(b->reset, now + (int64_t)(wait * G_USEC_PER_SEC));
+    }
+}
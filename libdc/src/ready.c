@@ -0,0 +1,728 @@
+/*
+ * Part of ncdc - a discord client for the console
+ * Copyright (C) 2019 Florian Stinglmayr <fstinglmayr@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <dc/ready.h>
+#include "internal.h"
+
+struct dc_ready_
+{
+    dc_refable_t ref;
+
+    GPtrArray *guilds;
+    GPtrArray *channels;
+    GPtrArray *friends;
+    /* user id to status
+     */
+    GHashTable *presences;
+};
+
+typedef enum {
+    READY_GUILDS = 0,
+    READY_CHANNELS,
+    READY_FRIENDS,
+    READY_PRESENCES,
+    READY_LAST,
+} dc_ready_kind_t;
+
+/* the arrays of READY that are turned into objects
+ */
+static char const *arrays[READY_LAST] = {
+    [READY_GUILDS] = "guilds",
+    [READY_CHANNELS] = "private_channels",
+    [READY_FRIENDS] = "relationships",
+    [READY_PRESENCES] = "presences",
+};
+
+#define DC_READY_CHUNK (16 * 1024)
+
+/* A forward only JSON tokenizer. It never builds anything itself, but it
+ * can capture the text of a single value, which is then parsed by jansson
+ * on its own.
+ */
+typedef struct {
+    json_load_callback_t cb;
+    void *arg;
+
+    char buf[DC_READY_CHUNK];
+    size_t pos;
+    size_t len;
+    bool eof;
+
+    /* text of the value being captured, "mark" is where it starts in buf
+     */
+    GByteArray *capture;
+    bool capturing;
+    size_t mark;
+
+    /* if set, guilds and channels are built by these threads, and "lock"
+     * guards the arrays they are added to
+     */
+    GThreadPool *pool;
+    pthread_mutex_t lock;
+} dc_ready_parser_t;
+
+/* one guild, or channel for the thread pool
+ */
+typedef struct {
+    dc_ready_parser_t *p;
+    dc_ready_t ready;
+    dc_ready_kind_t kind;
+    size_t len;
+    char data[];
+} dc_ready_job_t;
+
+typedef struct {
+    char const *data;
+    size_t len;
+    size_t pos;
+} dc_ready_buffer_t;
+
+static void dc_ready_free(dc_ready_t r)
+{
+    return_if_true(r == NULL,);
+
+    if (r->guilds != NULL) {
+        g_ptr_array_unref(r->guilds);
+        r->guilds = NULL;
+    }
+
+    if (r->channels != NULL) {
+        g_ptr_array_unref(r->channels);
+        r->channels = NULL;
+    }
+
+    if (r->friends != NULL) {
+        g_ptr_array_unref(r->friends);
+        r->friends = NULL;
+    }
+
+    if (r->presences != NULL) {
+        g_hash_table_unref(r->presences);
+        r->presences = NULL;
+    }
+
+    free(r);
+}
+
+dc_ready_t dc_ready_new(void)
+{
+    dc_ready_t r = calloc(1, sizeof(struct dc_ready_));
+    return_if_true(r == NULL, NULL);
+
+    r->ref.cleanup = (dc_cleanup_t)dc_ready_free;
+
+    r->guilds = g_ptr_array_new_with_free_func((GDestroyNotify)dc_unref);
+    goto_if_true(r->guilds == NULL, error);
+
+    r->channels = g_ptr_array_new_with_free_func((GDestroyNotify)dc_unref);
+    goto_if_true(r->channels == NULL, error);
+
+    r->friends = g_ptr_array_new_with_free_func((GDestroyNotify)dc_unref);
+    goto_if_true(r->friends == NULL, error);
+
+    r->presences = g_hash_table_new_full(g_str_hash, g_str_equal, free, free);
+    goto_if_true(r->presences == NULL, error);
+
+    return dc_ref(r);
+
+error:
+
+    dc_ready_free(r);
+    return NULL;
+}
+
+static void *dc_ready_make(dc_ready_kind_t kind, json_t *j)
+{
+    switch (kind) {
+    case READY_GUILDS: return dc_guild_from_json(j);
+    case READY_CHANNELS: return dc_channel_from_json(j);
+    case READY_FRIENDS: return dc_account_from_relationship(j);
+    default: return NULL;
+    }
+}
+
+static GPtrArray *dc_ready_objects(dc_ready_t r, dc_ready_kind_t kind)
+{
+    switch (kind) {
+    case READY_GUILDS: return r->guilds;
+    case READY_CHANNELS: return r->channels;
+    case READY_FRIENDS: return r->friends;
+    default: return NULL;
+    }
+}
+
+static void dc_ready_add(dc_ready_t r, dc_ready_kind_t kind, json_t *j)
+{
+    void *o = NULL;
+
+    switch (kind) {
+    case READY_GUILDS:
+    case READY_CHANNELS:
+    case READY_FRIENDS:
+    {
+        o = dc_ready_make(kind, j);
+        return_if_true(o == NULL,);
+        g_ptr_array_add(dc_ready_objects(r, kind), o);
+    } break;
+
+    case READY_PRESENCES:
+    {
+        json_t *id = json_object_get(json_object_get(j, "user"), "id");
+        json_t *status = json_object_get(j, "status");
+
+        return_if_true(id == NULL || !json_is_string(id),);
+        return_if_true(status == NULL || !json_is_string(status),);
+
+        g_hash_table_replace(r->presences,
+                             strdup(json_string_value(id)),
+                             strdup(json_string_value(status))
+            );
+    } break;
+
+    default: break;
+    }
+}
+
+dc_ready_t dc_ready_from_json(json_t *d)
+{
+    dc_ready_t r = NULL;
+    json_t *arr = NULL, *c = NULL;
+    size_t i = 0, idx = 0;
+
+    return_if_true(d == NULL || !json_is_object(d), NULL);
+
+    r = dc_ready_new();
+    return_if_true(r == NULL, NULL);
+
+    for (i = 0; i < READY_LAST; i++) {
+        arr = json_object_get(d, arrays[i]);
+        continue_if_true(arr == NULL || !json_is_array(arr));
+
+        json_array_foreach(arr, idx, c) {
+            dc_ready_add(r, (dc_ready_kind_t)i, c);
+        }
+    }
+
+    return r;
+}
+
+static bool dc_ready_fill(dc_ready_parser_t *p)
+{
+    size_t ret = 0;
+
+    return_if_true(p->pos < p->len, true);
+    return_if_true(p->eof, false);
+
+    /* the buffer is about to be overwritten, so save what has been
+     * captured so far
+     */
+    if (p->capturing) {
+        g_byte_array_append(p->capture, (uint8_t const *)p->buf + p->mark,
+                            p->len - p->mark
+            );
+        p->mark = 0;
+    }
+
+    ret = p->cb(p->buf, sizeof(p->buf), p->arg);
+    if (ret == 0 || ret == (size_t)-1) {
+        p->eof = true;
+        p->pos = p->len = 0;
+        return false;
+    }
+
+    p->pos = 0;
+    p->len = ret;
+
+    return true;
+}
+
+static int dc_ready_peekc(dc_ready_parser_t *p)
+{
+    return_if_true(!dc_ready_fill(p), -1);
+    return (uint8_t)p->buf[p->pos];
+}
+
+static int dc_ready_getc(dc_ready_parser_t *p)
+{
+    int c = dc_ready_peekc(p);
+
+    if (c >= 0) {
+        ++p->pos;
+    }
+
+    return c;
+}
+
+static void dc_ready_skip_ws(dc_ready_parser_t *p)
+{
+    int c = 0;
+
+    while ((c = dc_ready_peekc(p)) == ' ' || c == '\t' ||
+           c == '\n' || c == '\r') {
+        ++p->pos;
+    }
+}
+
+/* Reads the rest of a string whose opening quote has been read. Keys with
+ * escapes in them, or ones longer than out, come back empty, none of the
+ * keys we look for are like that.
+ */
+static bool dc_ready_scan_string(dc_ready_parser_t *p,
+                                 char *out, size_t outlen)
+{
+    size_t n = 0;
+    bool clean = true;
+    int c = 0;
+
+    while ((c = dc_ready_getc(p)) >= 0) {
+        if (c == '"') {
+            if (out != NULL) {
+                out[(clean ? n : 0)] = '\0';
+            }
+            return true;
+        }
+
+        if (c == '\\') {
+            return_if_true(dc_ready_getc(p) < 0, false);
+            clean = false;
+        } else if (out != NULL && clean) {
+            if (n + 1 >= outlen) {
+                clean = false;
+            } else {
+                out[n++] = (char)c;
+            }
+        }
+    }
+
+    return false;
+}
+
+static bool dc_ready_skip_value(dc_ready_parser_t *p)
+{
+    int c = dc_ready_peekc(p), depth = 0;
+    bool instr = false, escape = false;
+
+    if (c == '"') {
+        dc_ready_getc(p);
+        return dc_ready_scan_string(p, NULL, 0);
+    }
+
+    if (c != '{' && c != '[') {
+        /* numbers, true, false, and null
+         */
+        while ((c = dc_ready_peekc(p)) >= 0 && c != ',' && c != '}' &&
+               c != ']' && c != ' ' && c != '\t' && c != '\n' && c != '\r') {
+            ++p->pos;
+        }
+        return (c >= 0);
+    }
+
+    /* this is where most of the time goes, so it works on the buffer
+     * directly instead of going through getc
+     */
+    while (dc_ready_fill(p)) {
+        char const *b = p->buf;
+        size_t i = p->pos;
+
+        for (; i < p->len; i++) {
+            c = b[i];
+
+            if (instr) {
+                if (escape) {
+                    escape = false;
+                } else if (c == '\\') {
+                    escape = true;
+                } else if (c == '"') {
+                    instr = false;
+                }
+                continue;
+            }
+
+            if (c == '"') {
+                instr = true;
+            } else if (c == '{' || c == '[') {
+                ++depth;
+            } else if (c == '}' || c == ']') {
+                if (--depth == 0) {
+                    p->pos = i + 1;
+                    return true;
+                }
+            }
+        }
+
+        p->pos = i;
+    }
+
+    return false;
+}
+
+/* Copies the text of the next value into p->capture
+ */
+static bool dc_ready_capture_text(dc_ready_parser_t *p)
+{
+    bool ok = false;
+
+    g_byte_array_set_size(p->capture, 0);
+    p->capturing = true;
+    p->mark = p->pos;
+
+    ok = dc_ready_skip_value(p);
+
+    g_byte_array_append(p->capture, (uint8_t const *)p->buf + p->mark,
+                        p->pos - p->mark
+        );
+    p->capturing = false;
+
+    return ok;
+}
+
+/* Parses just the next value
+ */
+static json_t *dc_ready_capture(dc_ready_parser_t *p)
+{
+    return_if_true(!dc_ready_capture_text(p), NULL);
+
+    return json_loadb((char const *)p->capture->data, p->capture->len,
+                      JSON_DECODE_ANY, NULL
+        );
+}
+
+static void dc_ready_work(gpointer data, gpointer arg)
+{
+    dc_ready_job_t *job = (dc_ready_job_t *)data;
+    json_t *j = NULL;
+    void *o = NULL;
+
+    j = json_loadb(job->data, job->len, 0, NULL);
+    o = dc_ready_make(job->kind, j);
+    json_decref(j);
+
+    if (o != NULL) {
+        pthread_mutex_lock(&job->p->lock);
+        g_ptr_array_add(dc_ready_objects(job->ready, job->kind), o);
+        pthread_mutex_unlock(&job->p->lock);
+    }
+
+    free(job);
+}
+
+/* Hands the text of the next value to the thread pool
+ */
+static bool dc_ready_push(dc_ready_parser_t *p, dc_ready_t r,
+                          dc_ready_kind_t kind)
+{
+    dc_ready_job_t *job = NULL;
+
+    return_if_true(!dc_ready_capture_text(p), false);
+
+    job = malloc(sizeof(dc_ready_job_t) + p->capture->len);
+    return_if_true(job == NULL, false);
+
+    job->p = p;
+    job->ready = r;
+    job->kind = kind;
+    job->len = p->capture->len;
+    memcpy(job->data, p->capture->data, job->len);
+
+    return g_thread_pool_push(p->pool, job, NULL);
+}
+
+/* Walks the members of an object, calling f with the parser positioned at
+ * the start of each value. f has to consume the value.
+ */
+typedef bool (*dc_ready_member_t)(dc_ready_parser_t *p, char const *key,
+                                  void *arg);
+
+static bool dc_ready_object(dc_ready_parser_t *p, dc_ready_member_t f,
+                            void *arg)
+{
+    char key[64] = {0};
+    int c = 0;
+
+    dc_ready_skip_ws(p);
+    return_if_true(dc_ready_getc(p) != '{', false);
+
+    dc_ready_skip_ws(p);
+    if (dc_ready_peekc(p) == '}') {
+        dc_ready_getc(p);
+        return true;
+    }
+
+    while (true) {
+        dc_ready_skip_ws(p);
+        return_if_true(dc_ready_getc(p) != '"', false);
+        return_if_true(!dc_ready_scan_string(p, key, sizeof(key)), false);
+
+        dc_ready_skip_ws(p);
+        return_if_true(dc_ready_getc(p) != ':', false);
+        dc_ready_skip_ws(p);
+
+        return_if_true(!f(p, key, arg), false);
+
+        dc_ready_skip_ws(p);
+        c = dc_ready_getc(p);
+        return_if_true(c == '}', true);
+        return_if_true(c != ',', false);
+    }
+}
+
+static bool dc_ready_array(dc_ready_parser_t *p, dc_ready_t r,
+                           dc_ready_kind_t kind)
+{
+    json_t *j = NULL;
+    int c = 0;
+
+    return_if_true(dc_ready_getc(p) != '[', false);
+
+    dc_ready_skip_ws(p);
+    if (dc_ready_peekc(p) == ']') {
+        dc_ready_getc(p);
+        return true;
+    }
+
+    while (true) {
+        dc_ready_skip_ws(p);
+
+        if (p->pool != NULL &&
+            (kind == READY_GUILDS || kind == READY_CHANNELS)) {
+            return_if_true(!dc_ready_push(p, r, kind), false);
+            goto next;
+        }
+
+        /* one element at a time, and gone again right after
+         */
+        j = dc_ready_capture(p);
+        return_if_true(j == NULL, false);
+        dc_ready_add(r, kind, j);
+        json_decref(j);
+
+    next:
+
+        dc_ready_skip_ws(p);
+        c = dc_ready_getc(p);
+        return_if_true(c == ']', true);
+        return_if_true(c != ',', false);
+    }
+}
+
+typedef struct {
+    dc_ready_t ready;
+    json_t *op;
+    /* what is left of "d"
+     */
+    json_t *rest;
+} dc_ready_state_t;
+
+static bool dc_ready_d_member(dc_ready_parser_t *p, char const *key,
+                              void *arg)
+{
+    dc_ready_state_t *s = (dc_ready_state_t *)arg;
+    json_t *j = NULL;
+    int c = dc_ready_peekc(p);
+    size_t i = 0;
+
+    for (i = 0; i < READY_LAST; i++) {
+        if (strcmp(key, arrays[i]) == 0 && c == '[') {
+            return dc_ready_array(p, s->ready, (dc_ready_kind_t)i);
+        }
+    }
+
+    /* keep ourselves, and the small stuff, everything else that is large
+     * (read states, guild settings, experiments, ...) is of no use to us
+     */
+    if ((c == '{' || c == '[') && strcmp(key, "user") != 0) {
+        return dc_ready_skip_value(p);
+    }
+
+    j = dc_ready_capture(p);
+    return_if_true(j == NULL, false);
+    json_object_set_new(s->rest, key, j);
+
+    return true;
+}
+
+static bool dc_ready_op_member(dc_ready_parser_t *p, char const *key,
+                               void *arg)
+{
+    dc_ready_state_t *s = (dc_ready_state_t *)arg;
+    json_t *j = NULL;
+
+    if (strcmp(key, "d") == 0 && dc_ready_peekc(p) == '{') {
+        json_object_set(s->op, "d", s->rest);
+        return dc_ready_object(p, dc_ready_d_member, s);
+    }
+
+    j = dc_ready_capture(p);
+    return_if_true(j == NULL, false);
+    json_object_set_new(s->op, key, j);
+
+    return true;
+}
+
+static dc_ready_t dc_ready_load(json_load_callback_t cb, void *arg,
+                                json_t **op, unsigned int threads)
+{
+    dc_ready_parser_t *p = NULL;
+    dc_ready_state_t s = {0};
+    bool ok = false;
+
+    return_if_true(cb == NULL, NULL);
+
+    /* the read buffer is a bit large for the stack
+     */
+    p = calloc(1, sizeof(dc_ready_parser_t));
+    return_if_true(p == NULL, NULL);
+
+    p->cb = cb;
+    p->arg = arg;
+
+    p->capture = g_byte_array_new();
+    goto_if_true(p->capture == NULL, error);
+
+    s.ready = dc_ready_new();
+    goto_if_true(s.ready == NULL, error);
+
+    s.op = json_object();
+    goto_if_true(s.op == NULL, error);
+
+    s.rest = json_object();
+    goto_if_true(s.rest == NULL, error);
+
+    pthread_mutex_init(&p->lock, NULL);
+    if (threads > 0) {
+        p->pool = g_thread_pool_new(dc_ready_work, NULL, threads, TRUE, NULL);
+    }
+
+    ok = dc_ready_object(p, dc_ready_op_member, &s);
+
+    /* wait for the pool to finish everything it has been given
+     */
+    if (p->pool != NULL) {
+        g_thread_pool_free(p->pool, FALSE, TRUE);
+        p->pool = NULL;
+    }
+    pthread_mutex_destroy(&p->lock);
+
+    goto_if_true(!ok, error);
+
+    if (op != NULL) {
+        *op = s.op;
+    } else {
+        json_decref(s.op);
+    }
+    json_decref(s.rest);
+
+    g_byte_array_unref(p->capture);
+    free(p);
+
+    return s.ready;
+
+error:
+
+    if (p->capture != NULL) {
+        g_byte_array_unref(p->capture);
+    }
+    free(p);
+
+    json_decref(s.op);
+    json_decref(s.rest);
+    dc_unref(s.ready);
+
+    return NULL;
+}
+
+dc_ready_t dc_ready_load_callback(json_load_callback_t cb, void *arg,
+                                  json_t **op)
+{
+    return dc_ready_load(cb, arg, op, 0);
+}
+
+static size_t dc_ready_read_buffer(void *buffer, size_t buflen, void *arg)
+{
+    dc_ready_buffer_t *b = (dc_ready_buffer_t *)arg;
+    size_t n = MIN(buflen, b->len - b->pos);
+
+    memcpy(buffer, b->data + b->pos, n);
+    b->pos += n;
+
+    return n;
+}
+
+dc_ready_t dc_ready_loadb(char const *data, size_t len, json_t **op)
+{
+    dc_ready_buffer_t b = { data, len, 0 };
+
+    return_if_true(data == NULL, NULL);
+    return dc_ready_load(dc_ready_read_buffer, &b, op, 0);
+}
+
+dc_ready_t dc_ready_loadb_parallel(char const *data, size_t len,
+                                   json_t **op, unsigned int threads)
+{
+    dc_ready_buffer_t b = { data, len, 0 };
+
+    return_if_true(data == NULL, NULL);
+
+    if (threads == 0) {
+        threads = g_get_num_processors();
+    }
+
+    return dc_ready_load(dc_ready_read_buffer, &b, op, threads);
+}
+
+size_t dc_ready_guilds(dc_ready_t r)
+{
+    return_if_true(r == NULL, 0);
+    return r->guilds->len;
+}
+
+dc_guild_t dc_ready_nth_guild(dc_ready_t r, size_t i)
+{
+    return_if_true(r == NULL || i >= r->guilds->len, NULL);
+    return g_ptr_array_index(r->guilds, i);
+}
+
+size_t dc_ready_channels(dc_ready_t r)
+{
+    return_if_true(r == NULL, 0);
+    return r->channels->len;
+}
+
+dc_channel_t dc_ready_nth_channel(dc_ready_t r, size_t i)
+{
+    return_if_true(r == NULL || i >= r->channels->len, NULL);
+    return g_ptr_array_index(r->channels, i);
+}
+
+size_t dc_ready_friends(dc_ready_t r)
+{
+    return_if_true(r == NULL, 0);
+    return r->friends->len;
+}
+
+dc_account_t dc_ready_nth_friend(dc_ready_t r, size_t i)
+{
+    return_if_true(r == NULL || i >= r->friends->len, NULL);
+    return g_ptr_array_index(r->friends, i);
+}
+
+char const *dc_ready_status(dc_ready_t r, char const *id)
+{
+    return_if_true(r == NULL || id == NULL, NULL);
+    return g_hash_table_lookup(r->presences, id);
+}
@@ -27,7 +27,9 @@ void *dc_ref(void *arg)
     return_if_true(arg == NULL,NULL);
 
     ptr = (dc_refable_t *)arg;
-    ++ptr->ref;
+    /* objects of the session are handed out to other threads
+     */
+    g_atomic_int_inc(&ptr->ref);
 
     if (ptr->debug) {
         FILE *F = fopen("refdebug.txt", "a+");
@@ -41,11 +43,12 @@ void *dc_ref(void *arg)
 void dc_unref(void *arg)
 {
     dc_refable_t *ptr = NULL;
+    bool last = false;
 
     return_if_true(arg == NULL,);
 
     ptr = (dc_refable_t *)arg;
-    --ptr->ref;
+    last = (g_atomic_int_add(&ptr->ref, -1) <= 1);
 
     if (ptr->debug) {
         FILE *F = fopen("refdebug.txt", "a+");
@@ -55,7 +58,7 @@ void dc_unref(void *arg)
         fclose(F);
     }
 
-    if (ptr->ref <= 0 && ptr->cleanup != NULL) {
+    if (last && ptr->cleanup != NULL) {
         ptr->cleanup(arg);
 
         if (ptr->debug) {
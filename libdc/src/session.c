@@ -28,10 +28,19 @@ struct dc_session_
     dc_account_t login;
     dc_gateway_t gateway;
     bool ready;
+    bool compress;
+    dc_gateway_encoding_t encoding;
+    dc_gateway_transport_t transport;
+    /* events the user of the session wants, on top of the ones we handle
+     */
+    bool subscribed[DC_EVENT_TYPE_LAST];
 
     GHashTable *accounts;
     GHashTable *channels;
     GHashTable *guilds;
+    /* channel id -> dc_api_cancel_t of the history fetched for it
+     */
+    GHashTable *prefetch;
 
     GQueue *queue;
     pthread_mutex_t *mutex;
@@ -42,24 +51,123 @@ struct dc_session_
 typedef void (*dc_session_handler_t)(dc_session_t s, dc_event_t e);
 static void dc_session_handle_ready(dc_session_t s, dc_event_t e);
 static void dc_session_handle_message_create(dc_session_t s, dc_event_t e);
-
+static void dc_session_handle_message_update(dc_session_t s, dc_event_t e);
+static void dc_session_handle_message_delete(dc_session_t s, dc_event_t e);
+static void dc_session_handle_message_delete_bulk(dc_session_t s,
+                                                  dc_event_t e);
+static void dc_session_handle_guild_create(dc_session_t s, dc_event_t e);
+static void dc_session_handle_guild_update(dc_session_t s, dc_event_t e);
+static void dc_session_handle_guild_delete(dc_session_t s, dc_event_t e);
+static void dc_session_handle_channel_create(dc_session_t s, dc_event_t e);
+static void dc_session_handle_channel_update(dc_session_t s, dc_event_t e);
+static void dc_session_handle_channel_delete(dc_session_t s, dc_event_t e);
+static void dc_session_handle_relationship_add(dc_session_t s, dc_event_t e);
+static void dc_session_handle_relationship_remove(dc_session_t s,
+                                                  dc_event_t e);
+static void dc_session_handle_presence_update(dc_session_t s, dc_event_t e);
+
+/* indexed by the event code, event types without a handler are only
+ * passed on to the queue. Those change nothing the session keeps, i.e.
+ * members, roles, reactions and typing
+ */
 static dc_session_handler_t handlers[DC_EVENT_TYPE_LAST] = {
     [DC_EVENT_TYPE_UNKNOWN] = NULL,
     [DC_EVENT_TYPE_READY] = dc_session_handle_ready,
     [DC_EVENT_TYPE_MESSAGE_CREATE] = dc_session_handle_message_create,
+    [DC_EVENT_TYPE_MESSAGE_UPDATE] = dc_session_handle_message_update,
+    [DC_EVENT_TYPE_MESSAGE_DELETE] = dc_session_handle_message_delete,
+    [DC_EVENT_TYPE_MESSAGE_DELETE_BULK] =
+        dc_session_handle_message_delete_bulk,
+    [DC_EVENT_TYPE_GUILD_CREATE] = dc_session_handle_guild_create,
+    [DC_EVENT_TYPE_GUILD_UPDATE] = dc_session_handle_guild_update,
+    [DC_EVENT_TYPE_GUILD_DELETE] = dc_session_handle_guild_delete,
+    [DC_EVENT_TYPE_CHANNEL_CREATE] = dc_session_handle_channel_create,
+    [DC_EVENT_TYPE_CHANNEL_UPDATE] = dc_session_handle_channel_update,
+    [DC_EVENT_TYPE_CHANNEL_DELETE] = dc_session_handle_channel_delete,
+    [DC_EVENT_TYPE_RELATIONSHIP_ADD] = dc_session_handle_relationship_add,
+    [DC_EVENT_TYPE_RELATIONSHIP_REMOVE] =
+        dc_session_handle_relationship_remove,
+    [DC_EVENT_TYPE_PRESENCE_UPDATE] = dc_session_handle_presence_update,
+};
+
+/* handled when they come, but only asked for when the user of the session
+ * subscribed to them. Presence needs a privileged intent, and guild
+ * subscriptions, which are a lot of traffic
+ */
+static bool const on_request[DC_EVENT_TYPE_LAST] = {
+    [DC_EVENT_TYPE_PRESENCE_UPDATE] = true,
+};
+
+/* gateway intents an event needs, so that discord sends it at all
+ */
+static uint32_t const intents[DC_EVENT_TYPE_LAST] = {
+    [DC_EVENT_TYPE_READY] = GATEWAY_INTENT_GUILDS,
+    [DC_EVENT_TYPE_CHANNEL_CREATE] = GATEWAY_INTENT_GUILDS,
+    [DC_EVENT_TYPE_CHANNEL_UPDATE] = GATEWAY_INTENT_GUILDS,
+    [DC_EVENT_TYPE_CHANNEL_DELETE] = GATEWAY_INTENT_GUILDS,
+    [DC_EVENT_TYPE_CHANNEL_PINS_UPDATE] = GATEWAY_INTENT_GUILDS,
+    [DC_EVENT_TYPE_GUILD_CREATE] = GATEWAY_INTENT_GUILDS,
+    [DC_EVENT_TYPE_GUILD_UPDATE] = GATEWAY_INTENT_GUILDS,
+    [DC_EVENT_TYPE_GUILD_DELETE] = GATEWAY_INTENT_GUILDS,
+    [DC_EVENT_TYPE_GUILD_ROLE_CREATE] = GATEWAY_INTENT_GUILDS,
+    [DC_EVENT_TYPE_GUILD_ROLE_UPDATE] = GATEWAY_INTENT_GUILDS,
+    [DC_EVENT_TYPE_GUILD_ROLE_DELETE] = GATEWAY_INTENT_GUILDS,
+    [DC_EVENT_TYPE_GUILD_MEMBER_ADD] = GATEWAY_INTENT_GUILD_MEMBERS,
+    [DC_EVENT_TYPE_GUILD_MEMBER_UPDATE] = GATEWAY_INTENT_GUILD_MEMBERS,
+    [DC_EVENT_TYPE_GUILD_MEMBER_REMOVE] = GATEWAY_INTENT_GUILD_MEMBERS,
+    [DC_EVENT_TYPE_GUILD_BAN_ADD] = GATEWAY_INTENT_GUILD_BANS,
+    [DC_EVENT_TYPE_GUILD_BAN_REMOVE] = GATEWAY_INTENT_GUILD_BANS,
+    [DC_EVENT_TYPE_GUILD_EMOJIS_UPDATE] = GATEWAY_INTENT_GUILD_EMOJIS,
+    [DC_EVENT_TYPE_GUILD_INTEGRATIONS_UPDATE] =
+        GATEWAY_INTENT_GUILD_INTEGRATIONS,
+    [DC_EVENT_TYPE_WEBHOOKS_UPDATE] = GATEWAY_INTENT_GUILD_WEBHOOKS,
+    [DC_EVENT_TYPE_INVITE_CREATE] = GATEWAY_INTENT_GUILD_INVITES,
+    [DC_EVENT_TYPE_INVITE_DELETE] = GATEWAY_INTENT_GUILD_INVITES,
+    [DC_EVENT_TYPE_VOICE_STATE_UPDATE] = GATEWAY_INTENT_GUILD_VOICE_STATES,
+    [DC_EVENT_TYPE_PRESENCE_UPDATE] = GATEWAY_INTENT_GUILD_PRESENCES,
+    /* no MESSAGE_CONTENT, the v6 gateway has no such intent, and sends
+     * the content anyway
+     */
+    [DC_EVENT_TYPE_MESSAGE_CREATE] = (GATEWAY_INTENT_GUILD_MESSAGES |
+                                      GATEWAY_INTENT_DIRECT_MESSAGES),
+    [DC_EVENT_TYPE_MESSAGE_UPDATE] = (GATEWAY_INTENT_GUILD_MESSAGES |
+                                      GATEWAY_INTENT_DIRECT_MESSAGES),
+    [DC_EVENT_TYPE_MESSAGE_DELETE] = (GATEWAY_INTENT_GUILD_MESSAGES |
+                                      GATEWAY_INTENT_DIRECT_MESSAGES),
+    [DC_EVENT_TYPE_MESSAGE_DELETE_BULK] = GATEWAY_INTENT_GUILD_MESSAGES,
+    [DC_EVENT_TYPE_MESSAGE_REACTION_ADD] =
+        (GATEWAY_INTENT_GUILD_MESSAGE_REACTIONS |
+         GATEWAY_INTENT_DIRECT_MESSAGE_REACTIONS),
+    [DC_EVENT_TYPE_MESSAGE_REACTION_REMOVE] =
+        (GATEWAY_INTENT_GUILD_MESSAGE_REACTIONS |
+         GATEWAY_INTENT_DIRECT_MESSAGE_REACTIONS),
+    [DC_EVENT_TYPE_MESSAGE_REACTION_REMOVE_ALL] =
+        (GATEWAY_INTENT_GUILD_MESSAGE_REACTIONS |
+         GATEWAY_INTENT_DIRECT_MESSAGE_REACTIONS),
+    [DC_EVENT_TYPE_MESSAGE_REACTION_REMOVE_EMOJI] =
+        (GATEWAY_INTENT_GUILD_MESSAGE_REACTIONS |
+         GATEWAY_INTENT_DIRECT_MESSAGE_REACTIONS),
+    [DC_EVENT_TYPE_TYPING_START] = (GATEWAY_INTENT_GUILD_MESSAGE_TYPING |
+                                    GATEWAY_INTENT_DIRECT_MESSAGE_TYPING),
 };
 
 static void dc_session_free(dc_session_t s)
 {
     return_if_true(s == NULL,);
 
+    /* while the tables, and the lock for them, are still around
+     */
+    dc_session_logout(s);
+
     if (s->mutex != NULL) {
         pthread_mutex_lock(s->mutex);
         if (s->queue != NULL) {
             g_queue_free_full(s->queue, (GDestroyNotify)dc_unref);
             s->queue = NULL;
         }
+        pthread_mutex_unlock(s->mutex);
         pthread_mutex_destroy(s->mutex);
+        free(s->mutex);
         s->mutex = NULL;
     }
 
@@ -78,7 +186,10 @@ static void dc_session_free(dc_session_t s)
         s->guilds = NULL;
     }
 
-    dc_session_logout(s);
+    if (s->prefetch != NULL) {
+        g_hash_table_unref(s->prefetch);
+        s->prefetch = NULL;
+    }
 
     dc_unref(s->api);
     dc_unref(s->loop);
@@ -86,9 +197,145 @@ static void dc_session_free(dc_session_t s)
     free(s);
 }
 
+/* The tables below are changed by the loop thread, while the user of the
+ * session looks things up in them. Everything here expects s->mutex to
+ * be held, and everything that is handed out is a reference of its own.
+ */
+static void dc_session_put_account(dc_session_t s, dc_account_t u)
+{
+    char const *id = dc_account_id(u);
+
+    if (id != NULL && !g_hash_table_contains(s->accounts, id)) {
+        g_hash_table_insert(s->accounts, strdup(id), u);
+    } else {
+        dc_unref(u);
+    }
+}
+
+static void dc_session_put_channel(dc_session_t s, dc_channel_t c)
+{
+    char const *id = dc_channel_id(c);
+
+    if (id != NULL && !g_hash_table_contains(s->channels, id)) {
+        g_hash_table_insert(s->channels, strdup(id), c);
+        /* TODO: dedup for saving storage
+         */
+    } else {
+        dc_unref(c);
+    }
+}
+
+static void dc_session_put_guild(dc_session_t s, dc_guild_t g)
+{
+    char const *id = dc_guild_id(g);
+    size_t i = 0;
+
+    if (id == NULL) {
+        dc_unref(g);
+        return;
+    }
+
+    /* add their channels to our own thing
+     */
+    for (i = 0; i < dc_guild_channels(g); i++) {
+        dc_session_put_channel(s, dc_ref(dc_guild_nth_channel(g, i)));
+    }
+
+    if (!g_hash_table_contains(s->guilds, id)) {
+        g_hash_table_insert(s->guilds, strdup(id), g);
+    } else {
+        dc_unref(g);
+    }
+}
+
+/* a guild goes, and with it all of its channels
+ */
+static void dc_session_drop_guild(dc_session_t s, char const *id)
+{
+    dc_guild_t g = g_hash_table_lookup(s->guilds, id);
+    size_t i = 0;
+
+    return_if_true(g == NULL,);
+
+    for (i = 0; i < dc_guild_channels(g); i++) {
+        dc_channel_t c = dc_guild_nth_channel(g, i);
+        g_hash_table_remove(s->channels, dc_channel_id(c));
+    }
+
+    g_hash_table_remove(s->guilds, id);
+}
+
+/* the history of a channel does not come with it, so a new object of a
+ * channel gets the messages the old one had
+ */
+static void dc_session_copy_history(dc_channel_t to, dc_channel_t from)
+{
+    dc_message_t m = NULL;
+    size_t i = 0;
+
+    for (i = 0; i < dc_channel_messages(from); i++) {
+        m = dc_channel_nth_message(from, i);
+        dc_channel_add_messages(to, &m, 1);
+    }
+}
+
+/* A READY that is not the first one means the old session could not be
+ * resumed. What happened in between was never sent to us, so only what
+ * this READY has stays around. Channels that are still there keep their
+ * history.
+ */
+static void dc_session_forget(dc_session_t s, dc_ready_t ready)
+{
+    dc_channel_t c = NULL, old = NULL;
+    dc_guild_t g = NULL;
+    size_t i = 0, j = 0;
+
+    for (i = 0; i < dc_ready_channels(ready); i++) {
+        c = dc_ready_nth_channel(ready, i);
+        continue_if_true(dc_channel_id(c) == NULL);
+        old = g_hash_table_lookup(s->channels, dc_channel_id(c));
+        dc_session_copy_history(c, old);
+    }
+
+    for (i = 0; i < dc_ready_guilds(ready); i++) {
+        g = dc_ready_nth_guild(ready, i);
+        for (j = 0; j < dc_guild_channels(g); j++) {
+            c = dc_guild_nth_channel(g, j);
+            continue_if_true(dc_channel_id(c) == NULL);
+            old = g_hash_table_lookup(s->channels, dc_channel_id(c));
+            dc_session_copy_history(c, old);
+        }
+    }
+
+    dc_account_set_friends(s->login, NULL, 0);
+    g_hash_table_remove_all(s->guilds);
+    g_hash_table_remove_all(s->channels);
+}
+
+/* the guild a channel event is about gets a new list of channels. It is
+ * a new guild object, since the old one might be in use right now
+ */
+static void dc_session_update_guild(dc_session_t s, json_t *payload,
+                                    char const *remove, dc_channel_t add)
+{
+    json_t *id = json_object_get(payload, "guild_id");
+    dc_guild_t g = NULL;
+
+    return_if_true(id == NULL || !json_is_string(id),);
+
+    g = dc_guild_copy(g_hash_table_lookup(s->guilds, json_string_value(id)));
+    return_if_true(g == NULL,);
+
+    dc_guild_remove_channel(g, remove);
+    dc_guild_add_channel(g, add);
+
+    g_hash_table_replace(s->guilds, strdup(json_string_value(id)), g);
+}
+
 static void dc_session_handle_message_create(dc_session_t s, dc_event_t e)
 {
     dc_message_t m = NULL;
+    dc_channel_t c = NULL;
     json_t *r = dc_event_payload(e);
     char const *id = NULL;
 
@@ -96,28 +343,277 @@ static void dc_session_handle_message_create(dc_session_t s, dc_event_t e)
     goto_if_true(m == NULL, cleanup);
 
     id = dc_message_channel_id(m);
-    goto_if_true(m == NULL, cleanup);
+    goto_if_true(id == NULL, cleanup);
 
-    if (g_hash_table_contains(s->channels, id)) {
-        dc_channel_t c = g_hash_table_lookup(s->channels, id);
+    pthread_mutex_lock(s->mutex);
+    c = dc_ref(g_hash_table_lookup(s->channels, id));
+    pthread_mutex_unlock(s->mutex);
+
+    if (c != NULL) {
         dc_channel_add_messages(c, &m, 1);
     }
 
 cleanup:
 
+    dc_unref(c);
     dc_unref(m);
 }
 
+/* the channel a message event is about, as a reference of its own
+ */
+static dc_channel_t dc_session_event_channel(dc_session_t s, json_t *r)
+{
+    json_t *id = json_object_get(r, "channel_id");
+    dc_channel_t c = NULL;
+
+    return_if_true(id == NULL || !json_is_string(id), NULL);
+
+    pthread_mutex_lock(s->mutex);
+    c = dc_ref(g_hash_table_lookup(s->channels, json_string_value(id)));
+    pthread_mutex_unlock(s->mutex);
+
+    return c;
+}
+
+static void dc_session_handle_message_update(dc_session_t s, dc_event_t e)
+{
+    json_t *r = dc_event_payload(e);
+    dc_message_t m = NULL;
+    dc_channel_t c = NULL;
+
+    /* embeds that were resolved later come without content, and are
+     * nothing we would show
+     */
+    m = dc_message_from_json(r);
+    return_if_true(m == NULL,);
+
+    c = dc_session_event_channel(s, r);
+    if (c != NULL) {
+        dc_channel_update_message(c, m);
+    }
+
+    dc_unref(c);
+    dc_unref(m);
+}
+
+static void dc_session_handle_message_delete(dc_session_t s, dc_event_t e)
+{
+    json_t *r = dc_event_payload(e);
+    json_t *id = json_object_get(r, "id");
+    dc_channel_t c = NULL;
+
+    return_if_true(id == NULL || !json_is_string(id),);
+
+    c = dc_session_event_channel(s, r);
+    if (c != NULL) {
+        dc_channel_remove_message(c, json_string_value(id));
+    }
+
+    dc_unref(c);
+}
+
+static void dc_session_handle_message_delete_bulk(dc_session_t s,
+                                                  dc_event_t e)
+{
+    json_t *r = dc_event_payload(e);
+    json_t *ids = json_object_get(r, "ids"), *id = NULL;
+    dc_channel_t c = NULL;
+    size_t idx = 0;
+
+    return_if_true(ids == NULL || !json_is_array(ids),);
+
+    c = dc_session_event_channel(s, r);
+    return_if_true(c == NULL,);
+
+    json_array_foreach(ids, idx, id) {
+        continue_if_true(!json_is_string(id));
+        dc_channel_remove_message(c, json_string_value(id));
+    }
+
+    dc_unref(c);
+}
+
+static void dc_session_handle_guild_create(dc_session_t s, dc_event_t e)
+{
+    dc_guild_t g = dc_guild_from_json(dc_event_payload(e));
+
+    return_if_true(g == NULL,);
+
+    /* also sent when a guild comes back after an outage, and for every
+     * guild right after READY. The new one is the more recent, and so
+     * are its channels, the old ones would otherwise stay around
+     */
+    pthread_mutex_lock(s->mutex);
+    dc_session_drop_guild(s, dc_guild_id(g));
+    dc_session_put_guild(s, g);
+    pthread_mutex_unlock(s->mutex);
+}
+
+static void dc_session_handle_guild_update(dc_session_t s, dc_event_t e)
+{
+    json_t *r = dc_event_payload(e), *id = NULL, *name = NULL;
+    dc_guild_t g = NULL;
+
+    /* comes without channels, so only what else we keep of a guild
+     */
+    id = json_object_get(r, "id");
+    name = json_object_get(r, "name");
+    return_if_true(id == NULL || !json_is_string(id),);
+    return_if_true(name == NULL || !json_is_string(name),);
+
+    pthread_mutex_lock(s->mutex);
+    g = dc_guild_copy(g_hash_table_lookup(s->guilds, json_string_value(id)));
+    if (g != NULL) {
+        dc_guild_set_name(g, json_string_value(name));
+        g_hash_table_replace(s->guilds, strdup(json_string_value(id)), g);
+    }
+    pthread_mutex_unlock(s->mutex);
+}
+
+static void dc_session_handle_guild_delete(dc_session_t s, dc_event_t e)
+{
+    json_t *r = dc_event_payload(e), *id = NULL;
+
+    /* unavailable means there is an outage, and the guild will be back
+     */
+    return_if_true(json_is_true(json_object_get(r, "unavailable")),);
+
+    id = json_object_get(r, "id");
+    return_if_true(id == NULL || !json_is_string(id),);
+
+    pthread_mutex_lock(s->mutex);
+    dc_session_drop_guild(s, json_string_value(id));
+    pthread_mutex_unlock(s->mutex);
+}
+
+static void dc_session_handle_channel_create(dc_session_t s, dc_event_t e)
+{
+    json_t *r = dc_event_payload(e);
+    dc_channel_t c = dc_channel_from_json(r);
+
+    return_if_true(c == NULL,);
+
+    pthread_mutex_lock(s->mutex);
+    if (dc_channel_id(c) != NULL &&
+        !g_hash_table_contains(s->channels, dc_channel_id(c))) {
+        dc_session_update_guild(s, r, NULL, c);
+        dc_session_put_channel(s, dc_ref(c));
+    }
+    pthread_mutex_unlock(s->mutex);
+
+    dc_unref(c);
+}
+
+static void dc_session_handle_channel_update(dc_session_t s, dc_event_t e)
+{
+    json_t *r = dc_event_payload(e);
+    dc_channel_t c = dc_channel_from_json(r), old = NULL;
+
+    return_if_true(c == NULL,);
+    goto_if_true(dc_channel_id(c) == NULL, cleanup);
+
+    pthread_mutex_lock(s->mutex);
+    old = dc_ref(g_hash_table_lookup(s->channels, dc_channel_id(c)));
+    pthread_mutex_unlock(s->mutex);
+
+    goto_if_true(old == NULL, cleanup);
+
+    dc_session_copy_history(c, old);
+
+    pthread_mutex_lock(s->mutex);
+    dc_session_update_guild(s, r, dc_channel_id(c), c);
+    g_hash_table_replace(s->channels, strdup(dc_channel_id(c)), dc_ref(c));
+    pthread_mutex_unlock(s->mutex);
+
+cleanup:
+
+    dc_unref(old);
+    dc_unref(c);
+}
+
+static void dc_session_handle_channel_delete(dc_session_t s, dc_event_t e)
+{
+    json_t *r = dc_event_payload(e);
+    json_t *id = json_object_get(r, "id");
+
+    return_if_true(id == NULL || !json_is_string(id),);
+
+    pthread_mutex_lock(s->mutex);
+    dc_session_update_guild(s, r, json_string_value(id), NULL);
+    g_hash_table_remove(s->channels, json_string_value(id));
+    pthread_mutex_unlock(s->mutex);
+}
+
+static void dc_session_handle_relationship_add(dc_session_t s, dc_event_t e)
+{
+    dc_account_t u = dc_account_from_relationship(dc_event_payload(e));
+
+    return_if_true(u == NULL,);
+
+    pthread_mutex_lock(s->mutex);
+    dc_account_add_friend(s->login, u);
+    dc_session_put_account(s, u);
+    pthread_mutex_unlock(s->mutex);
+}
+
+static void dc_session_handle_relationship_remove(dc_session_t s,
+                                                  dc_event_t e)
+{
+    json_t *id = json_object_get(dc_event_payload(e), "id");
+
+    return_if_true(id == NULL || !json_is_string(id),);
+
+    /* the account stays, messages might still point to it
+     */
+    pthread_mutex_lock(s->mutex);
+    dc_account_remove_friend(s->login, json_string_value(id));
+    pthread_mutex_unlock(s->mutex);
+}
+
+static void dc_session_handle_presence_update(dc_session_t s, dc_event_t e)
+{
+    json_t *r = dc_event_payload(e), *user = NULL, *id = NULL;
+    json_t *status = NULL;
+    dc_account_t acc = NULL;
+
+    user = json_object_get(r, "user");
+    return_if_true(user == NULL || !json_is_object(user),);
+    id = json_object_get(user, "id");
+    return_if_true(id == NULL || !json_is_string(id),);
+    status = json_object_get(r, "status");
+    return_if_true(status == NULL || !json_is_string(status),);
+
+    pthread_mutex_lock(s->mutex);
+    acc = g_hash_table_lookup(s->accounts, json_string_value(id));
+    if (acc != NULL) {
+        dc_account_set_status(acc, json_string_value(status));
+    }
+    pthread_mutex_unlock(s->mutex);
+}
+
 static void dc_session_handle_ready(dc_session_t s, dc_event_t e)
 {
     json_t *r = dc_event_payload(e);
     json_t *user = NULL;
-    json_t *relationships = NULL;
-    json_t *presences = NULL;
-    size_t idx = 0;
-    json_t *c = NULL;
-    json_t *channels = NULL;
-    json_t *guilds = NULL;
+    dc_ready_t ready = NULL;
+    GHashTableIter iter;
+    gpointer key, value;
+    size_t i = 0;
+
+    /* the gateway hands us the objects if it streamed READY, otherwise
+     * we make them from the payload
+     */
+    ready = dc_ref(dc_event_ready(e));
+    if (ready == NULL) {
+        ready = dc_ready_from_json(r);
+    }
+    return_if_true(ready == NULL,);
+
+    pthread_mutex_lock(s->mutex);
+
+    if (s->ready) {
+        dc_session_forget(s, ready);
+    }
 
     /* retrieve user information about ourselves, including snowflake,
      * discriminator, and other things
@@ -125,71 +621,45 @@ static void dc_session_handle_ready(dc_session_t s, dc_event_t e)
     user = json_object_get(r, "user");
     if (user != NULL && json_is_object(user)) {
         dc_account_load(s->login, user);
-        dc_session_add_account(s, s->login);
+        dc_session_put_account(s, dc_ref(s->login));
     }
 
     /* load relationships, aka friends
      */
-    relationships = json_object_get(r, "relationships");
-    if (relationships != NULL && json_is_array(relationships)) {
-        json_array_foreach(relationships, idx, c) {
-            dc_account_t u = dc_account_from_relationship(c);
-
-            if (u == NULL) {
-                continue;
-            }
+    for (i = 0; i < dc_ready_friends(ready); i++) {
+        dc_account_t u = dc_ready_nth_friend(ready, i);
 
-            dc_account_add_friend(s->login, u);
-            dc_session_add_account_new(s, u);
-        }
+        dc_account_add_friend(s->login, u);
+        dc_session_put_account(s, dc_ref(u));
     }
 
     /* check presences
      */
-    presences = json_object_get(r, "presences");
-    if (presences != NULL && json_is_array(presences)) {
-        json_array_foreach(presences, idx, c) {
-            json_t *user = NULL, *id = NULL, *status = NULL;
-            dc_account_t acc = NULL;
-
-            user = json_object_get(c, "user");
-            continue_if_true(user == NULL || !json_is_object(user));
-            id = json_object_get(user, "id");
-            continue_if_true(id == NULL || !json_is_string(id));
-            status = json_object_get(c, "status");
-            continue_if_true(s == NULL || !json_is_string(status));
-
-            acc = g_hash_table_lookup(s->accounts, json_string_value(id));
-            continue_if_true(acc == NULL);
-
-            dc_account_set_status(acc, json_string_value(status));
-        }
+    g_hash_table_iter_init(&iter, s->accounts);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        char const *status = dc_ready_status(ready, key);
+        continue_if_true(status == NULL);
+        dc_account_set_status((dc_account_t)value, status);
     }
 
     /* load guilds
      */
-    guilds = json_object_get(r, "guilds");
-    if (guilds != NULL && json_is_array(guilds)) {
-        json_array_foreach(guilds, idx, c) {
-            dc_guild_t guild = dc_guild_from_json(c);
-            continue_if_true(guild == NULL);
-            dc_session_add_guild_new(s, guild);
-        }
+    for (i = 0; i < dc_ready_guilds(ready); i++) {
+        dc_session_put_guild(s, dc_ref(dc_ready_nth_guild(ready, i)));
     }
 
     /* load channels
      */
-    channels = json_object_get(r, "private_channels");
-    if (channels != NULL && json_is_array(channels)) {
-        json_array_foreach(channels, idx, c) {
-            dc_channel_t chan = dc_channel_from_json(c);
-            continue_if_true(chan == NULL);
-            /* TODO: dedup recipients
-             */
-            dc_session_add_channel_new(s, chan);
-        }
+    for (i = 0; i < dc_ready_channels(ready); i++) {
+        /* TODO: dedup recipients
+         */
+        dc_session_put_channel(s, dc_ref(dc_ready_nth_channel(ready, i)));
     }
 
+    pthread_mutex_unlock(s->mutex);
+
+    dc_unref(ready);
+
     s->ready = true;
 }
 
@@ -244,8 +714,14 @@ dc_session_t dc_session_new(dc_loop_t loop)
         );
     goto_if_true(s->channels == NULL, error);
 
+    s->prefetch = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                        free, g_free
+        );
+    goto_if_true(s->prefetch == NULL, error);
+
     s->mutex = calloc(1, sizeof(pthread_mutex_t));
     goto_if_true(s->mutex == NULL, error);
+    pthread_mutex_init(s->mutex, NULL);
 
     s->loop = dc_ref(loop);
 
@@ -280,6 +756,10 @@ bool dc_session_logout(dc_session_t s)
         s->gateway = NULL;
     }
 
+    if (s->mutex != NULL) {
+        pthread_mutex_lock(s->mutex);
+    }
+
     if (s->accounts != NULL) {
         g_hash_table_remove_all(s->accounts);
     }
@@ -292,11 +772,39 @@ bool dc_session_logout(dc_session_t s)
         g_hash_table_remove_all(s->channels);
     }
 
+    if (s->mutex != NULL) {
+        pthread_mutex_unlock(s->mutex);
+    }
+
     s->ready = false;
 
     return true;
 }
 
+/* Only ask discord for what we, or the user of the session handle. Guild
+ * subscriptions are presence, and typing updates, which nobody wants yet.
+ */
+static void dc_session_subscribe_gateway(dc_session_t s)
+{
+    uint32_t want = GATEWAY_INTENT_GUILDS;
+    int i = 0;
+
+    for (i = DC_EVENT_TYPE_UNKNOWN + 1; i < DC_EVENT_TYPE_LAST; i++) {
+        continue_if_true((handlers[i] == NULL || on_request[i]) &&
+                         !s->subscribed[i]
+            );
+
+        want |= intents[i];
+        dc_gateway_subscribe(s->gateway, dc_event_type_name(i));
+    }
+
+    dc_gateway_set_intents(s->gateway, want);
+    dc_gateway_set_guild_subscriptions(s->gateway,
+        (want & (GATEWAY_INTENT_GUILD_PRESENCES |
+                 GATEWAY_INTENT_GUILD_MESSAGE_TYPING)) != 0
+        );
+}
+
 bool dc_session_login(dc_session_t s, dc_account_t login)
 {
     return_if_true(s == NULL || login == NULL, false);
@@ -323,12 +831,42 @@ bool dc_session_login(dc_session_t s, dc_account_t login)
 
         dc_gateway_set_callback(s->gateway, dc_session_handler, s);
         dc_gateway_set_login(s->gateway, s->login);
+        dc_gateway_set_compress(s->gateway, s->compress);
+        dc_gateway_set_encoding(s->gateway, s->encoding);
+        dc_gateway_set_transport(s->gateway, s->transport);
+        dc_session_subscribe_gateway(s);
         dc_loop_add_gateway(s->loop, s->gateway);
     }
 
     return true;
 }
 
+void dc_session_subscribe(dc_session_t s, dc_event_type_t t)
+{
+    return_if_true(s == NULL,);
+    return_if_true(t <= DC_EVENT_TYPE_UNKNOWN || t >= DC_EVENT_TYPE_LAST,);
+
+    s->subscribed[t] = true;
+}
+
+void dc_session_set_compress(dc_session_t s, bool compress)
+{
+    return_if_true(s == NULL,);
+    s->compress = compress;
+}
+
+void dc_session_set_encoding(dc_session_t s, dc_gateway_encoding_t e)
+{
+    return_if_true(s == NULL,);
+    s->encoding = e;
+}
+
+void dc_session_set_transport(dc_session_t s, dc_gateway_transport_t t)
+{
+    return_if_true(s == NULL,);
+    s->transport = t;
+}
+
 bool dc_session_has_token(dc_session_t s)
 {
     return_if_true(s == NULL || s->login == NULL, false);
@@ -341,6 +879,12 @@ bool dc_session_is_ready(dc_session_t s)
     return s->ready;
 }
 
+dc_gateway_t dc_session_gateway(dc_session_t s)
+{
+    return_if_true(s == NULL, NULL);
+    return s->gateway;
+}
+
 dc_api_t dc_session_api(dc_session_t s)
 {
     return_if_true(s == NULL, NULL);
@@ -410,11 +954,9 @@ void dc_session_add_account_new(dc_session_t s, dc_account_t u)
     return_if_true(s == NULL || u == NULL,);
     return_if_true(dc_account_id(u) == NULL,);
 
-    char const *id = dc_account_id(u);
-
-    if (!g_hash_table_contains(s->accounts, id)) {
-        g_hash_table_insert(s->accounts, strdup(id), u);
-    }
+    pthread_mutex_lock(s->mutex);
+    dc_session_put_account(s, u);
+    pthread_mutex_unlock(s->mutex);
 }
 
 dc_account_t dc_session_account_fullname(dc_session_t s, char const *f)
@@ -422,24 +964,34 @@ dc_account_t dc_session_account_fullname(dc_session_t s, char const *f)
     return_if_true(s == NULL || f == NULL, NULL);
     GHashTableIter iter;
     gpointer key, value;
+    dc_account_t a = NULL;
 
     /* TODO: hash table with fullname
      */
+    pthread_mutex_lock(s->mutex);
     g_hash_table_iter_init(&iter, s->accounts);
     while (g_hash_table_iter_next(&iter, &key, &value)) {
-        dc_account_t a = (dc_account_t)value;
-        if (strcmp(dc_account_fullname(a), f) == 0) {
-            return a;
+        if (strcmp(dc_account_fullname((dc_account_t)value), f) == 0) {
+            a = dc_ref(value);
+            break;
         }
     }
+    pthread_mutex_unlock(s->mutex);
 
-    return NULL;
+    return a;
 }
 
 dc_channel_t dc_session_channel_by_id(dc_session_t s, char const *snowflake)
 {
+    dc_channel_t c = NULL;
+
     return_if_true(s == NULL || snowflake == NULL, NULL);
-    return (dc_channel_t)g_hash_table_lookup(s->channels, snowflake);
+
+    pthread_mutex_lock(s->mutex);
+    c = dc_ref(g_hash_table_lookup(s->channels, snowflake));
+    pthread_mutex_unlock(s->mutex);
+
+    return c;
 }
 
 void dc_session_add_channel(dc_session_t s, dc_channel_t u)
@@ -453,12 +1005,76 @@ void dc_session_add_channel_new(dc_session_t s, dc_channel_t u)
     return_if_true(s == NULL || u == NULL,);
     return_if_true(dc_channel_id(u) == NULL,);
 
-    char const *id = dc_channel_id(u);
+    pthread_mutex_lock(s->mutex);
+    dc_session_put_channel(s, u);
+    pthread_mutex_unlock(s->mutex);
+}
+
+typedef struct {
+    dc_session_t session;
+    char *channel;
+    dc_api_cancel_t cancel;
+} dc_session_prefetch_t;
 
-    if (!g_hash_table_contains(s->channels, id)) {
-        g_hash_table_insert(s->channels, strdup(id), u);
-        /* TODO: dedup for saving storage
-         */
+static void dc_session_prefetch_done(dc_api_t api, bool ok,
+                                     void *result, void *arg)
+{
+    dc_session_prefetch_t *p = (dc_session_prefetch_t*)arg;
+    dc_session_t s = p->session;
+    dc_api_cancel_t *cancel = NULL;
+
+    /* only if it is still this fetch, the channel might have been
+     * closed and opened again since
+     */
+    pthread_mutex_lock(s->mutex);
+    cancel = g_hash_table_lookup(s->prefetch, p->channel);
+    if (cancel != NULL && *cancel == p->cancel) {
+        g_hash_table_remove(s->prefetch, p->channel);
+    }
+    pthread_mutex_unlock(s->mutex);
+
+    dc_unref(s);
+    free(p->channel);
+    free(p);
+}
+
+static void dc_session_prefetch(dc_session_t s, dc_channel_t c)
+{
+    dc_api_priority_t prio = 0;
+    dc_api_cancel_t *cancel = NULL;
+    dc_api_cancel_t old = 0;
+    dc_session_prefetch_t *p = NULL;
+    bool ret = false;
+
+    p = calloc(1, sizeof(dc_session_prefetch_t));
+    return_if_true(p == NULL,);
+
+    cancel = g_new(dc_api_cancel_t, 1);
+
+    /* so it can be called off, if the channel is closed before
+     */
+    *cancel = dc_api_cancel_new(s->api);
+    p->session = dc_ref(s);
+    p->channel = strdup(dc_channel_id(c));
+    p->cancel = *cancel;
+
+    pthread_mutex_lock(s->mutex);
+    g_hash_table_insert(s->prefetch, strdup(dc_channel_id(c)), cancel);
+    pthread_mutex_unlock(s->mutex);
+
+    /* nobody has to wait for them, and they should not hold up anything
+     * else either
+     */
+    prio = dc_api_set_priority(DC_API_PRIORITY_BACKGROUND);
+    old = dc_api_set_cancel(p->cancel);
+    ret = dc_api_get_messages_async(s->api, s->login, c,
+                                    dc_session_prefetch_done, p
+        );
+    dc_api_set_cancel(old);
+    dc_api_set_priority(prio);
+
+    if (!ret) {
+        dc_session_prefetch_done(s->api, false, NULL, p);
     }
 }
 
@@ -479,18 +1095,40 @@ dc_channel_t dc_session_make_channel(dc_session_t s, dc_account_t *r,
         }
 
         return_if_true(c == NULL, NULL);
-        dc_session_add_channel_new(s, c);
+        dc_session_add_channel(s, c);
     }
 
     if (dc_channel_messages(c) <= 0 && dc_channel_is_dm(c)) {
-        /* fetch some messages for it
+        /* the messages are added on the thread running the callback base
+         * of the API, see dc_api_set_callback_base()
          */
-        dc_api_get_messages(s->api, s->login, c);
+        dc_session_prefetch(s, c);
     }
 
     return c;
 }
 
+void dc_session_cancel_channel(dc_session_t s, dc_channel_t c)
+{
+    dc_api_cancel_t *cancel = NULL;
+    dc_api_cancel_t id = 0;
+
+    return_if_true(s == NULL || c == NULL,);
+    return_if_true(dc_channel_id(c) == NULL,);
+
+    pthread_mutex_lock(s->mutex);
+    cancel = g_hash_table_lookup(s->prefetch, dc_channel_id(c));
+    if (cancel != NULL) {
+        id = *cancel;
+        g_hash_table_remove(s->prefetch, dc_channel_id(c));
+    }
+    pthread_mutex_unlock(s->mutex);
+
+    if (id != 0) {
+        dc_api_cancel(s->api, id);
+    }
+}
+
 dc_channel_t dc_session_channel_recipients(dc_session_t s,
                                            dc_account_t *r, size_t sz)
 {
@@ -498,8 +1136,10 @@ dc_channel_t dc_session_channel_recipients(dc_session_t s,
 
     GHashTableIter iter;
     gpointer key, value;
+    dc_channel_t c = NULL;
     size_t i = 0;
 
+    pthread_mutex_lock(s->mutex);
     g_hash_table_iter_init(&iter, s->channels);
     while (g_hash_table_iter_next(&iter, &key, &value)) {
         dc_channel_t chan = (dc_channel_t)value;
@@ -521,17 +1161,34 @@ dc_channel_t dc_session_channel_recipients(dc_session_t s,
         }
 
         if (found) {
-            return chan;
+            c = dc_ref(chan);
+            break;
         }
     }
+    pthread_mutex_unlock(s->mutex);
 
-    return NULL;
+    return c;
 }
 
-GHashTable *dc_session_guilds(dc_session_t s)
+GPtrArray *dc_session_guilds(dc_session_t s)
 {
+    GPtrArray *guilds = NULL;
+    GHashTableIter iter;
+    gpointer key, value;
+
     return_if_true(s == NULL, NULL);
-    return s->guilds;
+
+    guilds = g_ptr_array_new_with_free_func((GDestroyNotify)dc_unref);
+    return_if_true(guilds == NULL, NULL);
+
+    pthread_mutex_lock(s->mutex);
+    g_hash_table_iter_init(&iter, s->guilds);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        g_ptr_array_add(guilds, dc_ref(value));
+    }
+    pthread_mutex_unlock(s->mutex);
+
+    return guilds;
 }
 
 void dc_session_add_guild(dc_session_t s, dc_guild_t g)
@@ -545,21 +1202,9 @@ void dc_session_add_guild_new(dc_session_t s, dc_guild_t g)
     return_if_true(s == NULL || g == NULL,);
     return_if_true(dc_guild_id(g) == NULL,);
 
-    char const *id = dc_guild_id(g);
-    size_t i = 0;
-
-    if (!g_hash_table_contains(s->guilds, id)) {
-        g_hash_table_insert(s->guilds, strdup(id), g);
-        /* TODO: dedup for saving storage
-         */
-    }
-
-    /* add their channels to our own thing
-     */
-    for (i = 0; i < dc_guild_channels(g); i++) {
-        dc_channel_t chan = dc_guild_nth_channel(g, i);
-        dc_session_add_channel(s, chan);
-    }
+    pthread_mutex_lock(s->mutex);
+    dc_session_put_guild(s, g);
+    pthread_mutex_unlock(s->mutex);
 }
 
 dc_guild_t dc_session_guild_by_name(dc_session_t s, char const *name)
@@ -568,14 +1213,17 @@ dc_guild_t dc_session_guild_by_name(dc_session_t s, char const *name)
 
     GHashTableIter iter;
     gpointer key, value;
+    dc_guild_t g = NULL;
 
+    pthread_mutex_lock(s->mutex);
     g_hash_table_iter_init(&iter, s->guilds);
     while (g_hash_table_iter_next(&iter, &key, &value)) {
-        dc_guild_t g = (dc_guild_t)value;
-        if (strcmp(dc_guild_name(g), name) == 0) {
-            return g;
+        if (strcmp(dc_guild_name((dc_guild_t)value), name) == 0) {
+            g = dc_ref(value);
+            break;
         }
     }
+    pthread_mutex_unlock(s->mutex);
 
-    return NULL;
+    return g;
 }
@@ -0,0 +1,109 @@
+/*
+ * Part of ncdc - a discord client for the console
+ * Copyright (C) 2019 Florian Stinglmayr <fstinglmayr@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <dc/share.h>
+#include <dc/refable.h>
+
+#include "internal.h"
+
+struct dc_share_
+{
+    dc_refable_t ref;
+
+    CURLSH *curl;
+
+    /* one lock per kind of data, so a DNS lookup does not wait for
+     * somebody storing a TLS session
+     */
+    pthread_mutex_t locks[CURL_LOCK_DATA_LAST];
+};
+
+static void dc_share_free(dc_share_t s)
+{
+    int i = 0;
+
+    return_if_true(s == NULL,);
+
+    if (s->curl != NULL) {
+        curl_share_cleanup(s->curl);
+        s->curl = NULL;
+    }
+
+    for (i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        pthread_mutex_destroy(&s->locks[i]);
+    }
+
+    free(s);
+}
+
+static void dc_share_lock(CURL *easy, curl_lock_data data,
+                          curl_lock_access access, void *ptr)
+{
+    dc_share_t s = (dc_share_t)ptr;
+    pthread_mutex_lock(&s->locks[data]);
+}
+
+static void dc_share_unlock(CURL *easy, curl_lock_data data, void *ptr)
+{
+    dc_share_t s = (dc_share_t)ptr;
+    pthread_mutex_unlock(&s->locks[data]);
+}
+
+dc_share_t dc_share_new(void)
+{
+    dc_share_t ptr = calloc(1, sizeof(struct dc_share_));
+    int i = 0;
+
+    return_if_true(ptr == NULL, NULL);
+
+    ptr->ref.cleanup = (dc_cleanup_t)dc_share_free;
+
+    for (i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        pthread_mutex_init(&ptr->locks[i], NULL);
+    }
+
+    ptr->curl = curl_share_init();
+    goto_if_true(ptr->curl == NULL, error);
+
+    curl_share_setopt(ptr->curl, CURLSHOPT_LOCKFUNC, dc_share_lock);
+    curl_share_setopt(ptr->curl, CURLSHOPT_UNLOCKFUNC, dc_share_unlock);
+    curl_share_setopt(ptr->curl, CURLSHOPT_USERDATA, ptr);
+
+    curl_share_setopt(ptr->curl, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(ptr->curl, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    curl_share_setopt(ptr->curl, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+
+    return dc_ref(ptr);
+
+error:
+
+    dc_share_free(ptr);
+    return NULL;
+}
+
+CURLSH *dc_share_curl(dc_share_t share)
+{
+    return_if_true(share == NULL, NULL);
+    return share->curl;
+}
+
+void dc_share_attach(dc_share_t share, CURL *easy)
+{
+    return_if_true(share == NULL || easy == NULL,);
+    curl_easy_setopt(easy, CURLOPT_SHARE, share->curl);
+}
@@ -28,3 +28,56 @@ void dc_util_dump_json(json_t *j)
     printf("%s\n", str);
     free(str);
 }
+
+void dc_util_json_string(GString *out, char const *s)
+{
+    char const *run = NULL;
+
+    return_if_true(out == NULL,);
+
+    if (s == NULL) {
+        g_string_append(out, "null");
+        return;
+    }
+
+    g_string_append_c(out, '"');
+
+    while (*s != '\0') {
+        /* copy everything that needs no escaping in one go
+         */
+        for (run = s; *s != '\0' && *s != '"' && *s != '\\' &&
+                 (unsigned char)*s >= 0x20; s++)
+            ;
+        g_string_append_len(out, run, s - run);
+        if (*s == '\0') {
+            break;
+        }
+
+        switch (*s) {
+        case '"': g_string_append(out, "\\\""); break;
+        case '\\': g_string_append(out, "\\\\"); break;
+        case '\n': g_string_append(out, "\\n"); break;
+        case '\r': g_string_append(out, "\\r"); break;
+        case '\t': g_string_append(out, "\\t"); break;
+        default: g_string_append_printf(out, "\\u%04x", (unsigned char)*s);
+        }
+        ++s;
+    }
+
+    g_string_append_c(out, '"');
+}
+
+void dc_util_json_key(GString *out, char const *key)
+{
+    char last = 0;
+
+    return_if_true(out == NULL || key == NULL,);
+
+    last = (out->len > 0 ? out->str[out->len-1] : '\0');
+    if (last != '{' && last != '[' && last != '\0') {
+        g_string_append_c(out, ',');
+    }
+
+    dc_util_json_string(out, key);
+    g_string_append_c(out, ':');
+}
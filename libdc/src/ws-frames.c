@@ -19,29 +19,97 @@
 #include <dc/gateway.h>
 #include "internal.h"
 
-static uint8_t *
-websocket_mask(uint8_t key[4], uint8_t const *pload, size_t psize)
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# include <immintrin.h>
+# define DC_HAVE_AVX2
+#endif
+
+/* The key repeats every four bytes, and all the blocks below are multiples
+ * of four, so the key never has to be rotated. Only the tail is done byte
+ * by byte.
+ */
+static void
+websocket_mask_scalar(uint8_t *dst, uint8_t const *src, size_t len,
+                      uint8_t const key[4], size_t i)
 {
+    uint32_t k32 = 0;
+    uint64_t k64 = 0, v = 0;
+
+    memcpy(&k32, key, sizeof(k32));
+    k64 = ((uint64_t)k32 << 32) | k32;
+
+    for (; i + sizeof(v) <= len; i += sizeof(v)) {
+        memcpy(&v, src + i, sizeof(v));
+        v ^= k64;
+        memcpy(dst + i, &v, sizeof(v));
+    }
+
+    for (; i < len; i++) {
+        dst[i] = src[i] ^ key[i % 4];
+    }
+}
+
+#ifdef DC_HAVE_AVX2
+__attribute__((target("avx2")))
+static size_t
+websocket_mask_avx2(uint8_t *dst, uint8_t const *src, size_t len,
+                    uint32_t k32)
+{
+    __m256i k = _mm256_set1_epi32(k32);
     size_t i = 0;
-    uint8_t *ret = calloc(psize, sizeof(char));
 
-    for (i = 0; i < psize; i++) {
-        ret[i] = pload[i] ^ key[i % 4];
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((__m256i const *)(src + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_xor_si256(v, k));
     }
 
-    return ret;
+    return i;
 }
+#endif
 
-uint8_t *
-dc_gateway_makeframe(uint8_t const *d, size_t data_len,
-                     uint8_t type, size_t *outlen)
+#ifdef __SSE2__
+static size_t
+websocket_mask_sse2(uint8_t *dst, uint8_t const *src, size_t len,
+                    uint32_t k32)
+{
+    __m128i k = _mm_set1_epi32(k32);
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((__m128i const *)(src + i));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(v, k));
+    }
+
+    return i;
+}
+#endif
+
+void
+dc_gateway_mask(uint8_t *dst, uint8_t const *src, size_t len,
+                uint8_t const key[4])
 {
-    uint8_t *data = NULL;
-    uint8_t *full_data;
-    uint32_t len_size = 1;
-    uint8_t mkey[4] = { 0x12, 0x34, 0x56, 0x78 };
+    size_t i = 0;
+    uint32_t k32 = 0;
+
+    memcpy(&k32, key, sizeof(k32));
+
+#ifdef DC_HAVE_AVX2
+    if (len >= 64 && __builtin_cpu_supports("avx2")) {
+        i = websocket_mask_avx2(dst, src, len, k32);
+    }
+#endif
 
-    data = websocket_mask(mkey, d, data_len);
+#ifdef __SSE2__
+    i += websocket_mask_sse2(dst + i, src + i, len - i, k32);
+#endif
+
+    websocket_mask_scalar(dst, src, len, key, i);
+}
+
+size_t
+dc_gateway_frame_size(size_t data_len)
+{
+    size_t len_size = 1;
 
     if (data_len > 125) {
         if (data_len <= UINT16_MAX) {
@@ -51,111 +119,154 @@ dc_gateway_makeframe(uint8_t const *d, size_t data_len,
         }
     }
 
-    full_data = calloc(1 + data_len + len_size + 4, sizeof(uint8_t));
+    /* type, length, key, payload
+     */
+    return 1 + len_size + 4 + data_len;
+}
+
+size_t
+dc_gateway_makeframe_into(uint8_t *out, size_t outsize,
+                          uint8_t const *d, size_t data_len, uint8_t type)
+{
+    size_t idx = 0, size = dc_gateway_frame_size(data_len);
+    uint32_t r = g_random_int();
+    uint8_t mkey[4] = {0};
+
+    return_if_true(out == NULL || outsize < size, 0);
+
+    memcpy(mkey, &r, sizeof(mkey));
 
     if (type == 0) {
         type = 129;
     }
 
-    full_data[0] = type;
+    out[idx++] = type;
 
     if (data_len <= 125) {
-        full_data[1] = data_len | 0x80;
+        out[idx++] = data_len | 0x80;
     } else if (data_len <= G_MAXUINT16) {
         uint16_t be_len = GUINT16_TO_BE(data_len);
-        full_data[1] = 126 | 0x80;
-        memmove(full_data + 2, &be_len, 2);
+        out[idx++] = 126 | 0x80;
+        memcpy(out + idx, &be_len, 2);
+        idx += 2;
     } else {
         guint64 be_len = GUINT64_TO_BE(data_len);
-        full_data[1] = 127 | 0x80;
-        memmove(full_data + 2, &be_len, 8);
+        out[idx++] = 127 | 0x80;
+        memcpy(out + idx, &be_len, 8);
+        idx += 8;
     }
 
-    memmove(full_data + (1 + len_size), &mkey, 4);
-    memmove(full_data + (1 + len_size + 4), data, data_len);
+    memcpy(out + idx, mkey, 4);
+    idx += 4;
 
-    *outlen = 1 + data_len + len_size + 4;
-    free(data);
+    /* mask straight into place, no intermediate copy
+     */
+    dc_gateway_mask(out + idx, d, data_len, mkey);
+
+    return size;
+}
+
+uint8_t *
+dc_gateway_makeframe(uint8_t const *d, size_t data_len,
+                     uint8_t type, size_t *outlen)
+{
+    size_t size = dc_gateway_frame_size(data_len);
+    uint8_t *full_data = malloc(size);
+
+    return_if_true(full_data == NULL, NULL);
+
+    *outlen = dc_gateway_makeframe_into(full_data, size, d, data_len, type);
 
     return full_data;
 }
 
 size_t
-dc_gateway_parseframe(uint8_t const *data, size_t datalen,
-                      uint8_t *type, uint8_t **outdata, size_t *outlen)
+dc_gateway_parseheader(uint8_t const *data, size_t datalen, uint8_t *type,
+                       size_t *outlen)
 {
-    size_t ret = 0;
     uint8_t t = 0, l = 0;
     size_t idx = 0, data_len = 0;
-    uint8_t *buf = NULL;
 
-    goto_if_true(data == NULL || datalen == 0, cleanup);
+    return_if_true(data == NULL || datalen < 2, 0);
 
-    goto_if_true(datalen <= idx, cleanup);
     t = data[idx];
 
     switch (t) {
+    case GATEWAY_FRAME_CONTINUE:
+    case GATEWAY_FRAME_CONTINUE_END:
+    case GATEWAY_FRAME_TEXT_DATA_START:
     case GATEWAY_FRAME_TEXT_DATA:
+    case GATEWAY_FRAME_BINARY_DATA_START:
+    case GATEWAY_FRAME_BINARY_DATA:
     case GATEWAY_FRAME_DISCONNECT:
     case GATEWAY_FRAME_PING:
     case GATEWAY_FRAME_PONG:
         break;
 
-    default: return false;
+    default: return 0;
     }
 
     ++idx;
-    goto_if_true(datalen <= idx, cleanup);
-    l = data[idx];
+    l = data[idx] & 0x7F;
+    ++idx;
 
     if (l <= 125) {
         data_len = l;
-        ++idx;
     } else if (l == 126) {
         /* read an uint16_t from the data
          */
         uint16_t len = 0;
 
-        ++idx;
-        goto_if_true(datalen <= idx, cleanup);
+        return_if_true(datalen < idx + sizeof(len), 0);
         memcpy(&len, data+idx, sizeof(len));
 
-        data_len = GUINT16_TO_BE(len);
+        data_len = GUINT16_FROM_BE(len);
         idx += sizeof(len);
     } else if (l == 127) {
-        /* read an uint16_t from the data
+        /* read an uint64_t from the data
          */
         uint64_t len = 0;
 
-        ++idx;
-        goto_if_true(datalen <= idx, cleanup);
+        return_if_true(datalen < idx + sizeof(len), 0);
         memcpy(&len, data+idx, sizeof(len));
 
-        data_len = GUINT64_TO_BE(len);
+        data_len = GUINT64_FROM_BE(len);
         idx += sizeof(len);
     }
 
-    goto_if_true(datalen < (idx+data_len), cleanup);
-    buf = calloc(data_len, sizeof(uint8_t));
-    goto_if_true(buf == NULL, cleanup);
-
-    memcpy(buf, data+idx, data_len);
-
     if (type != NULL) {
         *type = t;
     }
 
-    if (outdata != NULL) {
-        *outdata = buf;
+    if (outlen != NULL) {
         *outlen = data_len;
-        buf = NULL;
     }
 
-    ret = idx + data_len;
+    return idx;
+}
+
+size_t
+dc_gateway_parseframe(uint8_t const *data, size_t datalen, uint8_t *type,
+                      uint8_t const **outdata, size_t *outlen)
+{
+    size_t idx = 0, data_len = 0;
+
+    idx = dc_gateway_parseheader(data, datalen, type, &data_len);
+    return_if_true(idx == 0, 0);
 
-cleanup:
+    /* frame is not complete yet
+     */
+    return_if_true(data_len > datalen - idx, 0);
 
-    free(buf);
+    /* the payload stays where it is, the caller only borrows it
+     */
+    if (outdata != NULL) {
+        *outdata = data + idx;
+    }
+
+    if (outlen != NULL) {
+        *outlen = data_len;
+    }
 
-    return ret;
+    return idx + data_len;
 }
@@ -28,4 +28,20 @@ ncdc_config_t ncdc_config_new(void);
 
 dc_account_t ncdc_config_account(ncdc_config_t c, char const *name);
 
+/* whether or not to compress the websocket
+ */
+bool ncdc_config_compress(ncdc_config_t c);
+
+/* payload encoding of the websocket, either "json" or "etf"
+ */
+dc_gateway_encoding_t ncdc_config_encoding(ncdc_config_t c);
+
+/* websocket transport, either "curl" or "libevent"
+ */
+dc_gateway_transport_t ncdc_config_transport(ncdc_config_t c);
+
+/* whether to keep REST replies in ~/.config/ncdc/cache across restarts
+ */
+bool ncdc_config_cache(ncdc_config_t c);
+
 #endif
@@ -68,6 +68,9 @@ extern dc_session_t current_session;
 
 extern dc_api_t api;
 extern dc_loop_t loop;
+/* the main thread's base, which runs the UI and session callbacks
+ */
+extern struct event_base *base;
 
 extern char *ncdc_private_dir;
 extern void *config;
@@ -27,6 +27,10 @@ static cfg_opt_t account_opts[] = {
 
 static cfg_opt_t opts[] = {
     CFG_SEC("account", account_opts, CFGF_TITLE|CFGF_MULTI),
+    CFG_BOOL("compress", cfg_false, CFGF_NONE),
+    CFG_STR("encoding", "json", CFGF_NONE),
+    CFG_STR("transport", "curl", CFGF_NONE),
+    CFG_BOOL("cache", cfg_true, CFGF_NONE),
     CFG_END()
 };
 
@@ -98,3 +102,43 @@ dc_account_t ncdc_config_account(ncdc_config_t c, char const *name)
 
     return acc;
 }
+
+bool ncdc_config_compress(ncdc_config_t c)
+{
+    return_if_true(c == NULL, false);
+    return cfg_getbool(c->cfg, "compress");
+}
+
+dc_gateway_encoding_t ncdc_config_encoding(ncdc_config_t c)
+{
+    char const *e = NULL;
+
+    return_if_true(c == NULL, GATEWAY_ENCODING_JSON);
+
+    e = cfg_getstr(c->cfg, "encoding");
+    if (e != NULL && strcmp(e, "etf") == 0) {
+        return GATEWAY_ENCODING_ETF;
+    }
+
+    return GATEWAY_ENCODING_JSON;
+}
+
+bool ncdc_config_cache(ncdc_config_t c)
+{
+    return_if_true(c == NULL, false);
+    return cfg_getbool(c->cfg, "cache");
+}
+
+dc_gateway_transport_t ncdc_config_transport(ncdc_config_t c)
+{
+    char const *t = NULL;
+
+    return_if_true(c == NULL, GATEWAY_TRANSPORT_CURL);
+
+    t = cfg_getstr(c->cfg, "transport");
+    if (t != NULL && strcmp(t, "libevent") == 0) {
+        return GATEWAY_TRANSPORT_BUFFEREVENT;
+    }
+
+    return GATEWAY_TRANSPORT_CURL;
+}
@@ -48,7 +48,7 @@ ncdc_cmd_join(ncdc_mainwindow_t n, size_t ac, wchar_t **av, wchar_t const *f)
             goto cleanup;
         }
 
-        c = dc_guild_channel_by_name(g, channel);
+        c = dc_ref(dc_guild_channel_by_name(g, channel));
         if (c == NULL) {
             LOG(n, L"join: no such channel %s in guild %s", channel, guild);
             goto cleanup;
@@ -86,6 +86,9 @@ ncdc_cmd_join(ncdc_mainwindow_t n, size_t ac, wchar_t **av, wchar_t const *f)
 
 cleanup:
 
+    dc_unref(c);
+    dc_unref(g);
+
     free(guild);
     free(channel);
     free(id);
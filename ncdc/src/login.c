@@ -54,6 +54,16 @@ bool ncdc_cmd_login(ncdc_mainwindow_t n, size_t ac,
         /* enable queueing
          */
         dc_session_enable_queue(s, true);
+        dc_session_set_compress(s, ncdc_config_compress(config));
+        dc_session_set_encoding(s, ncdc_config_encoding(config));
+        dc_session_set_transport(s, ncdc_config_transport(config));
+        /* so anything the session fetches in the background is added
+         * here, and not while the main window is drawing it
+         */
+        dc_api_set_callback_base(dc_session_api(s), base);
+        /* the main window shows new messages
+         */
+        dc_session_subscribe(s, DC_EVENT_TYPE_MESSAGE_CREATE);
 
         g_ptr_array_add(sessions, s);
     } else {
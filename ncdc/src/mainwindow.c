@@ -240,7 +240,20 @@ static void ncdc_mainwindow_render_status(ncdc_mainwindow_t n)
         fwprintf(f, L" [not logged in]");
     } else {
         dc_account_t current_account = dc_session_me(current_session);
+        dc_gateway_t gw = dc_session_gateway(current_session);
+        int64_t in = dc_gateway_reconnect_in(gw);
+
         fwprintf(f, L" [%s]", dc_account_fullname(current_account));
+
+        if (in >= 0 && dc_gateway_state(gw) != GATEWAY_STATE_DISCONNECTED) {
+            fwprintf(f, L" [%s in %ds]",
+                     (dc_gateway_state(gw) == GATEWAY_STATE_CIRCUIT_OPEN ?
+                      "offline, retrying" : "reconnecting"),
+                     (int)((in + G_USEC_PER_SEC - 1) / G_USEC_PER_SEC)
+                );
+        } else if (dc_gateway_state(gw) == GATEWAY_STATE_FAILED) {
+            fwprintf(f, L" [offline, rejected by discord]");
+        }
     }
 
     view = g_ptr_array_index(n->views, n->curview);
@@ -294,9 +307,8 @@ static void ncdc_mainwindow_open_guildchat(ncdc_mainwindow_t n)
 
 void ncdc_mainwindow_update_guilds(ncdc_mainwindow_t n)
 {
-    GHashTableIter iter;
-    gpointer key = NULL, value = NULL;
-    size_t idx = 0;
+    GPtrArray *guilds = NULL;
+    size_t idx = 0, gi = 0;
     GHashTable *parents = NULL;
 
     ncdc_treeitem_clear(n->root);
@@ -305,11 +317,13 @@ void ncdc_mainwindow_update_guilds(ncdc_mainwindow_t n)
         return;
     }
 
+    guilds = dc_session_guilds(current_session);
+    return_if_true(guilds == NULL,);
+
     parents = g_hash_table_new(g_str_hash, g_str_equal);
 
-    g_hash_table_iter_init(&iter, dc_session_guilds(current_session));
-    while (g_hash_table_iter_next(&iter, &key, &value)) {
-        dc_guild_t g = (dc_guild_t)value;
+    for (gi = 0; gi < guilds->len; gi++) {
+        dc_guild_t g = g_ptr_array_index(guilds, gi);
         ncdc_treeitem_t i = ncdc_treeitem_new();
         wchar_t *name = NULL;
 
@@ -388,6 +402,7 @@ void ncdc_mainwindow_update_guilds(ncdc_mainwindow_t n)
     }
 
     g_hash_table_unref(parents);
+    g_ptr_array_unref(guilds);
 }
 
 void ncdc_mainwindow_input_ready(ncdc_mainwindow_t n)
@@ -521,6 +536,7 @@ static void ncdc_mainwindow_handle_events(ncdc_mainwindow_t n)
 
 cleanup:
 
+    dc_unref(c);
     dc_unref(m);
     dc_unref(e);
 }
@@ -581,6 +597,14 @@ void ncdc_mainwindow_close_view(ncdc_mainwindow_t n, int idx)
         return;
     }
 
+    return_if_true((guint)idx >= n->views->len,);
+
+    if (is_logged_in()) {
+        dc_session_cancel_channel(current_session,
+            ncdc_textview_channel(g_ptr_array_index(n->views, idx))
+            );
+    }
+
     n->curview = idx - 1;
     g_ptr_array_remove_index(n->views, idx);
 }
@@ -31,18 +31,24 @@ bool ncdc_cmd_msg(ncdc_mainwindow_t n, size_t ac,
     dc_message_t m = NULL;
     bool ret = false;
     dc_channel_t c = NULL;
+    dc_account_t f = NULL;
+    dc_api_priority_t prio = DC_API_PRIORITY_NORMAL;
 
     if (!is_logged_in()) {
         LOG(n, L"msg: not logged in");
         return false;
     }
 
+    /* both making the channel, and posting to it
+     */
+    prio = dc_api_set_priority(DC_API_PRIORITY_INTERACTIVE);
+
     target = w_convert(av[1]);
     goto_if_true(target == NULL, cleanup);
 
     /* find out if the target is a friend we can contact
      */
-    dc_account_t f = dc_session_account_fullname(current_session, target);
+    f = dc_session_account_fullname(current_session, target);
     if (f == NULL) {
         LOG(n, L"msg: no such account found: \"%s\"", target);
         goto cleanup;
@@ -81,6 +87,10 @@ bool ncdc_cmd_msg(ncdc_mainwindow_t n, size_t ac,
 
 cleanup:
 
+    dc_api_set_priority(prio);
+
+    dc_unref(c);
+    dc_unref(f);
     dc_unref(m);
     free(target);
     free(message);
@@ -37,7 +37,7 @@ ncdc_mainwindow_t mainwin = NULL;
 bool main_done = false;
 bool thread_done = false;
 static pthread_t event_thread;
-static struct event_base *base = NULL;
+struct event_base *base = NULL;
 
 /* all the sessions we currently have around
  */
@@ -75,13 +75,15 @@ static void cleanup(void)
         stdin_ev = NULL;
     }
 
+    dc_unref(api);
+    /* whatever the loop still had fails now, and is delivered to the base
+     */
+    dc_unref(loop);
+
     event_base_loopbreak(base);
     event_base_free(base);
     base = NULL;
 
-    dc_unref(api);
-    dc_unref(loop);
-
     dc_unref(config);
     dc_unref(mainwin);
 }
@@ -115,11 +117,11 @@ static void stdin_handler(int sock, short what, void *data)
 static void *looper(void *arg)
 {
     while (!thread_done) {
+        /* blocks until there is something to do
+         */
         if (!dc_loop_once(loop)) {
             break;
         }
-
-        usleep(10 * 1000);
     }
 
     return NULL;
@@ -160,6 +162,18 @@ static bool init_everything(void)
     config = ncdc_config_new();
     return_if_true(config == NULL, false);
 
+    if (ncdc_config_cache(config)) {
+        char *dir = NULL;
+
+        asprintf(&dir, "%s/cache", ncdc_private_dir);
+        if (dir != NULL) {
+            /* not fatal, it just keeps the replies in memory then
+             */
+            dc_api_set_cache_dir(api, dir);
+            free(dir);
+        }
+    }
+
     sessions = g_ptr_array_new_with_free_func((GDestroyNotify)dc_unref);
     return_if_true(sessions == NULL, false);
 
@@ -27,6 +27,7 @@ bool ncdc_cmd_post(ncdc_mainwindow_t n, size_t ac, wchar_t **av,
     dc_message_t m = NULL;
     dc_channel_t chan = NULL;
     size_t i = 0;
+    dc_api_priority_t prio = DC_API_PRIORITY_NORMAL;
 
     if (!is_logged_in()) {
         return false;
@@ -50,11 +51,15 @@ bool ncdc_cmd_post(ncdc_mainwindow_t n, size_t ac, wchar_t **av,
     m = dc_message_new_content(str, -1);
     goto_if_true(m == NULL, cleanup);
 
+    /* somebody is looking at the input line, waiting for this
+     */
+    prio = dc_api_set_priority(DC_API_PRIORITY_INTERACTIVE);
     ret = dc_api_post_message(
         dc_session_api(current_session),
         dc_session_me(current_session),
         chan, m
         );
+    dc_api_set_priority(prio);
     goto_if_true(ret == false, cleanup);
 
     ret = true;
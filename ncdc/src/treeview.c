@@ -35,7 +35,7 @@ struct ncdc_treeitem_
      */
     GPtrArray *children;
 
-    /* user defined data
+    /* user defined data, a refable object the item keeps a reference of
      */
     void *tag;
 
@@ -68,6 +68,9 @@ static void ncdc_treeitem_free(ncdc_treeitem_t t)
     free(t->content);
     t->content = NULL;
 
+    dc_unref(t->tag);
+    t->tag = NULL;
+
     if (t->children != NULL) {
         g_ptr_array_unref(t->children);
         t->children = NULL;
@@ -137,7 +140,8 @@ void *ncdc_treeitem_tag(ncdc_treeitem_t i)
 void ncdc_treeitem_set_tag(ncdc_treeitem_t i, void *t)
 {
     return_if_true(i == NULL,);
-    i->tag = t;
+    dc_unref(i->tag);
+    i->tag = dc_ref(t);
 }
 
 ncdc_treeitem_t ncdc_treeitem_parent(ncdc_treeitem_t i)